@@ -8,6 +8,8 @@ const CLSID IID_TORTUGASIO_XTREAMER = { 0x25CBA31C, 0x951A, 0x48C6,{ 0xB5, 0x13,
 LPCTSTR const szNameShMem = _T("AudioXtreamer_{25CBA31C-951A-48C6-B513-012E1E2D09D8}_Mem");
 LPCTSTR const szNameAsioEvent = _T("AudioXtreamer_{25CBA31C-951A-48C6-B513-012E1E2D09D8}_AsioEvent");
 LPCTSTR const szNameXtreamerEvent = _T("AudioXtreamer_{25CBA31C-951A-48C6-B513-012E1E2D09D8}_XtreamerEvent");
+LPCTSTR const szNameTraceEvent = _T("AudioXtreamer_{25CBA31C-951A-48C6-B513-012E1E2D09D8}_TraceEvent");
+LPCTSTR const szNameControlEvent = _T("AudioXtreamer_{25CBA31C-951A-48C6-B513-012E1E2D09D8}_ControlEvent");
 LPCTSTR const szNameClass = _T("AudioXtreamer_{25CBA31C-951A-48C6-B513-012E1E2D09D8}_Class");
 LPCTSTR const szNameApp   = _T("TortugASIO Xtreamer");
 
@@ -16,5 +18,10 @@ ASIOSettings::Settings theSettings =
   { 15, 15, 15,_T("NrIns"),     _T("; zero index based number of pcm LR lines")},
   { 15, 15, 15,_T("NrOuts"),    _T("; zero index based number of pcm LR lines")},
   { 64, 64, 255,_T("NrSamples"), _T("; Whats necesary to run smooth using the least 512b usb packets")},
-  { 64, 64, 255,_T("FifoSize"),  _T("; Size of the hardware Out FIFO , multiple of 16")}
+  { 64, 64, 255,_T("FifoSize"),  _T("; Size of the hardware Out FIFO , multiple of 16")},
+  { 0, 0, 2,_T("SampleFormat"), _T("; ASIO sample type 0:Int24LSB 1:Int32LSB 2:Float32LSB")},
+  { 0, 0, 1,_T("DirectMode"), _T("; 1: the asio driver opens the usb device itself, no round trip through AudioXtreamer")},
+  { 16, 16, 32,_T("QueueDepth"), _T("; Nr of NrSamples blocks buffered between the usb device and the asio client")},
+  { 2, 2, 8,_T("XferCount"), _T("; iso requests in flight per direction, more rides out longer stalls at the cost of latency")},
+  { 8, 8, 64,_T("XferPackets"), _T("; iso packets per request, rounded up to what the usb backend takes. 8 at high speed is a request per ms")}
 };
\ No newline at end of file
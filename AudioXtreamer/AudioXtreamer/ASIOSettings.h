@@ -7,7 +7,12 @@ namespace ASIOSettings
     NrOuts = 1,
     NrSamples = 2,
     FifoDepth = 3,
-    MaxSetting = 4
+    SampleFormat = 4,
+    DirectMode = 5,
+    QueueDepth = 6,
+    XferCount = 7,
+    XferPackets = 8,
+    MaxSetting = 9
   };
 
   typedef struct _Settings {
@@ -20,30 +25,43 @@ namespace ASIOSettings
 
 #pragma pack(push,4)
 
+  //the offsets count from the start of the shared memory
   typedef struct _StreamInfo {
     uint32_t RxStride;
     uint32_t RxOffset;
     uint32_t TxStride;
     uint32_t TxOffset;
     uint32_t Flags;
+    //frames per Switch the asio host asked for, published by the client with every alive flag
+    uint32_t BlockFrames;
+    //QPC time in ns the input of the block was complete, written by the device before every switch
+    uint64_t BlockTime;
+    //latency probe result for the client, in frames, flagged with 0x4
+    uint32_t RoundTrip;
   } StreamInfo;
 
 #pragma pack(pop)
 
   static const uint8_t ChanEntires = 16;
+  static const uint8_t MaxChannels = ChanEntires * 2;
+  //asio buffers queued in the shared memory between the device and the client, the QueueDepth setting
+  static const uint8_t MaxQueueDepth = 32;
+  //host buffer sizes the driver accepts, independent of the NrSamples the fpga runs with
+  static const uint16_t MinBlockFrames = 16;
+  static const uint16_t MaxBlockFrames = 1024;
 };
 
+//posted to the tray window, a command waits in the ControlBlock's mailbox
 #define WM_XTREAMER WM_APP + 100
 
-//1MB shared memory for asio buffers
-//should suffice for a 16x deep queue 64ch @ 256samples
-#define SH_MEM_BLK_SIZE_SHIFT 20 
-
-
 extern const CLSID IID_TORTUGASIO_XTREAMER;
 extern LPCTSTR const szNameShMem;
 extern LPCTSTR const szNameAsioEvent;
 extern LPCTSTR const szNameXtreamerEvent;
+//manual reset, set while the pipeline is traced
+extern LPCTSTR const szNameTraceEvent;
+//auto reset, set by AudioXtreamer when it answered the mailbox
+extern LPCTSTR const szNameControlEvent;
 extern LPCTSTR const szNameClass;
 extern LPCTSTR const szNameApp;
 
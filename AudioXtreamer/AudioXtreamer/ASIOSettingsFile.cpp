@@ -24,6 +24,7 @@ ASIOSettingsFile::~ASIOSettingsFile()
 }
 
 const LPCTSTR defDev = _T("DefaultDevice");
+const LPCTSTR latencySection = _T("Latency");
 
 
 
@@ -66,11 +67,40 @@ bool ASIOSettingsFile::Load()
   return result == SI_OK;
 }
 
+void ASIOSettingsFile::Reload()
+{
+  mIni.Reset();
+  mIni.LoadFile(fileName);
+}
+
 bool ASIOSettingsFile::Save()
 {
+  Reload();
   for (int c = 0; c < MaxSetting; ++c)
     mIni.SetLongValue(defDev, mInfo[c].key, mInfo[c].val, mInfo[c].desc);
 
   SI_Error result = mIni.SaveFile(fileName);
   return result == SI_OK;
 }
+
+bool ASIOSettingsFile::LoadLatency(LPCTSTR config, uint32_t &roundTrip)
+{
+  Reload();
+  long val = mIni.GetLongValue(latencySection, config, 0, nullptr);
+  if (val <= 0)
+    return false;
+
+  roundTrip = (uint32_t)val;
+  return true;
+}
+
+bool ASIOSettingsFile::SaveLatency(LPCTSTR config, uint32_t roundTrip)
+{
+  Reload();
+  mIni.SetValue(latencySection, nullptr, nullptr,
+    _T("; measured round trips in frames, the keys are rate_block_ins_outs_fifo_queue_xfers_packets_direct"));
+  mIni.SetLongValue(latencySection, config, (long)roundTrip);
+
+  SI_Error result = mIni.SaveFile(fileName);
+  return result == SI_OK;
+}
@@ -12,7 +12,14 @@ public:
   bool Load();
   bool Save();
 
+  //calibrated round trips in frames, one per configuration key
+  bool LoadLatency(LPCTSTR config, uint32_t &roundTrip);
+  bool SaveLatency(LPCTSTR config, uint32_t roundTrip);
+
 private:
+  //the driver and AudioXtreamer both write the file, each save starts from what is on disk
+  void Reload();
+
     CSimpleIni mIni;
     ASIOSettings::Settings &mInfo;
 };
@@ -8,6 +8,9 @@
 
 #include "MainFrame.h"
 #include "resource.h"
+#include "LockFree\SpinWake.h"
+#include "LockFree\SeqLock.h"
+#include <atomic>
 
 
 #ifdef _DEBUG
@@ -21,13 +24,32 @@ CAudioXtreamerApp theApp;
 CAudioXtreamerApp::CAudioXtreamerApp()
 : hMapFile(NULL)
 , pBuf(nullptr)
+, mLargePages(false)
 , hAsioEvent(NULL)
-, hXtreamerEvent(NULL)
+, hControlEvent(NULL)
 , mDevice(new CypressDevice(*this, theSettings))
 , mClientActive(false)
+, mBlockTime(0)
 {
 }
 
+//large pages need the lock pages in memory right, granted to the user by an administrator
+static bool EnableLockMemory()
+{
+  HANDLE token;
+  if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+    return false;
+
+  TOKEN_PRIVILEGES tp;
+  tp.PrivilegeCount = 1;
+  tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  //AdjustTokenPrivileges succeeds without the right, it only says so in the last error
+  const bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)
+    && AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+  CloseHandle(token);
+  return enabled;
+}
+
 BOOL CAudioXtreamerApp::InitInstance()
 {
   CWinAppEx::InitInstance();
@@ -42,18 +64,43 @@ BOOL CAudioXtreamerApp::InitInstance()
 
   ResetEvent(hAsioEvent);
 
-  hXtreamerEvent = CreateEvent(NULL, FALSE, TRUE, szNameXtreamerEvent);
-  ResetEvent(hXtreamerEvent);
-
-  //Create the named shared memory mapping (4*256k) and synchronization events for IPC
+  hControlEvent = CreateEvent(NULL, FALSE, FALSE, szNameControlEvent);
+
+  //Create the named shared memory mapping, room for the largest configuration the settings allow.
+  //A device start commits what its layout needs, in large pages all of it is there from the start
+
+  SharedLayout largest;
+  const uint32_t maxInStride = ASIOSettings::MaxChannels * 3;
+  const uint32_t maxOutStride = scTxHeaderSize + ASIOSettings::MaxChannels * 3;
+  const uint32_t maxRingFrames = ASIOSettings::MaxQueueDepth * ASIOSettings::MaxBlockFrames;
+  BuildLayout(largest, maxRingFrames * maxInStride, maxRingFrames * maxOutStride, ASIOSettings::MaxBlockFrames * maxOutStride);
+
+  SYSTEM_INFO sysInfo;
+  GetSystemInfo(&sysInfo);
+  uint32_t pageSize = sysInfo.dwPageSize;
+  uint32_t mapSize = largest.Size;
+
+  const SIZE_T largePage = EnableLockMemory() ? GetLargePageMinimum() : 0;
+  if (largePage != 0) {
+    const uint32_t size = (uint32_t)((mapSize + largePage - 1) / largePage * largePage);
+    hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, 0, size, szNameShMem);
+    if (hMapFile != NULL) {
+      mLargePages = true;
+      pageSize = (uint32_t)largePage;
+      mapSize = size;
+    }
+    else
+      LOGN("CAudioXtreamerApp large pages refused (%u)\n", GetLastError());
+  }
 
-  hMapFile = CreateFileMapping(
-    INVALID_HANDLE_VALUE,    // use paging file
-    NULL,                    // default security
-    PAGE_READWRITE,          // read/write access
-    0,                       // maximum object size (high-order DWORD)
-    (4 << SH_MEM_BLK_SIZE_SHIFT),  // maximum object size (low-order DWORD)
-    szNameShMem);            // name of mapping object
+  if (hMapFile == NULL)
+    hMapFile = CreateFileMapping(
+      INVALID_HANDLE_VALUE,    // use paging file
+      NULL,                    // default security
+      PAGE_READWRITE | SEC_RESERVE, // read/write access, committed on demand
+      0,                       // maximum object size (high-order DWORD)
+      mapSize,                 // maximum object size (low-order DWORD)
+      szNameShMem);            // name of mapping object
 
   if (hMapFile == NULL) {
     _tprintf(TEXT("Could not create file mapping object (%d).\n"), GetLastError());
@@ -66,13 +113,37 @@ BOOL CAudioXtreamerApp::InitInstance()
     0,
     0);
 
-  if (pBuf == NULL) {
+  if (pBuf == NULL || (!mLargePages && VirtualAlloc(pBuf, scLayoutHeaderSize, MEM_COMMIT, PAGE_READWRITE) == NULL)) {
     _tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
+    if (pBuf != NULL)
+      UnmapViewOfFile(pBuf);
+    pBuf = nullptr;
     CloseHandle(hMapFile);
+    hMapFile = NULL;
 
     return FALSE;
   }
 
+  //the usb worker touches it all in real time, the working set gets room to keep it locked
+  SIZE_T wsMin, wsMax;
+  if (!mLargePages && GetProcessWorkingSetSize(GetCurrentProcess(), &wsMin, &wsMax))
+    SetProcessWorkingSetSize(GetCurrentProcess(), wsMin + mapSize, max(wsMax, wsMin + mapSize));
+  PrefaultPages(pBuf, scLayoutHeaderSize);
+
+  //no rings until the device starts, the magic goes last
+  SharedLayout* layout = (SharedLayout*)pBuf;
+  layout->PageSize = pageSize;
+  layout->Reserved = mapSize;
+  layout->Size = scLayoutHeaderSize;
+  layout->Version = scLayoutVersion;
+  std::atomic_thread_fence(std::memory_order_release);
+  layout->Magic = scLayoutMagic;
+  LOGN("CAudioXtreamerApp shared memory %u bytes reserved in %u byte pages\n", mapSize, pageSize);
+
+  PublishControl(0, (uint32_t)(-1));
+  if (!mClients.Init(pBuf))
+    return FALSE;
+
   pMainFrame = new MainFrame(*mDevice);
   if (pMainFrame == nullptr || !pMainFrame->Create(szNameClass, szNameApp))
     return FALSE;
@@ -88,46 +159,80 @@ BOOL CAudioXtreamerApp::InitInstance()
 }
 
 //Callback from the USB driver
-//we dont process the data here, just signal the client that the data is ready in the shared memory
-//pass the strides and offsets to the shared struct.
-// signal the xtreamer event and leave
-// later we will wait for completion
+//we dont process the data here, just signal the clients that the data is ready in the shared memory,
+//the device polls SwitchComplete for their answers
 
-bool CAudioXtreamerApp::Switch(uint32_t timeout, uint32_t rxSampleSize, uint8_t * rxBuff, uint32_t txSampleSize, uint8_t * txBuff)
+bool CAudioXtreamerApp::Switch(uint32_t frames, uint32_t rxSampleSize, uint8_t * rxBuff, uint32_t txSampleSize, uint8_t * txBuff)
 {
-  volatile ASIOSettings::StreamInfo *info = (ASIOSettings::StreamInfo *)pBuf;
-
-  info->Flags &= ~((uint32_t)0x2);
-
-  info->RxStride = rxSampleSize;
-  info->RxOffset = (uint32_t)(rxBuff - pBuf) - (1 << SH_MEM_BLK_SIZE_SHIFT);
-  info->TxStride = txSampleSize;
-  info->TxOffset = (uint32_t)(txBuff - pBuf) - (2 << SH_MEM_BLK_SIZE_SHIFT);
-
-  if (SetEvent(hXtreamerEvent) == FALSE)
-  {
-    DWORD error = GetLastError();
-    _tprintf(TEXT("Could not release Mutex (%d).\n"), error);
-  }
+  mClients.Switch(frames, rxSampleSize, rxBuff, txSampleSize, txBuff, mBlockTime, mDevice->GetSampleRate());
+  return mClientActive;
+}
 
+bool CAudioXtreamerApp::SwitchComplete()
+{
+  return mClients.Complete();
+}
 
-  return mClientActive;
+uint32_t CAudioXtreamerApp::SwitchWaitMs()
+{
+  return mClients.WaitMs();
 }
 
 bool CAudioXtreamerApp::ClientPresent()
 {
-  volatile ASIOSettings::StreamInfo* info = (ASIOSettings::StreamInfo*)pBuf;
-  mClientActive = info->Flags & (uint32_t)0x1 ? true : false;
-  info->Flags &= ~(uint32_t)0x1;
+  mClientActive = mClients.Present();
   return mClientActive;
 }
 
-void CAudioXtreamerApp::AllocBuffers(uint32_t rxSize, uint8_t *& rxBuff, uint32_t txSize, uint8_t *& txBuff)
+uint32_t CAudioXtreamerApp::BlockFrames()
+{
+  return mClients.BlockFrames();
+}
+
+void CAudioXtreamerApp::SetBlockTime(uint64_t ns)
+{
+  mBlockTime = ns;
+}
+
+//lays the rings out for the configuration the device starts with, committed, zeroed and locked
+//before the first block
+bool CAudioXtreamerApp::AllocBuffers(uint32_t rxSize, uint8_t *& rxBuff, uint32_t txSize, uint8_t *& txBuff, uint32_t slotTxSize)
 {
-  ZeroMemory(pBuf, (4 << SH_MEM_BLK_SIZE_SHIFT));
-  rxBuff = (uint8_t*)(pBuf + (1 << SH_MEM_BLK_SIZE_SHIFT));
-  txBuff = (uint8_t*)(pBuf + (2 << SH_MEM_BLK_SIZE_SHIFT));
+  SharedLayout* layout = (SharedLayout*)pBuf;
+  SharedLayout next;
+  BuildLayout(next, rxSize, txSize, slotTxSize);
+  rxBuff = txBuff = nullptr;
+  if (next.Size > layout->Reserved) {
+    LOGN("CAudioXtreamerApp::AllocBuffers %u bytes do not fit in the %u reserved\n", next.Size, layout->Reserved);
+    return false;
+  }
+  if (!mLargePages && VirtualAlloc(pBuf + scLayoutHeaderSize, next.Size - scLayoutHeaderSize, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+    LOGN("CAudioXtreamerApp::AllocBuffers could not commit %u bytes (%u)\n", next.Size, GetLastError());
+    return false;
+  }
+
+  //the first block outlives the stream: a driver may be waiting on the mailbox for the restart,
+  //the wake counters go on and the clients keep their slots
+  ZeroMemory(pBuf + next.RxOffset, next.Size - next.RxOffset);
+  if (!PrefaultPages(pBuf + next.RxOffset, next.Size - next.RxOffset))
+    LOGN("CAudioXtreamerApp::AllocBuffers could not lock %u bytes (%u)\n", next.Size, GetLastError());
+
+  SeqLock::WriteBegin(layout->Sequence);
+  layout->Size = next.Size;
+  layout->RxOffset = next.RxOffset;
+  layout->RxSize = next.RxSize;
+  layout->TxOffset = next.TxOffset;
+  layout->TxSize = next.TxSize;
+  layout->SlotTxOffset = next.SlotTxOffset;
+  layout->SlotTxSize = next.SlotTxSize;
+  SeqLock::WriteEnd(layout->Sequence);
+  LOGN("CAudioXtreamerApp::AllocBuffers %u bytes in use, rx %u tx %u client blocks %u\n", next.Size, rxSize, txSize, next.SlotTxSize);
+
+  rxBuff = pBuf + next.RxOffset;
+  txBuff = pBuf + next.TxOffset;
+  mClients.Reset();
   mClientActive = false;
+  return true;
 }
 
 void CAudioXtreamerApp::FreeBuffers(uint8_t *& rxBuff, uint8_t *& txBuff)
@@ -147,8 +252,95 @@ void CAudioXtreamerApp::DeviceStopped(bool error)
 void CAudioXtreamerApp::SampleRateChanged()
 {
   LOG0("CAudioXtreamerApp::SampleRateChanged");
-  ASIOSettings::StreamInfo *info = (ASIOSettings::StreamInfo *)pBuf;
-  info->Flags |= ((uint32_t)0x2);
+  //the drivers ask for the new rate as soon as they hear of it
+  ControlBlock* ctl = (ControlBlock*)(pBuf + scControlOffset);
+  ctl->SampleRate = mDevice->GetSampleRate();
+  mClients.SetFlag(0x2);
+}
+
+//the asio drivers keep the calibration, they pick the result up with the next switch
+void CAudioXtreamerApp::LatencyMeasured(uint32_t roundTrip)
+{
+  LOGN("CAudioXtreamerApp::LatencyMeasured %u\n", roundTrip);
+  mClients.SetFlag(0x4, roundTrip);
+}
+
+//the driver's answers, the usb worker spins on it before it sleeps
+WakeWord* CAudioXtreamerApp::SwitchWake()
+{
+  return pBuf != nullptr ? &((WakeBlock*)(pBuf + scWakeOffset))->ToDevice : nullptr;
+}
+
+//both processes publish their half of it, the control panel shows it
+DriverLoad* CAudioXtreamerApp::LoadBlock()
+{
+  return pBuf != nullptr ? (DriverLoad*)(pBuf + scDriverLoadOffset) : nullptr;
+}
+
+//written by the usb worker, here or in a direct mode host, the control panel reads it
+Telemetry* CAudioXtreamerApp::TelemetryBlock()
+{
+  return pBuf != nullptr ? (Telemetry*)(pBuf + scTelemetryOffset) : nullptr;
+}
+
+void CAudioXtreamerApp::SetDirectOwner(DWORD owner)
+{
+  DirectInfo* direct = (DirectInfo*)(pBuf + scDirectInfoOffset);
+  if (owner != 0)
+    ZeroMemory(direct, sizeof(DirectInfo));
+  direct->Owner = owner;
+}
+
+DWORD CAudioXtreamerApp::GetDirectOwner()
+{
+  volatile DirectInfo* direct = (DirectInfo*)(pBuf + scDirectInfoOffset);
+  return direct->Owner;
+}
+
+bool CAudioXtreamerApp::RequestDirectProbe()
+{
+  volatile DirectInfo* direct = (DirectInfo*)(pBuf + scDirectInfoOffset);
+  if (direct->Owner == 0)
+    return false;
+
+  direct->ProbeRequests++;
+  return true;
+}
+
+void CAudioXtreamerApp::PublishControl(uint32_t flags, uint32_t sampleRate)
+{
+  ControlBlock* ctl = (ControlBlock*)(pBuf + scControlOffset);
+  ctl->SampleRate = sampleRate;
+  ctl->Flags = flags;
+}
+
+uint32_t CAudioXtreamerApp::GetControlFlags()
+{
+  ControlBlock* ctl = (ControlBlock*)(pBuf + scControlOffset);
+  return ctl->Flags;
+}
+
+//false if there is no command waiting
+bool CAudioXtreamerApp::TakeControl(uint32_t& request, uint32_t& command, uint32_t& arg)
+{
+  ControlBlock* ctl = (ControlBlock*)(pBuf + scControlOffset);
+  request = ctl->Request;
+  if (ctl->Owner == 0 || ctl->Done == request)
+    return false;
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  command = ctl->Command;
+  arg = ctl->Arg;
+  return true;
+}
+
+void CAudioXtreamerApp::ControlDone(uint32_t request, uint32_t result)
+{
+  ControlBlock* ctl = (ControlBlock*)(pBuf + scControlOffset);
+  ctl->Result = result;
+  std::atomic_thread_fence(std::memory_order_release);
+  ctl->Done = request;
+  SetEvent(hControlEvent);
 }
 
 int CAudioXtreamerApp::ExitInstance()
@@ -169,9 +361,11 @@ int CAudioXtreamerApp::ExitInstance()
     hAsioEvent = NULL;
   }
 
-  if (hXtreamerEvent != NULL) {
-    CloseHandle(hXtreamerEvent);
-    hXtreamerEvent = NULL;
+  mClients.Close();
+
+  if (hControlEvent != NULL) {
+    CloseHandle(hControlEvent);
+    hControlEvent = NULL;
   }
 
   if(pBuf && !UnmapViewOfFile(pBuf))
@@ -6,6 +6,7 @@
 
 #include "resource.h"		// main symbols
 #include "usbdev\usbdev.h"
+#include "ClientMix.h"
 
 
 // CAudioXtreamerApp:
@@ -20,25 +21,49 @@ public:
 
 public:
   BOOL InitInstance() override;
-  bool Switch(uint32_t timeout, uint32_t rxSampleSize, uint8_t *rxBuff, uint32_t txSampleSize, uint8_t *txBuff) override;
+  bool Switch(uint32_t frames, uint32_t rxSampleSize, uint8_t *rxBuff, uint32_t txSampleSize, uint8_t *txBuff) override;
+  bool SwitchComplete() override;
+  uint32_t SwitchWaitMs() override;
   HANDLE GetSwitchHandle() override { return hAsioEvent; };
+  WakeWord* SwitchWake() override;
   bool ClientPresent() override;
-  void AllocBuffers(uint32_t rxSize, uint8_t *&rxBuff, uint32_t txSize, uint8_t *&txBuff) override;
+  uint32_t BlockFrames() override;
+  void SetBlockTime(uint64_t ns) override;
+  bool AllocBuffers(uint32_t rxSize, uint8_t *&rxBuff, uint32_t txSize, uint8_t *&txBuff, uint32_t slotTxSize) override;
   void FreeBuffers(uint8_t *&rxBuff, uint8_t *&txBuff) override;
   void DeviceStopped(bool error) override;
   void SampleRateChanged() override;
+  void LatencyMeasured(uint32_t roundTrip) override;
+  DriverLoad* LoadBlock() override;
+  Telemetry* TelemetryBlock() override;
 
   bool IsClientActive() { return mClientActive; }
 
+  //direct mode sideband, the asio host owning the usb device and the probes asked of it
+  void SetDirectOwner(DWORD owner);
+  DWORD GetDirectOwner();
+  bool RequestDirectProbe();
+
+  //the asio drivers' control block, the state words and the mailbox
+  void PublishControl(uint32_t flags, uint32_t sampleRate);
+  uint32_t GetControlFlags();
+  bool TakeControl(uint32_t& request, uint32_t& command, uint32_t& arg);
+  void ControlDone(uint32_t request, uint32_t result);
+
 protected:
 
   HANDLE hMapFile;
   uint8_t* pBuf;
+  //the mapping came committed in large pages, otherwise it is reserved and committed as the layout grows
+  bool mLargePages;
   HANDLE hAsioEvent;
-  HANDLE hXtreamerEvent;
+  HANDLE hControlEvent;
   UsbDevice * mDevice;
   MainFrame * pMainFrame;
   bool mClientActive;
+  //the asio drivers, their blocks and the mix of their outputs
+  ClientMix mClients;
+  uint64_t mBlockTime;
   bool mSwitchWait;
 
   int ExitInstance() override;
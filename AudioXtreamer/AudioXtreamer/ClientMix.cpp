@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "ClientMix.h"
+#include "PcmConv\PcmConv.h"
+#include "LockFree\SpinWake.h"
+#include <atomic>
+
+//Stream.Flags is written by the drivers too, every change is one interlocked operation
+static void ClearFlags(volatile ClientSlot& slot, uint32_t flags)
+{
+  InterlockedAnd((volatile LONG*)&slot.Stream.Flags, ~(LONG)flags);
+}
+
+static void SetFlags(volatile ClientSlot& slot, uint32_t flags)
+{
+  InterlockedOr((volatile LONG*)&slot.Stream.Flags, (LONG)flags);
+}
+
+//a client that didn't say it was alive for that long is gone, the drivers do so at least once a second
+static const int64_t scAliveSeconds = 2;
+
+ClientMix::ClientMix()
+  : mSlots(nullptr)
+  , mShared(nullptr)
+  , mFed(0)
+  , mMixing(false)
+  , mDirect(0)
+  , mClearBlocks(0)
+  , mFrames(0)
+  , mTxStride(0)
+  , mTxBuff(nullptr)
+  , mStart(0)
+  , mPeriod(0)
+  , mQpcFreq(1)
+{
+  for (uint32_t i = 0; i < scMaxClients; i++)
+    mEvents[i] = NULL;
+  Reset();
+}
+
+bool ClientMix::Init(uint8_t* shared)
+{
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  mQpcFreq = freq.QuadPart;
+  PcmConv::Isa isa = PcmConv::Init();
+  LOGN("ClientMix::Init %s mixing\n", PcmConv::IsaName(isa));
+  mShared = shared;
+  mSlots = (ClientSlot*)(shared + scClientSlotOffset);
+
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    TCHAR name[MAX_PATH];
+    SlotEventName(i, name, MAX_PATH);
+    mEvents[i] = CreateEvent(NULL, FALSE, FALSE, name);
+    if (mEvents[i] == NULL)
+      return false;
+  }
+  return true;
+}
+
+void ClientMix::Close()
+{
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    if (mEvents[i] != NULL) {
+      CloseHandle(mEvents[i]);
+      mEvents[i] = NULL;
+    }
+  }
+  mSlots = nullptr;
+  mShared = nullptr;
+}
+
+void ClientMix::Reset()
+{
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    mPresent[i] = false;
+    mSeen[i] = 0;
+    mBlock[i] = mSlots != nullptr ? mSlots[i].Done : 0;
+    mLate[i] = false;
+  }
+  mFed = 0;
+  mMixing = false;
+  mDirect = 0;
+  mClearBlocks = 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool ClientMix::Present()
+{
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+
+  bool any = false;
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    volatile ClientSlot& slot = mSlots[i];
+    const uint32_t flags = slot.Stream.Flags;
+    if (slot.Owner == 0 || (flags & 0x8))
+      mPresent[i] = false;
+    else if (flags & 0x1) {
+      ClearFlags(slot, 0x1);
+      mSeen[i] = now.QuadPart;
+      mPresent[i] = true;
+    }
+    else if (now.QuadPart - mSeen[i] > scAliveSeconds * mQpcFreq)
+      mPresent[i] = false;
+    any |= mPresent[i];
+  }
+  return any;
+}
+
+uint32_t ClientMix::BlockFrames()
+{
+  for (uint32_t i = 0; i < scMaxClients; i++)
+    if (mPresent[i])
+      return mSlots[i].Stream.BlockFrames;
+  return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void ClientMix::Switch(uint32_t frames, uint32_t rxStride, const uint8_t* rxBuff, uint32_t txStride, uint8_t* txBuff,
+  uint64_t blockTime, uint32_t sampleRate)
+{
+  //a client still on its last block sits this one out
+  mFed = 0;
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    if (mPresent[i] && mSlots[i].Stream.BlockFrames == frames && mSlots[i].Done == mBlock[i])
+      mFed |= 1 << i;
+  }
+  mMixing = (mFed & (mFed - 1)) != 0;
+
+  //a client alone writes only its OutMask into the ring block. Once the ring was mixed or written by
+  //another client, every ring block gets silence before its first turn, until the ring went round
+  if (mFed != 0) {
+    if (!mMixing && mFed != mDirect)
+      mClearBlocks = ASIOSettings::MaxQueueDepth;
+    mDirect = mMixing ? 0 : mFed;
+  }
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  mStart = now.QuadPart;
+  mPeriod = (int64_t)frames * mQpcFreq / (sampleRate != 0 && sampleRate != (uint32_t)-1 ? sampleRate : 48000);
+  mFrames = frames;
+  mTxStride = txStride;
+  mTxBuff = txBuff;
+  if (mDirect != 0 && mClearBlocks > 0) {
+    mClearBlocks--;
+    Silence();
+  }
+
+  //written on this thread when the device started
+  const SharedLayout& layout = *(const SharedLayout*)mShared;
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    if (!(mFed & (1 << i)))
+      continue;
+
+    volatile ClientSlot& slot = mSlots[i];
+    ClearFlags(slot, 0x2);
+    slot.Stream.RxStride = rxStride;
+    slot.Stream.RxOffset = (uint32_t)(rxBuff - mShared);
+    slot.Stream.TxStride = txStride;
+    slot.Stream.TxOffset = mMixing ? SlotTxOffset(layout, i) : (uint32_t)(txBuff - mShared);
+    slot.Stream.BlockTime = blockTime;
+    mBlock[i] = slot.Block + 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.Block = mBlock[i];
+
+    if (!SpinWake::Signal((WakeWord*)&slot.ToClient, mEvents[i]))
+      LOGN("ClientMix::Switch slot %u SetEvent error %u\n", i, GetLastError());
+  }
+}
+
+bool ClientMix::Complete()
+{
+  if (mFed == 0)
+    return true;
+
+  bool all = true;
+  for (uint32_t i = 0; i < scMaxClients; i++)
+    if ((mFed & (1 << i)) && mSlots[i].Done != mBlock[i])
+      all = false;
+
+  //a client alone has the ring block, there is nothing to go on with without it
+  if (!all) {
+    if (!mMixing)
+      return false;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    if (now.QuadPart - mStart < mPeriod)
+      return false;
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (mMixing)
+    Mix();
+  else {
+    //a client alone answers a block with the rate changed without writing the ring block
+    for (uint32_t i = 0; i < scMaxClients; i++)
+      if ((mFed & (1 << i)) && (mSlots[i].Stream.Flags & 0x2))
+        Silence();
+  }
+  mFed = 0;
+  return true;
+}
+
+uint32_t ClientMix::WaitMs()
+{
+  if (mFed == 0)
+    return 0;
+  if (!mMixing)
+    return INFINITE;
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  const int64_t left = mStart + mPeriod - now.QuadPart;
+  return left > 0 ? (uint32_t)((left * 1000 + mQpcFreq - 1) / mQpcFreq) : 0;
+}
+
+void ClientMix::Silence()
+{
+  for (uint32_t f = 0; f < mFrames; f++) {
+    uint8_t* frame = mTxBuff + f * mTxStride;
+    *(uint32_t*)frame = scTxHeaderMark;
+    ZeroMemory(frame + scTxHeaderSize, mTxStride - scTxHeaderSize);
+  }
+}
+
+//the ring block starts as silence, the clients that answered are added on their outputs
+void ClientMix::Mix()
+{
+  Silence();
+
+  const uint32_t nrOuts = (mTxStride - scTxHeaderSize) / 3;
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    if (!(mFed & (1 << i)))
+      continue;
+
+    volatile ClientSlot& slot = mSlots[i];
+    if (slot.Done != mBlock[i]) {
+      slot.Late++;
+      if (!mLate[i])
+        LOGN("ClientMix slot %u late, left out of the mix\n", i);
+      mLate[i] = true;
+      continue;
+    }
+    mLate[i] = false;
+
+    //the rate changed, the client may have answered without writing its block
+    if (slot.Stream.Flags & 0x2)
+      continue;
+
+    uint8_t active[ASIOSettings::MaxChannels];
+    const uint32_t mask = slot.OutMask;
+    for (uint32_t c = 0; c < nrOuts; c++)
+      active[c] = (mask >> c) & 1;
+    PcmConv::Plan plan;
+    plan.Build(active, nrOuts);
+
+    const uint8_t* src = mShared + SlotTxOffset(*(const SharedLayout*)mShared, i);
+    PcmConv::Mix(mTxBuff + scTxHeaderSize, mTxStride, src + scTxHeaderSize, mTxStride, plan, mFrames);
+  }
+}
+
+//---------------------------------------------------------------------------------------------
+
+void ClientMix::SetFlag(uint32_t flag, uint32_t roundTrip)
+{
+  for (uint32_t i = 0; i < scMaxClients; i++) {
+    volatile ClientSlot& slot = mSlots[i];
+    if (slot.Owner == 0)
+      continue;
+    if (flag & 0x4)
+      slot.Stream.RoundTrip = roundTrip;
+    SetFlags(slot, flag);
+  }
+}
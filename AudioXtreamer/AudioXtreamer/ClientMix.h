@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include "UsbDev\UsbDev.h"
+
+/*The asio drivers attached to AudioXtreamer, one ClientSlot each in the shared memory
+
+  Every block goes to all the clients present that run the block size of the first one. They read
+  the input block in place. A client alone writes its output straight into the ring, the device waits
+  for it as it always did. With more than one, each writes to a block of its own, and once all of
+  them answered or the block period went by, the ones that answered are summed into the ring. A late
+  client is left out of that block and of the following ones until it answered, the others don't wait
+  for it.
+  Everything here runs on the usb worker thread.
+*/
+class ClientMix
+{
+public:
+  ClientMix();
+
+  //the slots in the first shared memory block, their tx blocks where the layout says. Creates the slot events
+  bool Init(uint8_t* shared);
+  void Close();
+
+  //a new stream, whatever was handed out is forgotten
+  void Reset();
+
+  //takes up the alive flags, true if any client is present
+  bool Present();
+  //the block size of the first client present, 0 without one
+  uint32_t BlockFrames();
+
+  //hands the block to the clients present, txBuff is the ring block the output goes to
+  void Switch(uint32_t frames, uint32_t rxStride, const uint8_t* rxBuff, uint32_t txStride, uint8_t* txBuff,
+    uint64_t blockTime, uint32_t sampleRate);
+  //true once the block is done, mixed if there was more than one client
+  bool Complete();
+  //ms until Complete goes on without the clients that haven't answered, INFINITE for a client alone
+  uint32_t WaitMs();
+
+  //sets a Stream flag for every client attached, with the round trip for 0x4
+  void SetFlag(uint32_t flag, uint32_t roundTrip = 0);
+
+private:
+  void Mix();
+  //the ring block as silent tx frames
+  void Silence();
+
+  ClientSlot* mSlots;
+  uint8_t* mShared;
+  HANDLE mEvents[scMaxClients];
+
+  //per slot: present, the last time it said it was alive, the block it was handed, late since when
+  bool mPresent[scMaxClients];
+  int64_t mSeen[scMaxClients];
+  uint32_t mBlock[scMaxClients];
+  bool mLate[scMaxClients];
+
+  //the block out: the slots it went to and if their outputs are mixed
+  uint32_t mFed;
+  bool mMixing;
+  //the slot that wrote the ring block alone last, 0 after a mix, and the ring blocks still to silence for it
+  uint32_t mDirect;
+  uint32_t mClearBlocks;
+  uint32_t mFrames;
+  uint32_t mTxStride;
+  uint8_t* mTxBuff;
+  int64_t mStart;
+  int64_t mPeriod;
+  int64_t mQpcFreq;
+};
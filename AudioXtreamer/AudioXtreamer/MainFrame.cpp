@@ -4,6 +4,7 @@
 #include "resource.h"
 #include "AudioXtreamer.h"
 #include "PropertySheetDlg.h"
+#include "Trace\Trace.h"
 
 
 // CAboutDlg dialog used for App About
@@ -19,10 +20,12 @@ BEGIN_MESSAGE_MAP(MainFrame, CFrameWnd)
   ON_UPDATE_COMMAND_UI(ID_AUDIOXTREAMER_QUIT, &MainFrame::OnUpdateAudioxtreamerQuit)
   ON_COMMAND(ID_AUDIOXTREAMER_OPEN, &MainFrame::OnAudioxtreamerOpen)
   ON_UPDATE_COMMAND_UI(ID_AUDIOXTREAMER_OPEN, &MainFrame::OnUpdateAudioxtreamerOpen)
+  ON_COMMAND(ID_AUDIOXTREAMER_TRACE, &MainFrame::OnAudioxtreamerTrace)
+  ON_UPDATE_COMMAND_UI(ID_AUDIOXTREAMER_TRACE, &MainFrame::OnUpdateAudioxtreamerTrace)
 END_MESSAGE_MAP()
 
 
-enum State { stClosed, stOpen, stReady, stActive };
+enum State { stClosed, stOpen, stReady, stActive, stDirect };
 enum IconState { icstStopped, icstStarted, icstActive };
 
 
@@ -31,6 +34,7 @@ MainFrame::MainFrame(UsbDevice & dev)
 , mDevice(dev)
 , mPropertySheet(mDevice, this)
 , mState(stClosed)
+, mControlBusy(false)
 {
   WNDCLASSEX wndc;
   ZeroMemory(&wndc, sizeof(wndc));
@@ -92,8 +96,10 @@ void MainFrame::SetIconState(enum IconState st)
 
 void MainFrame::OnTimer(UINT_PTR nIDEvent)
 {
-  if (nIDEvent == 100)
+  if (nIDEvent == 100) {
     NextState(mState);
+    PublishControl();
+  }
   CFrameWnd::OnTimer(nIDEvent);
 }
 
@@ -110,20 +116,43 @@ void MainFrame::OnDestroy()
 {
   CFrameWnd::OnDestroy();
   g_TrayIcon.DestroyWindow();
+  //nobody left to switch it off
+  Trace::Enable(false);
 }
 
+//posted by a driver that put a command in the mailbox, the queries never come here
 LRESULT MainFrame::XtreamerMessage(WPARAM wp, LPARAM lp)
 {
-  switch (wp)
+  uint32_t request, command, arg;
+  if (mControlBusy || !theApp.TakeControl(request, command, arg))
+    return LRESULT(0);
+
+  mControlBusy = true;
+  uint32_t result = 0;
+  switch (command)
   {
-  case 1: return ( mDevice.IsPresent()) ? LRESULT(1) : LRESULT(0);
-  case 2: return ( mDevice.IsRunning()) ? LRESULT(1) : LRESULT(0);
-  case 3: return OpenControlPanel(true) == IDOK ? LRESULT(1) : LRESULT(0);
-  case 4: return (LRESULT)(mDevice.GetSampleRate());
+  case cmdConfigure: result = OpenControlPanel(true) == IDOK ? 1 : 0; break;
+  case cmdRelease: result = ReleaseDevice((DWORD)arg) ? 1 : 0; break;
+  case cmdReclaim: ReclaimDevice(); result = 1; break;
+  default: break;
   }
+  mControlBusy = false;
+
+  PublishControl();
+  theApp.ControlDone(request, result);
   return LRESULT(0);
 }
 
+void MainFrame::PublishControl()
+{
+  const uint32_t flags = (mDevice.IsPresent() ? ctlPresent : 0) | (mDevice.IsRunning() ? ctlRunning : 0)
+    | (mState == stDirect ? ctlDirect : 0);
+
+  //a running device has the rate in its status, a stopped one needs a control transfer, only on a change then
+  if ((flags & ctlRunning) || flags != theApp.GetControlFlags())
+    theApp.PublishControl(flags, (flags & ctlPresent) ? mDevice.GetSampleRate() : (uint32_t)(-1));
+}
+
 void MainFrame::NextState(enum State newState)
 {
   switch (mState)
@@ -171,6 +200,19 @@ void MainFrame::NextState(enum State newState)
       mState = stOpen;
     }
     break;
+
+  case stDirect:
+    {//the host might have died without giving the device back
+      HANDLE owner = OpenProcess(SYNCHRONIZE, FALSE, theApp.GetDirectOwner());
+      bool gone = owner == NULL || WaitForSingleObject(owner, 0) == WAIT_OBJECT_0;
+      if (owner != NULL)
+        CloseHandle(owner);
+      if (gone) {
+        LOG0("MainFrame direct mode owner is gone");
+        ReclaimDevice();
+      }
+    }
+    break;
   default: break;
   }
 }
@@ -213,6 +255,34 @@ void MainFrame::SaveSettings()
   mIniFile.Save();
 }
 
+bool MainFrame::ReleaseDevice(DWORD owner)
+{
+  LOGN("MainFrame::ReleaseDevice to process %u\n", owner);
+  //another direct host still has it
+  if (mState == stDirect && owner != theApp.GetDirectOwner())
+    return false;
+
+  if (mDevice.IsRunning())
+    mDevice.Stop(true);
+  mDevice.Close();
+
+  theApp.SetDirectOwner(owner);
+  mState = stDirect;
+  SetIconState(icstActive);
+  return true;
+}
+
+void MainFrame::ReclaimDevice()
+{
+  LOG0("MainFrame::ReclaimDevice");
+  if (mState != stDirect)
+    return;
+
+  theApp.SetDirectOwner(0);
+  SetIconState(icstStopped);
+  mState = stClosed;
+}
+
 
 
 void MainFrame::OnAudioxtreamerQuit()
@@ -240,3 +310,14 @@ void MainFrame::OnUpdateAudioxtreamerOpen(CCmdUI *pCmdUI)
 }
 
 
+//the pipeline trace of this process and the asio host, a json file each in the settings folder
+void MainFrame::OnAudioxtreamerTrace()
+{
+  Trace::Enable(!Trace::Enabled());
+}
+
+
+void MainFrame::OnUpdateAudioxtreamerTrace(CCmdUI *pCmdUI)
+{
+  pCmdUI->SetCheck(Trace::Enabled() ? 1 : 0);
+}
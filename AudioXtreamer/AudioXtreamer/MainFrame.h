@@ -22,9 +22,15 @@ public:
   afx_msg void OnUpdateAudioxtreamerOpen(CCmdUI *pCmdUI);
   afx_msg void OnAudioxtreamerQuit();
   afx_msg void OnUpdateAudioxtreamerQuit(CCmdUI *pCmdUI);
+  afx_msg void OnAudioxtreamerTrace();
+  afx_msg void OnUpdateAudioxtreamerTrace(CCmdUI *pCmdUI);
 
   void SaveSettings();
 
+  //direct mode, an asio host opens the usb device in its own process
+  bool ReleaseDevice(DWORD owner);
+  void ReclaimDevice();
+
   DECLARE_MESSAGE_MAP()
 
 protected:
@@ -32,10 +38,14 @@ protected:
 
   void NextState(enum State newState);
   void SetIconState(enum IconState st);
+  //the device state for the asio drivers' queries
+  void PublishControl();
 
   ASIOSettingsFile mIniFile;
   UsbDevice & mDevice;
   enum State mState;
+  //a command from the mailbox is running, the control panel pumps messages meanwhile
+  bool mControlBusy;
 
   PropertySheetDlg mPropertySheet;
   CPngImage m_pngImage;
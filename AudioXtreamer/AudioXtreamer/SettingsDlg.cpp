@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "SettingsDlg.h"
+#include "AudioXtreamer.h"
 
 using namespace ASIOSettings;
 
@@ -31,6 +32,7 @@ BEGIN_MESSAGE_MAP(ASIOSettingsDlg, CPropertyPage)
   ON_CBN_SELCHANGE(IDC_DL_INS, &ASIOSettingsDlg::OnCbnSelchangeChannels)
   ON_CBN_SELCHANGE(IDC_DL_OUTS, &ASIOSettingsDlg::OnCbnSelchangeChannels)
   ON_BN_CLICKED(IDC_BUTTON6, &ASIOSettingsDlg::OnRestart)
+  ON_BN_CLICKED(IDC_BUTTON_LATENCY, &ASIOSettingsDlg::OnMeasureLatency)
 END_MESSAGE_MAP()
 
 
@@ -39,10 +41,12 @@ void ASIOSettingsDlg::OnTimer(UINT_PTR nIDEvent)
 {
   TCHAR str[32];
   UsbDeviceStatus ds;
-  mDev.GetStatus(ds);
+  ZeroMemory(&ds, sizeof(ds));
+  //from the shared memory, whichever process runs the device
+  ReadTelemetry(theApp.TelemetryBlock(), ds);
 
   if ( nIDEvent == 200 ) {
-    uint32_t sr = mDev.GetSampleRate();
+    uint32_t sr = mDev.IsPresent() ? mDev.GetSampleRate() : ds.LastSR;
     if (sr != mLastSR) {
       CDataExchange pDX(this, false);
       mLastSR = sr;
@@ -56,9 +60,34 @@ void ASIOSettingsDlg::OnTimer(UINT_PTR nIDEvent)
       DDX_Radio(&pDX, IDC_RADIO_44, val);
       UpdateRanges(SCBoth);
     }
-    //LOGN("%u\n", ds.SwSR);
-    _stprintf(str, _T("%u"), ds.SwSR);
+    //measured rate and its drift from the nominal one
+    if (ds.SwSR != 0)
+      _stprintf(str, _T("%u.%02u %+.1fppm"), ds.SwSR / 1000, (ds.SwSR % 1000) / 10, ds.DriftPpb / 1000.);
+    else
+      _stprintf(str, _T("-"));
     GetDlgItem(IDC_STATIC_SR)->SetWindowText(str);
+
+    //the latency probe, its result goes to the asio driver's calibration
+    TCHAR probe[64];
+    switch (ds.ProbeState) {
+    case probeRunning:
+      _stprintf(probe, _T("Measuring..."));
+      break;
+    case probeDone:
+      if (sr != 0 && sr != (uint32_t)-1)
+        _stprintf(probe, _T("Round trip %u samples, %.2f ms"), ds.ProbeRoundTrip, ds.ProbeRoundTrip * 1000. / sr);
+      else
+        _stprintf(probe, _T("Round trip %u samples"), ds.ProbeRoundTrip);
+      break;
+    case probeFailed:
+      _stprintf(probe, _T("No impulse back on In 1"));
+      break;
+    default:
+      probe[0] = 0;
+      break;
+    }
+    if (probe[0] != 0)
+      GetDlgItem(IDC_STATIC_LATENCY)->SetWindowText(probe);
   }
 
   _stprintf(str, _T("Skip: %u"), ds.OutSkipCount);
@@ -69,6 +98,26 @@ void ASIOSettingsDlg::OnTimer(UINT_PTR nIDEvent)
 
   mProgressFifo.SetPos(ds.FifoLevel);
 
+  //lowest level last second against the margin the jitter control keeps
+  _stprintf(str, _T("FIFO %u/%u"), ds.FifoMinLevel, ds.FifoMargin);
+  GetDlgItem(IDC_STATIC_STATUS_VAR2)->SetWindowText(str);
+
+  //kernel wakes of the worker and client answers it caught spinning, page faults of its process
+  _stprintf(str, _T("W: %u/%u PF: %u"), ds.Wakes, ds.SpinWakes, ds.PageFaults);
+  GetDlgItem(IDC_STATIC_INPKTS)->SetWindowText(str);
+
+  _stprintf(str, _T("%uus"), ds.SwitchLatAvg);
+  GetDlgItem(IDC_STATIC_OUTPKTS)->SetWindowText(str);
+
+  //driver load, the longest round trip and bufferSwitch of the last second against the block period
+  const DriverLoad* load = theApp.LoadBlock();
+  LoadInfo roundTrip, callback;
+  if (load != nullptr && ReadLoad(load->RoundTrip, roundTrip) && ReadLoad(load->Callback, callback) && roundTrip.Calls != 0)
+    _stprintf(str, _T("Load %u%%/%u%% %u late"), roundTrip.MaxPct, callback.MaxPct, roundTrip.Overruns);
+  else
+    _stprintf(str, _T("Load -"));
+  GetDlgItem(IDC_STATIC_LOAD)->SetWindowText(str);
+
   __super::OnTimer(nIDEvent);
 }
 
@@ -237,3 +286,12 @@ void ASIOSettingsDlg::OnRestart()
 {
   mDev.Close();
 }
+
+void ASIOSettingsDlg::OnMeasureLatency()
+{
+  //the device streams here or in the direct mode host
+  if (mDev.MeasureLatency() || theApp.RequestDirectProbe())
+    GetDlgItem(IDC_STATIC_LATENCY)->SetWindowText(_T("Measuring..."));
+  else
+    GetDlgItem(IDC_STATIC_LATENCY)->SetWindowText(_T("The device is not streaming"));
+}
@@ -55,6 +55,7 @@ private:
 public:
   virtual void OnOK();
   afx_msg void OnRestart();
+  afx_msg void OnMeasureLatency();
 };
 
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <new>
 
 
 typedef struct _IsoReq
@@ -17,14 +18,62 @@ typedef struct _IsoReqResult
   USBD_STATUS status;
 } IsoReqResult;
 
+//what the backend and the endpoint take in one iso request
+typedef struct _IsoLimits
+{
+  uint32_t pktMultiple; //packets per request must be a multiple of it
+  uint32_t maxPkts;     //most packets in one request
+  uint32_t pktSize;     //bytes per packet, the endpoint's bytes per interval
+} IsoLimits;
+
+/*The backends' contexts of the iso requests, kept from one stream to the next
+
+  bknd_init_*_xfer takes one, bknd_xfer_cleanup gives it back. The packet arrays in a context stay
+  allocated when it is given back and are only replaced by larger ones, a restart with the same or
+  smaller requests does no heap work. T has Reserve(pktCount), allocating its arrays, and Free.
+*/
+static const uint32_t scXferPoolSize = 16;
+
+template<typename T>
+class XferPool
+{
+public:
+  XferPool() : mCtx(), mUsed() {}
+  ~XferPool()
+  {
+    for (uint32_t i = 0; i < scXferPoolSize; i++)
+      mCtx[i].Free();
+  }
+
+  //nullptr if they are all out
+  T* Take()
+  {
+    for (uint32_t i = 0; i < scXferPoolSize; i++)
+      if (InterlockedCompareExchange(&mUsed[i], 1, 0) == 0)
+        return &mCtx[i];
+    return nullptr;
+  }
+
+  void Give(T* ctx)
+  {
+    InterlockedExchange(&mUsed[ctx - mCtx], 0);
+  }
+
+private:
+  T mCtx[scXferPoolSize];
+  volatile LONG mUsed[scXferPoolSize];
+};
+
 typedef int64_t(*USB_BACKEND_CTRL_XFER)(HANDLE handle, uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
   unsigned char* data, uint16_t wLength, unsigned int timeout);
 
+//a req->buff set by the caller is used for the packets and stays the caller's, otherwise the backend allocates one
 typedef bool(*USB_BACKEND_INIT_ISO_PRIV)(HANDLE handle, XferReq* req, const size_t pktCount, const size_t pktSize);
 typedef bool(*USB_BACKEND_XFER)(XferReq* req);
 typedef IsoReqResult(*USB_BACKEND_ISO_GET_RESULT)(XferReq* req, uint32_t idx);
 typedef bool(*USB_BKND_OPEN_CLOSE)(HANDLE& dev, HANDLE& file);
 typedef bool(*USB_BACKEND_ABORT)(HANDLE handle, uint8_t ep);
+typedef bool(*USB_BACKEND_ISO_LIMITS)(HANDLE handle, uint8_t ep, IsoLimits* limits);
 
 extern const USB_BKND_OPEN_CLOSE bknd_open;
 extern const USB_BKND_OPEN_CLOSE bknd_close;
@@ -43,3 +92,5 @@ extern const USB_BACKEND_ISO_GET_RESULT bknd_iso_get_result;
 
 extern const USB_BACKEND_ABORT bknd_abort_pipe;
 
+extern const USB_BACKEND_ISO_LIMITS bknd_iso_limits;
+
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/*Timing for the benchmarks
+
+  Measure runs a call over and over in rounds and keeps the fastest round, what is left is the cost
+  of the call with warm caches, not the noise of the machine. Cycles are TSC reference cycles, the
+  same at any core clock, 0 where there is no TSC.
+*/
+namespace Bench
+{
+  struct Result
+  {
+    double ns;      //per call
+    double cycles;  //per call
+  };
+
+  inline uint64_t Cycles()
+  {
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  inline int64_t Nanos()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //the fastest of rounds, each one long enough for the clocks to resolve it
+  template<typename F>
+  Result Measure(F&& call, uint32_t rounds = 7, int64_t roundNs = 2000000)
+  {
+    //how many calls fill a round
+    uint32_t calls = 1;
+    for (;;) {
+      const int64_t start = Nanos();
+      for (uint32_t i = 0; i < calls; i++)
+        call();
+      if (Nanos() - start >= roundNs / 4 || calls >= (1u << 24))
+        break;
+      calls *= 2;
+    }
+    calls *= 4;
+
+    Result best = { 1e30, 1e30 };
+    for (uint32_t r = 0; r < rounds; r++) {
+      const int64_t start = Nanos();
+      const uint64_t c0 = Cycles();
+      for (uint32_t i = 0; i < calls; i++)
+        call();
+      const uint64_t c1 = Cycles();
+      const double ns = (double)(Nanos() - start) / calls;
+      if (ns < best.ns)
+        best = { ns, (double)(c1 - c0) / calls };
+    }
+    return best;
+  }
+
+  //--quick: the least that still runs every path, for ctest
+  inline bool Quick(int argc, char** argv)
+  {
+    for (int i = 1; i < argc; i++)
+      if (strcmp(argv[i], "--quick") == 0)
+        return true;
+    return false;
+  }
+
+  //a value the compiler can't see through, keeps results of the calls alive
+  template<typename T>
+  inline void Keep(const T& value)
+  {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+}
@@ -0,0 +1,125 @@
+#include "stdafx.h"
+#include "AudioXtreamer/ClientMix.h"
+
+#include <vector>
+
+/*ClientMix over a shared memory laid out in the test, the clients answering in place of the drivers
+
+  Two clients write outputs of their own, their blocks are mixed into the ring. Then one goes away and
+  the other writes the ring blocks alone, on its outputs only. Every ring block it fills from then on
+  has to carry its outputs and silence on all the others, nothing left over from the mix. Each block
+  goes round the ring twice in both phases.
+*/
+
+std::atomic<uint32_t> Win32Event::sSets(0);
+std::atomic<uint32_t> Win32Event::sWaits(0);
+
+void SlotEventName(uint32_t slot, TCHAR* name, size_t size)
+{
+  snprintf(name, size, "ClientMixTest%u", slot);
+}
+
+static const uint32_t Frames = 32;
+static const uint32_t Blocks = 4;
+static const uint32_t NrIns = 8, NrOuts = 8;
+static const uint32_t RxStride = NrIns * 3, TxStride = scTxHeaderSize + NrOuts * 3;
+
+//the outputs each client writes
+static const uint32_t Masks[2] = { 0x03, 0x0C };
+
+static uint32_t sFailures = 0;
+
+//what client k writes on channel c of frame f
+static uint32_t Sample(uint32_t k, uint32_t c, uint32_t f)
+{
+  return 0x10000 * (k + 1) + 0x100 * c + f;
+}
+
+//the driver's Switch: the frames' headers and its own outputs only
+static void Answer(volatile ClientSlot& slot, uint8_t* shared, uint32_t k)
+{
+  uint8_t* tx = shared + slot.Stream.TxOffset;
+  for (uint32_t f = 0; f < Frames; f++) {
+    uint8_t* frame = tx + f * TxStride;
+    memcpy(frame, &scTxHeaderMark, scTxHeaderSize);
+    for (uint32_t c = 0; c < NrOuts; c++)
+      if (Masks[k] & (1 << c)) {
+        const uint32_t v = Sample(k, c, f);
+        memcpy(frame + scTxHeaderSize + c * 3, &v, 3);
+      }
+  }
+  slot.Stream.Flags |= 0x1;
+  slot.Done = slot.Block;
+}
+
+static void Check(const uint8_t* block, uint32_t clients, const char* phase, uint32_t n)
+{
+  for (uint32_t f = 0; f < Frames; f++) {
+    const uint8_t* frame = block + f * TxStride;
+    uint32_t mark;
+    memcpy(&mark, frame, 4);
+    if (mark != scTxHeaderMark && sFailures++ < 10)
+      printf("FAIL %s block %u frame %u: sync word %08X\n", phase, n, f, mark);
+
+    for (uint32_t c = 0; c < NrOuts; c++) {
+      uint32_t expected = 0, got = 0;
+      for (uint32_t k = 0; k < clients; k++)
+        if (Masks[k] & (1 << c))
+          expected = Sample(k, c, f);
+      memcpy(&got, frame + scTxHeaderSize + c * 3, 3);
+      if (got != expected && sFailures++ < 10)
+        printf("FAIL %s block %u frame %u channel %u: %06X instead of %06X\n", phase, n, f, c, got, expected);
+    }
+  }
+}
+
+int main()
+{
+  //the slots in the header, the rings and the clients' blocks after it
+  std::vector<uint8_t> mem(scLayoutHeaderSize + (Blocks + 2) * scLayoutAlign, 0);
+  uint8_t* shared = mem.data();
+  SharedLayout& layout = *(SharedLayout*)shared;
+  layout.RxOffset = scLayoutHeaderSize;
+  layout.RxSize = Blocks * Frames * RxStride;
+  layout.TxOffset = layout.RxOffset + scLayoutAlign;
+  layout.TxSize = Blocks * Frames * TxStride;
+  layout.SlotTxOffset = layout.TxOffset + scLayoutAlign;
+  layout.SlotTxSize = 4096;
+
+  ClientSlot* slots = (ClientSlot*)(shared + scClientSlotOffset);
+  for (uint32_t k = 0; k < 2; k++) {
+    slots[k].Owner = 100 + k;
+    slots[k].OutMask = Masks[k];
+    slots[k].Stream.BlockFrames = Frames;
+    slots[k].Stream.Flags = 0x1;
+  }
+
+  ClientMix mix;
+  if (!mix.Init(shared)) {
+    printf("FAIL Init\n");
+    return 1;
+  }
+  mix.Reset();
+
+  //both clients, then the second one gone
+  uint32_t n = 0;
+  for (uint32_t clients : { 2u, 1u }) {
+    if (clients == 1)
+      slots[1].Owner = 0;
+    for (uint32_t b = 0; b < 2 * Blocks; b++, n++) {
+      mix.Present();
+      uint8_t* rx = shared + layout.RxOffset + (n % Blocks) * Frames * RxStride;
+      uint8_t* tx = shared + layout.TxOffset + (n % Blocks) * Frames * TxStride;
+      mix.Switch(Frames, RxStride, rx, TxStride, tx, 0, 48000);
+      for (uint32_t k = 0; k < clients; k++)
+        Answer(slots[k], shared, k);
+      if (!mix.Complete() && sFailures++ < 10)
+        printf("FAIL block %u not complete with every client answered\n", n);
+      Check(tx, clients, clients == 2 ? "mixed" : "alone", n);
+    }
+  }
+  mix.Close();
+
+  printf("ClientMix, %u blocks mixed and %u alone, %u failures\n", 2 * Blocks, 2 * Blocks, sFailures);
+  return sFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+#include "stdafx.h"
+#include "Bench.h"
+#include "PcmConv/PcmConv.h"
+#include "LockFree/SpscRing.h"
+#include "FX2LP/JitterControl.h"
+#include "UsbDev/StreamFormat.h"
+
+#include <vector>
+
+/*The stages a host block goes through in the driver, one at a time, on synthetic packets
+
+  A block of frames arrives the way the device sends it, 1k isoch packets that start with an RxHeader
+  and split frames across their ends, and goes back out as tx frames:
+  - hdr    ProcessHdr, the header checked, the rate snapped and the fifo level fed to JitterControl
+  - rx     RxIsochCB, the frames put back together and queued on the input ring
+  - in     Switch, the ring's frames to the client buffers
+  - out    Switch, the client buffers to the output ring, sync words included
+  - txinit InitTxHeaders, a block of silence
+  - tx     TxIsochCB, the output ring's frames into the iso buffer
+  Every channel count the device runs, 2 to 32 a pair at a time, and host blocks of 16 to 255 frames.
+  Per stage: ns per frame of the block and cycles per byte the stage moved. MIDI is left out, its
+  parser sits on the virtual midi port of the windows build.
+*/
+
+static const uint32_t MaxChannels = 32;
+static const uint32_t PacketSize = 1024;
+static const uint32_t PacketPayload = PacketSize - sizeof(RxHeader);
+static const uint32_t FifoDepth = 255;
+
+static uint32_t sRandom = 0x6C078965;
+static uint8_t Random8()
+{
+  sRandom ^= sRandom << 13;
+  sRandom ^= sRandom >> 17;
+  sRandom ^= sRandom << 5;
+  return (uint8_t)sRandom;
+}
+
+struct Packet
+{
+  const uint8_t* ptr;
+  uint32_t len;
+};
+
+//the block as the device sends it, full packets and the rest in the last one
+static std::vector<Packet> Packets(std::vector<uint8_t>& mem, uint32_t bytes)
+{
+  const uint32_t count = (bytes + PacketPayload - 1) / PacketPayload;
+  mem.assign(count * PacketSize, 0);
+  std::vector<Packet> packets;
+  for (uint32_t i = 0, left = bytes; i < count; i++) {
+    uint8_t* p = &mem[i * PacketSize];
+    RxHeader hdr = {};
+    hdr.Hdr1 = 0xaaaa;
+    hdr.Hdr2 = 0x5555;
+    hdr.SamplingRate = 4800 + (uint16_t)(Random8() % 3);
+    hdr.FifoLevel = 64 + Random8() % 32;
+    memcpy(p, &hdr, sizeof(hdr));
+    const uint32_t len = min(left, PacketPayload);
+    for (uint32_t b = 0; b < len; b++)
+      p[sizeof(RxHeader) + b] = Random8();
+    packets.push_back({ p, (uint32_t)sizeof(RxHeader) + len });
+    left -= len;
+  }
+  return packets;
+}
+
+struct Stage
+{
+  const char* name;
+  Bench::Result r;
+  double bytes;
+};
+
+static void Run(uint32_t ch, uint32_t frames, bool header)
+{
+  const uint32_t rxStride = ch * 3;
+  const uint32_t txStride = scTxHeaderSize + ch * 3;
+
+  std::vector<uint8_t> packetMem;
+  const std::vector<Packet> packets = Packets(packetMem, frames * rxStride);
+
+  //three blocks of ring, the way the device lays them out
+  std::vector<uint8_t> inMem(rxStride * frames * 3), outMem(txStride * frames * 3);
+  SpscRing inRing, outRing;
+  inRing.Init(inMem.data(), rxStride, frames * 3);
+  outRing.Init(outMem.data(), txStride, frames * 3);
+
+  std::vector<uint8_t> rx(rxStride * frames), client(ch * frames * 3), iso(txStride * frames);
+  for (uint8_t& b : rx)
+    b = Random8();
+  uint8_t* ptrs[MaxChannels];
+  for (uint32_t c = 0; c < ch; c++)
+    ptrs[c] = &client[c * frames * 3];
+  PcmConv::Plan plan;
+  plan.All(ch);
+  const PcmConv::DEINTERLEAVE deinterleave = PcmConv::Deinterleave[PcmConv::fmtInt24];
+  const PcmConv::INTERLEAVE interleave = PcmConv::Interleave[PcmConv::fmtInt24];
+
+  JitterControl jitter;
+  jitter.Init(FifoDepth);
+  RxFramer framer;
+  framer.Init(rxStride);
+
+  Stage stages[6];
+  stages[0] = { "hdr", Bench::Measure([&] {
+    uint32_t sr = 0;
+    for (const Packet& p : packets) {
+      const RxHeader* hdr = RxHeaderAt(p.ptr);
+      if (hdr != nullptr) {
+        sr += ConvertSampleRate(hdr->SamplingRate);
+        jitter.Sample(hdr->FifoLevel, hdr->OutSkipCount);
+      }
+    }
+    Bench::Keep(sr);
+  }), (double)packets.size() * sizeof(RxHeader) };
+
+  stages[1] = { "rx", Bench::Measure([&] {
+    for (const Packet& p : packets)
+      framer.Packet(p.ptr + sizeof(RxHeader), p.len - (uint32_t)sizeof(RxHeader),
+        [&](const uint8_t* f, uint32_t count) { inRing.Write(f, count); });
+    //the client's side, the ring is empty for the next block
+    inRing.Flush();
+  }), (double)frames * rxStride };
+
+  stages[2] = { "in", Bench::Measure([&] {
+    deinterleave(rx.data(), rxStride, ptrs, plan, frames);
+    Bench::Keep(client[0]);
+  }), (double)frames * rxStride };
+
+  stages[3] = { "out", Bench::Measure([&] {
+    uint32_t contiguous;
+    uint8_t* p = outRing.WritePtr(contiguous);
+    interleave(p, txStride, scTxHeaderMark, (const uint8_t* const*)ptrs, plan, frames);
+    outRing.Commit(frames);
+    outRing.Flush();
+  }), (double)frames * txStride };
+
+  stages[4] = { "txinit", Bench::Measure([&] {
+    FillTxHeaders(iso.data(), frames, txStride);
+    Bench::Keep(iso[0]);
+  }), (double)frames * txStride };
+
+  stages[5] = { "tx", Bench::Measure([&] {
+    outRing.Commit(frames);
+    Bench::Keep(outRing.Read(iso.data(), frames));
+  }), (double)frames * txStride };
+
+  if (header) {
+    printf("%4s %6s", "ch", "frames");
+    for (const Stage& s : stages)
+      printf(" %8s %6s", s.name, "cyc/B");
+    printf(" %8s\n", "total");
+  }
+  printf("%4u %6u", ch, frames);
+  double total = 0;
+  for (const Stage& s : stages) {
+    printf(" %8.2f %6.2f", s.r.ns / frames, s.r.cycles / s.bytes);
+    total += s.r.ns;
+  }
+  printf(" %8.2f\n", total / frames);
+}
+
+//the frames the ring hands over have to be the ones that came in, in order
+static bool Check()
+{
+  bool ok = true;
+  for (uint32_t ch = 2; ch <= MaxChannels; ch += 2) {
+    const uint32_t stride = ch * 3, frames = 255;
+    std::vector<uint8_t> mem;
+    const std::vector<Packet> packets = Packets(mem, frames * stride);
+
+    std::vector<uint8_t> ringMem(stride * frames), expected, got(stride * frames);
+    for (const Packet& p : packets)
+      expected.insert(expected.end(), p.ptr + sizeof(RxHeader), p.ptr + p.len);
+    SpscRing ring;
+    ring.Init(ringMem.data(), stride, frames);
+    RxFramer framer;
+    framer.Init(stride);
+    for (const Packet& p : packets)
+      framer.Packet(p.ptr + sizeof(RxHeader), p.len - (uint32_t)sizeof(RxHeader),
+        [&](const uint8_t* f, uint32_t count) { ring.Write(f, count); });
+
+    if (ring.Read(got.data(), frames) != frames || got != expected) {
+      printf("RxFramer lost frames at %u channels\n", ch);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  const bool quick = Bench::Quick(argc, argv);
+  const PcmConv::Isa isa = PcmConv::Init();
+  printf("Driver hot path per host block, %s kernels, ns per frame and cycles per byte\n", PcmConv::IsaName(isa));
+
+  const bool ok = Check();
+
+  const std::vector<uint32_t> frameCounts = quick ? std::vector<uint32_t>{ 16, 255 } : std::vector<uint32_t>{ 16, 32, 64, 128, 255 };
+  const uint32_t chStep = quick ? 10 : 2;
+  for (uint32_t frames : frameCounts) {
+    printf("\n");
+    for (uint32_t ch = 2; ch <= MaxChannels; ch += chStep)
+      Run(ch, frames, ch == 2);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+#include "stdafx.h"
+#include "Bench.h"
+#include "PcmConv/PcmConv.h"
+
+#include <vector>
+
+/*PcmConv against the per sample memcpy loops TortugASIO::Switch ran before, on random samples
+
+  Every channel count the device runs, 2 to MaxChannels a pair at a time, at a few host buffer sizes,
+  both ways. Per line: ns per frame of the memcpy loop, then ns per frame and cycles per device byte
+  of each kernel set the cpu runs, and the speedup of the best one. The Int24 results are checked
+  against the loop. The other formats follow at the largest frame, Int24 there for reference.
+*/
+
+static const uint32_t MaxChannels = 32;
+
+static uint32_t sRandom = 0x12345678;
+static uint8_t Random8()
+{
+  sRandom ^= sRandom << 13;
+  sRandom ^= sRandom >> 17;
+  sRandom ^= sRandom << 5;
+  return (uint8_t)sRandom;
+}
+
+//what TortugASIO::Switch did on the way in, one 3 byte memcpy per sample
+static void DeinterleaveMemcpy(const uint8_t* rxBuff, uint32_t rxStride, uint8_t* const* dst, uint32_t nrChannels, uint32_t nrFrames)
+{
+  for (uint32_t s = 0; s < nrFrames; s++)
+    for (uint32_t c = 0; c < nrChannels; c++)
+      memcpy(dst[c] + s * 3, rxBuff + s * rxStride + c * 3, 3);
+}
+
+//and on the way out, the header word the tx frame starts with included
+static void InterleaveMemcpy(uint8_t* txBuff, uint32_t txStride, uint32_t header, const uint8_t* const* src, uint32_t nrChannels, uint32_t nrFrames)
+{
+  for (uint32_t s = 0; s < nrFrames; s++) {
+    memcpy(txBuff + s * txStride, &header, sizeof(header));
+    for (uint32_t c = 0; c < nrChannels; c++)
+      memcpy(txBuff + s * txStride + sizeof(header) + c * 3, src[c] + s * 3, 3);
+  }
+}
+
+//the kernel sets the cpu can run, scalar first
+static std::vector<PcmConv::Isa> Isas()
+{
+  std::vector<PcmConv::Isa> isas;
+  const PcmConv::Isa best = PcmConv::Init();
+  for (int isa = PcmConv::isaScalar; isa <= best; isa++)
+    isas.push_back((PcmConv::Isa)isa);
+  return isas;
+}
+
+static bool BenchDeinterleave(const std::vector<PcmConv::Isa>& isas, const std::vector<uint32_t>& frameCounts, uint32_t chStep)
+{
+  printf("\nDeinterleave, Int24\n%4s %6s %10s", "ch", "frames", "memcpy");
+  for (PcmConv::Isa isa : isas)
+    printf(" %10s %8s", PcmConv::IsaName(isa), "cyc/B");
+  printf(" %8s\n", "speedup");
+
+  bool ok = true;
+  for (uint32_t frames : frameCounts)
+  {
+    for (uint32_t ch = 2; ch <= MaxChannels; ch += chStep)
+    {
+      const uint32_t stride = ch * 3;
+      std::vector<uint8_t> src(stride * frames);
+      for (uint8_t& b : src)
+        b = Random8();
+
+      std::vector<uint8_t> ref(ch * frames * 3), out(ch * frames * 3);
+      uint8_t* refPtrs[MaxChannels], *outPtrs[MaxChannels];
+      for (uint32_t c = 0; c < ch; c++) {
+        refPtrs[c] = &ref[c * frames * 3];
+        outPtrs[c] = &out[c * frames * 3];
+      }
+
+      PcmConv::Plan plan;
+      plan.All(ch);
+      const double bytes = (double)stride * frames;
+
+      const Bench::Result loop = Bench::Measure([&] { DeinterleaveMemcpy(src.data(), stride, refPtrs, ch, frames); Bench::Keep(ref[0]); });
+      printf("%4u %6u %10.2f", ch, frames, loop.ns / frames);
+
+      double best = loop.ns;
+      for (PcmConv::Isa isa : isas)
+      {
+        PcmConv::Init(isa);
+        const PcmConv::DEINTERLEAVE kernel = PcmConv::Deinterleave[PcmConv::fmtInt24];
+        memset(out.data(), 0, out.size());
+        kernel(src.data(), stride, outPtrs, plan, frames);
+        if (out != ref) {
+          printf("\n%s deinterleave differs from the memcpy loop at %u channels, %u frames\n", PcmConv::IsaName(isa), ch, frames);
+          ok = false;
+        }
+
+        const Bench::Result r = Bench::Measure([&] { kernel(src.data(), stride, outPtrs, plan, frames); Bench::Keep(out[0]); });
+        printf(" %10.2f %8.3f", r.ns / frames, r.cycles / bytes);
+        best = min(best, r.ns);
+      }
+      printf(" %7.1fx\n", loop.ns / best);
+    }
+  }
+  return ok;
+}
+
+static bool BenchInterleave(const std::vector<PcmConv::Isa>& isas, const std::vector<uint32_t>& frameCounts, uint32_t chStep)
+{
+  printf("\nInterleave, Int24\n%4s %6s %10s", "ch", "frames", "memcpy");
+  for (PcmConv::Isa isa : isas)
+    printf(" %10s %8s", PcmConv::IsaName(isa), "cyc/B");
+  printf(" %8s\n", "speedup");
+
+  const uint32_t header = 0xAA5555AA;
+  bool ok = true;
+  for (uint32_t frames : frameCounts)
+  {
+    for (uint32_t ch = 2; ch <= MaxChannels; ch += chStep)
+    {
+      const uint32_t stride = sizeof(header) + ch * 3;
+      std::vector<uint8_t> src(ch * frames * 3);
+      for (uint8_t& b : src)
+        b = Random8();
+      const uint8_t* srcPtrs[MaxChannels];
+      for (uint32_t c = 0; c < ch; c++)
+        srcPtrs[c] = &src[c * frames * 3];
+
+      std::vector<uint8_t> ref(stride * frames), out(stride * frames);
+      PcmConv::Plan plan;
+      plan.All(ch);
+      const double bytes = (double)stride * frames;
+
+      const Bench::Result loop = Bench::Measure([&] { InterleaveMemcpy(ref.data(), stride, header, srcPtrs, ch, frames); Bench::Keep(ref[0]); });
+      printf("%4u %6u %10.2f", ch, frames, loop.ns / frames);
+
+      double best = loop.ns;
+      for (PcmConv::Isa isa : isas)
+      {
+        PcmConv::Init(isa);
+        const PcmConv::INTERLEAVE kernel = PcmConv::Interleave[PcmConv::fmtInt24];
+        memset(out.data(), 0, out.size());
+        kernel(out.data(), stride, header, srcPtrs, plan, frames);
+        if (out != ref) {
+          printf("\n%s interleave differs from the memcpy loop at %u channels, %u frames\n", PcmConv::IsaName(isa), ch, frames);
+          ok = false;
+        }
+
+        const Bench::Result r = Bench::Measure([&] { kernel(out.data(), stride, header, srcPtrs, plan, frames); Bench::Keep(out[0]); });
+        printf(" %10.2f %8.3f", r.ns / frames, r.cycles / bytes);
+        best = min(best, r.ns);
+      }
+      printf(" %7.1fx\n", loop.ns / best);
+    }
+  }
+  return ok;
+}
+
+//every format both ways at full width, ns per frame
+static void BenchFormats(const std::vector<PcmConv::Isa>& isas, uint32_t frames)
+{
+  const uint32_t ch = MaxChannels;
+  printf("\nFormats, %u channels %u frames\n%-11s", ch, frames, "");
+  for (PcmConv::Isa isa : isas)
+    printf(" %10s %10s", PcmConv::IsaName(isa), "");
+  printf("\n%-11s", "");
+  for (size_t i = 0; i < isas.size(); i++)
+    printf(" %10s %10s", "in", "out");
+  printf("\n");
+
+  const uint32_t rxStride = ch * 3, txStride = sizeof(uint32_t) + ch * 3;
+  std::vector<uint8_t> rx(rxStride * frames), tx(txStride * frames);
+  for (uint8_t& b : rx)
+    b = Random8();
+
+  PcmConv::Plan plan;
+  plan.All(ch);
+  for (int fmt = 0; fmt < PcmConv::MaxFormat; fmt++)
+  {
+    std::vector<uint8_t> client(ch * frames * PcmConv::SampleSize((PcmConv::Format)fmt));
+    uint8_t* ptrs[MaxChannels];
+    for (uint32_t c = 0; c < ch; c++)
+      ptrs[c] = &client[c * frames * PcmConv::SampleSize((PcmConv::Format)fmt)];
+    //first in, so the floats going out are in range
+    printf("%-11s", PcmConv::FormatName((PcmConv::Format)fmt));
+    for (PcmConv::Isa isa : isas)
+    {
+      PcmConv::Init(isa);
+      const PcmConv::DEINTERLEAVE in = PcmConv::Deinterleave[fmt];
+      const PcmConv::INTERLEAVE out = PcmConv::Interleave[fmt];
+      const Bench::Result ri = Bench::Measure([&] { in(rx.data(), rxStride, ptrs, plan, frames); Bench::Keep(client[0]); });
+      const Bench::Result ro = Bench::Measure([&] { out(tx.data(), txStride, 0xAA5555AA, ptrs, plan, frames); Bench::Keep(tx[0]); });
+      printf(" %10.2f %10.2f", ri.ns / frames, ro.ns / frames);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const bool quick = Bench::Quick(argc, argv);
+  const std::vector<PcmConv::Isa> isas = Isas();
+  printf("PcmConv, best kernels %s, ns per frame\n", PcmConv::IsaName(isas.back()));
+
+  //the quick run still covers odd frame counts and channel counts off the simd blocks
+  const std::vector<uint32_t> frameCounts = quick ? std::vector<uint32_t>{ 37 } : std::vector<uint32_t>{ 32, 64, 256, 1024 };
+  const uint32_t chStep = quick ? 10 : 2;
+
+  bool ok = BenchDeinterleave(isas, frameCounts, chStep);
+  ok &= BenchInterleave(isas, frameCounts, chStep);
+  BenchFormats(isas, frameCounts.back());
+  return ok ? 0 : 1;
+}
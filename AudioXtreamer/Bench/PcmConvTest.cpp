@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "PcmConv/PcmConv.h"
+
+#include <math.h>
+#include <vector>
+
+/*The simd kernels of PcmConv against the scalar ones, byte for byte
+
+  Every Format both ways and the mix, 1 to 32 channels, frame counts off the simd blocks, full and
+  sparse plans. The buffers are filled before each call so a kernel that touches a byte it should
+  not, a channel outside the plan or past the last frame, shows as a difference too.
+  The scalar kernels are held against the memcpy loops Switch had before and the float clipping
+  against the values it must give.
+*/
+
+static const uint32_t MaxChannels = 32;
+static const uint32_t FrameCounts[] = { 1, 2, 3, 4, 5, 7, 8, 15, 16, 31, 33, 37, 64, 255 };
+
+static uint32_t sRandom = 0x2545F491;
+static uint32_t Random()
+{
+  sRandom ^= sRandom << 13;
+  sRandom ^= sRandom >> 17;
+  sRandom ^= sRandom << 5;
+  return sRandom;
+}
+
+static uint32_t sFailures = 0;
+static void Fail(const char* what, PcmConv::Isa isa, PcmConv::Format fmt, uint32_t ch, uint32_t frames, const char* plan)
+{
+  if (sFailures++ < 20)
+    printf("FAIL %s %s %s, %u channels %u frames, %s plan\n", what, PcmConv::IsaName(isa), PcmConv::FormatName(fmt), ch, frames, plan);
+}
+
+//client samples of fmt, the floats spread past full scale and with the values that have to clip
+static void FillClient(std::vector<uint8_t>& buf, PcmConv::Format fmt)
+{
+  if (fmt != PcmConv::fmtFloat32) {
+    for (uint8_t& b : buf)
+      b = (uint8_t)Random();
+    return;
+  }
+
+  static const float specials[] = { 1.0f, -1.0f, 2.0f, -2.0f, 0.0f, -0.0f, 1e-30f, 0.99999994f,
+    INFINITY, -INFINITY, NAN };
+  for (size_t i = 0; i + 4 <= buf.size(); i += 4) {
+    float x;
+    if (Random() % 8 == 0)
+      x = specials[Random() % (sizeof(specials) / sizeof(specials[0]))];
+    else
+      x = ((float)(int32_t)Random() / 2147483648.0f) * 1.5f;
+    memcpy(&buf[i], &x, 4);
+  }
+}
+
+struct TestPlan
+{
+  const char* name;
+  PcmConv::Plan plan;
+};
+
+static std::vector<TestPlan> Plans(uint32_t ch)
+{
+  std::vector<TestPlan> plans(4);
+  std::vector<uint8_t> active(ch);
+
+  plans[0].name = "full";
+  plans[0].plan.All(ch);
+
+  for (uint32_t c = 0; c < ch; c++)
+    active[c] = (uint8_t)(c & 1);
+  plans[1].name = "odd channels";
+  plans[1].plan.Build(active.data(), ch);
+
+  for (uint32_t c = 0; c < ch; c++)
+    active[c] = (uint8_t)(Random() % 3 != 0);
+  plans[2].name = "random";
+  plans[2].plan.Build(active.data(), ch);
+
+  //runs of 5 and 9, both sides of the 4 and 8 channel blocks
+  for (uint32_t c = 0; c < ch; c++)
+    active[c] = (uint8_t)(c % 16 < 5 || c % 16 > 6);
+  plans[3].name = "runs";
+  plans[3].plan.Build(active.data(), ch);
+  return plans;
+}
+
+//the same call on the scalar kernels and on isa, from the same buffers
+static void TestKernels(PcmConv::Isa isa, PcmConv::Format fmt, uint32_t ch, uint32_t frames, const TestPlan& tp)
+{
+  const uint32_t size = PcmConv::SampleSize(fmt);
+  const uint32_t rxStride = ch * 3;
+  const uint32_t txStride = sizeof(uint32_t) + ch * 3;
+  const uint32_t header = 0xAA5555AA;
+
+  //device side
+  std::vector<uint8_t> rx(rxStride * frames);
+  for (uint8_t& b : rx)
+    b = (uint8_t)Random();
+  std::vector<uint8_t> txFill(txStride * frames);
+  for (uint8_t& b : txFill)
+    b = (uint8_t)Random();
+
+  //client side, one block per channel
+  std::vector<uint8_t> client(ch * frames * size), clientFill(ch * frames * size);
+  FillClient(client, fmt);
+  for (uint8_t& b : clientFill)
+    b = (uint8_t)Random();
+
+  std::vector<uint8_t> ref, out;
+  uint8_t* ptrs[MaxChannels];
+  auto Pointers = [&](std::vector<uint8_t>& buf) {
+    for (uint32_t c = 0; c < ch; c++)
+      ptrs[c] = &buf[c * frames * size];
+  };
+
+  //deinterleave
+  ref = clientFill;
+  out = clientFill;
+  PcmConv::Init(PcmConv::isaScalar);
+  Pointers(ref);
+  PcmConv::Deinterleave[fmt](rx.data(), rxStride, ptrs, tp.plan, frames);
+  PcmConv::Init(isa);
+  Pointers(out);
+  PcmConv::Deinterleave[fmt](rx.data(), rxStride, ptrs, tp.plan, frames);
+  if (out != ref)
+    Fail("Deinterleave", isa, fmt, ch, frames, tp.name);
+
+  //interleave
+  Pointers(client);
+  ref = txFill;
+  out = txFill;
+  PcmConv::Init(PcmConv::isaScalar);
+  PcmConv::Interleave[fmt](ref.data(), txStride, header, ptrs, tp.plan, frames);
+  PcmConv::Init(isa);
+  PcmConv::Interleave[fmt](out.data(), txStride, header, ptrs, tp.plan, frames);
+  if (out != ref)
+    Fail("Interleave", isa, fmt, ch, frames, tp.name);
+
+  //mix, device frames into device frames
+  if (fmt == PcmConv::fmtInt24) {
+    ref = txFill;
+    out = txFill;
+    PcmConv::Init(PcmConv::isaScalar);
+    PcmConv::Mix(ref.data() + sizeof(header), txStride, rx.data(), rxStride, tp.plan, frames);
+    PcmConv::Init(isa);
+    PcmConv::Mix(out.data() + sizeof(header), txStride, rx.data(), rxStride, tp.plan, frames);
+    if (out != ref)
+      Fail("Mix", isa, fmt, ch, frames, tp.name);
+  }
+}
+
+//the scalar Int24 kernels against the memcpy loops of the old Switch
+static void TestScalarInt24()
+{
+  PcmConv::Init(PcmConv::isaScalar);
+  for (uint32_t ch = 1; ch <= MaxChannels; ch++) {
+    for (uint32_t frames : FrameCounts) {
+      const uint32_t rxStride = ch * 3, txStride = 4 + ch * 3;
+      std::vector<uint8_t> rx(rxStride * frames), client(ch * frames * 3), ref(ch * frames * 3);
+      for (uint8_t& b : rx)
+        b = (uint8_t)Random();
+      uint8_t* ptrs[MaxChannels], *refPtrs[MaxChannels];
+      for (uint32_t c = 0; c < ch; c++) {
+        ptrs[c] = &client[c * frames * 3];
+        refPtrs[c] = &ref[c * frames * 3];
+      }
+      for (uint32_t s = 0; s < frames; s++)
+        for (uint32_t c = 0; c < ch; c++)
+          memcpy(refPtrs[c] + s * 3, &rx[s * rxStride + c * 3], 3);
+
+      PcmConv::Plan plan;
+      plan.All(ch);
+      PcmConv::Deinterleave[PcmConv::fmtInt24](rx.data(), rxStride, ptrs, plan, frames);
+      if (client != ref)
+        Fail("Deinterleave vs memcpy", PcmConv::isaScalar, PcmConv::fmtInt24, ch, frames, "full");
+
+      std::vector<uint8_t> tx(txStride * frames), txRef(txStride * frames);
+      const uint32_t header = 0xAA5555AA;
+      for (uint32_t s = 0; s < frames; s++) {
+        memcpy(&txRef[s * txStride], &header, 4);
+        for (uint32_t c = 0; c < ch; c++)
+          memcpy(&txRef[s * txStride + 4 + c * 3], ptrs[c] + s * 3, 3);
+      }
+      PcmConv::Interleave[PcmConv::fmtInt24](tx.data(), txStride, header, ptrs, plan, frames);
+      if (tx != txRef)
+        Fail("Interleave vs memcpy", PcmConv::isaScalar, PcmConv::fmtInt24, ch, frames, "full");
+    }
+  }
+}
+
+//floats to the device: full scale and beyond clip to the 24bit limits, NaN goes to positive full scale
+static void TestFloatClipping(PcmConv::Isa isa)
+{
+  struct { float in; uint32_t out; } cases[] = {
+    { 0.0f, 0x000000 }, { 0.5f, 0x400000 }, { -0.5f, 0xC00000 }, { -1.0f, 0x800000 },
+    { 1.0f, 0x7FFFFF }, { 2.0f, 0x7FFFFF }, { -2.0f, 0x800000 }, { INFINITY, 0x7FFFFF },
+    { -INFINITY, 0x800000 }, { NAN, 0x7FFFFF },
+  };
+  const uint32_t n = sizeof(cases) / sizeof(cases[0]);
+
+  //one channel per case, 5 frames so the simd blocks and the scalar tail both see every value
+  const uint32_t frames = 5, stride = 4 + n * 3;
+  std::vector<float> client(n * frames);
+  const uint8_t* ptrs[n];
+  for (uint32_t c = 0; c < n; c++) {
+    for (uint32_t f = 0; f < frames; f++)
+      client[c * frames + f] = cases[c].in;
+    ptrs[c] = (const uint8_t*)&client[c * frames];
+  }
+
+  PcmConv::Plan plan;
+  plan.All(n);
+  std::vector<uint8_t> tx(stride * frames);
+  PcmConv::Init(isa);
+  PcmConv::Interleave[PcmConv::fmtFloat32](tx.data(), stride, 0, ptrs, plan, frames);
+
+  for (uint32_t f = 0; f < frames; f++)
+    for (uint32_t c = 0; c < n; c++) {
+      const uint8_t* p = &tx[f * stride + 4 + c * 3];
+      const uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+      if (v != cases[c].out && sFailures++ < 20)
+        printf("FAIL %s float %g gives %06X instead of %06X\n", PcmConv::IsaName(isa), cases[c].in, v, cases[c].out);
+    }
+}
+
+int main()
+{
+  const PcmConv::Isa best = PcmConv::Init();
+  printf("PcmConv kernels up to %s against scalar\n", PcmConv::IsaName(best));
+
+  TestScalarInt24();
+  TestFloatClipping(PcmConv::isaScalar);
+
+  uint32_t runs = 0;
+  for (int isa = PcmConv::isaScalar + 1; isa <= best; isa++) {
+    TestFloatClipping((PcmConv::Isa)isa);
+    for (int fmt = 0; fmt < PcmConv::MaxFormat; fmt++)
+      for (uint32_t ch = 1; ch <= MaxChannels; ch++)
+        for (const TestPlan& tp : Plans(ch))
+          for (uint32_t frames : FrameCounts) {
+            TestKernels((PcmConv::Isa)isa, (PcmConv::Format)fmt, ch, frames, tp);
+            runs++;
+          }
+  }
+
+  printf("%u kernel runs, %u failures\n", runs, sFailures);
+  return sFailures == 0 ? 0 : 1;
+}
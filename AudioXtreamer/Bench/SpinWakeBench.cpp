@@ -0,0 +1,125 @@
+#include "stdafx.h"
+#include "Win32Event.h"
+#include "LockFree/SpinWake.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/*SpinWake against the plain event pair it replaces, ping-pong between two threads
+
+  The device side signals a block to the client and waits for the answer, the client waits for the
+  block, works on it for a while and answers, the way ClientMix and the asio client hand blocks back
+  and forth. The event pair is SpinWake without words, an event set and waited on each way, the way
+  it went before. Per client work: round trip latency less the work, median, 90th and 99th percentile
+  and the longest, in us, and the kernel calls per round trip. A client that takes longer than the
+  spin budget has both sides in the kernel again, SpinWake has to come out no worse than the events.
+  Spinning only pays with a core per side, on a single core it costs the other side's time slice.
+*/
+
+std::atomic<uint32_t> Win32Event::sSets(0);
+std::atomic<uint32_t> Win32Event::sWaits(0);
+
+static const DWORD TimeoutMs = 1000;
+
+struct Result
+{
+  std::vector<int64_t> ns;
+  double kernelCalls;
+  bool ok;
+};
+
+static void Work(int64_t ns)
+{
+  const int64_t end = Bench::Nanos() + ns;
+  while (Bench::Nanos() < end)
+    ;
+}
+
+static Result PingPong(bool spin, int64_t workNs, uint32_t trips)
+{
+  WakeWord toClient = {}, toDevice = {};
+  WakeWord* const clientWord = spin ? &toClient : nullptr;
+  WakeWord* const deviceWord = spin ? &toDevice : nullptr;
+  HANDLE clientEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  HANDLE deviceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  Result result;
+  result.ns.reserve(trips);
+  result.ok = true;
+  std::atomic<bool> failed(false);
+
+  //both sides set up before the first wake
+  SpinWake deviceWake, clientWake;
+  deviceWake.Init(deviceWord, deviceEvent);
+  clientWake.Init(clientWord, clientEvent);
+
+  std::thread client([&] {
+    for (uint32_t i = 0; i < trips && !failed.load(std::memory_order_relaxed); i++) {
+      if (clientWake.Wait(TimeoutMs) != WAIT_OBJECT_0) {
+        failed.store(true);
+        break;
+      }
+      Work(workNs);
+      SpinWake::Signal(deviceWord, deviceEvent);
+    }
+  });
+
+  const uint32_t calls = Win32Event::sSets.load() + Win32Event::sWaits.load();
+  for (uint32_t i = 0; i < trips; i++) {
+    const int64_t start = Bench::Nanos();
+    SpinWake::Signal(clientWord, clientEvent);
+    if (deviceWake.Wait(TimeoutMs) != WAIT_OBJECT_0) {
+      failed.store(true);
+      break;
+    }
+    result.ns.push_back(Bench::Nanos() - start - workNs);
+  }
+  result.kernelCalls = (double)(Win32Event::sSets.load() + Win32Event::sWaits.load() - calls) / trips;
+
+  //a client stuck in its wait gets one more wake to see the failure
+  if (failed.load())
+    SpinWake::Signal(clientWord, clientEvent);
+  client.join();
+  CloseHandle(clientEvent);
+  CloseHandle(deviceEvent);
+
+  result.ok = !failed.load() && result.ns.size() == trips;
+  return result;
+}
+
+static double Percentile(std::vector<int64_t>& ns, double p)
+{
+  if (ns.empty())
+    return 0;
+  const size_t i = std::min(ns.size() - 1, (size_t)(p * ns.size()));
+  std::nth_element(ns.begin(), ns.begin() + i, ns.end());
+  return ns[i] / 1000.;
+}
+
+int main(int argc, char** argv)
+{
+  const bool quick = Bench::Quick(argc, argv);
+  const uint32_t trips = quick ? 2000 : 50000;
+  printf("SpinWake ping-pong, %u round trips, %u cores, latency less the client's work in us\n",
+    trips, std::thread::hardware_concurrency());
+  printf("%8s %-6s %8s %8s %8s %8s %8s\n", "work us", "wake", "median", "p90", "p99", "max", "kcalls");
+
+  //none, well inside the spin budget, at its edge and past it
+  const std::vector<int64_t> works = quick ? std::vector<int64_t>{ 0, 100000 } : std::vector<int64_t>{ 0, 5000, 20000, 50000, 100000 };
+  bool ok = true;
+  for (int64_t work : works) {
+    for (bool spin : { false, true }) {
+      Result r = PingPong(spin, work, trips);
+      if (!r.ok) {
+        printf("%8.0f %-6s timed out after %zu round trips\n", work / 1000., spin ? "spin" : "event", r.ns.size());
+        ok = false;
+        continue;
+      }
+      const double median = Percentile(r.ns, 0.5), p90 = Percentile(r.ns, 0.9), p99 = Percentile(r.ns, 0.99);
+      printf("%8.0f %-6s %8.2f %8.2f %8.2f %8.2f %8.2f\n", work / 1000., spin ? "spin" : "event",
+        median, p90, p99, *std::max_element(r.ns.begin(), r.ns.end()) / 1000., r.kernelCalls);
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include "stdafx.h"
+#include "Bench.h"
+#include "LockFree/SpscRing.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*SpscRing with the producer and the consumer on threads of their own
+
+  Every frame carries its sequence number in all of its bytes, the consumer checks they come in
+  whole, in order and none missing. Both sides move random counts through both of their interfaces,
+  the copies and the pointers, on a capacity that is no power of two so the cursors wrap everywhere.
+  A second pass moves whole blocks only, the way the asio client does, and checks a block never
+  crosses the end of the memory. The consumer flushes now and then, after that only the order holds.
+  Build with -DBENCH_TSAN=ON to run it under the thread sanitizer.
+*/
+
+static const uint32_t Stride = 12;
+
+static void Stamp(uint8_t* frame, uint32_t seq)
+{
+  for (uint32_t i = 0; i < Stride; i += 4)
+    memcpy(frame + i, &seq, 4);
+}
+
+//the frame's sequence number, ~0 if its bytes don't agree
+static uint32_t Check(const uint8_t* frame)
+{
+  uint32_t seq, other;
+  memcpy(&seq, frame, 4);
+  for (uint32_t i = 4; i < Stride; i += 4) {
+    memcpy(&other, frame + i, 4);
+    if (other != seq)
+      return ~0u;
+  }
+  return seq;
+}
+
+struct Random
+{
+  uint32_t state;
+  uint32_t operator()(uint32_t range)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % range;
+  }
+};
+
+static std::atomic<uint32_t> sErrors(0);
+static void Error(const char* what, uint32_t expected, uint32_t got)
+{
+  if (sErrors++ < 10)
+    printf("FAIL %s: expected %u got %u\n", what, expected, got);
+}
+
+//random counts, both interfaces on both sides
+static void RunFree(uint32_t capacity, uint32_t total)
+{
+  std::vector<uint8_t> mem(capacity * Stride);
+  SpscRing ring;
+  ring.Init(mem.data(), Stride, capacity);
+  //a flush may have taken the last frames, the consumer stops once the producer is through
+  std::atomic<bool> done(false);
+
+  std::thread producer([&] {
+    Random rnd = { 0x9E3779B9 };
+    std::vector<uint8_t> buf(capacity * Stride);
+    for (uint32_t seq = 0; seq < total; ) {
+      const uint32_t want = min(1 + rnd(capacity), total - seq);
+      if (rnd(2)) {
+        for (uint32_t i = 0; i < want; i++)
+          Stamp(&buf[i * Stride], seq + i);
+        seq += ring.Write(buf.data(), want);
+      }
+      else {
+        uint32_t contiguous;
+        uint8_t* p = ring.WritePtr(contiguous);
+        const uint32_t n = min(want, contiguous);
+        for (uint32_t i = 0; i < n; i++)
+          Stamp(p + i * Stride, seq + i);
+        ring.Commit(n);
+        seq += n;
+      }
+      if (ring.Space() == 0)
+        std::this_thread::yield();
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  Random rnd = { 0x85EBCA6B };
+  std::vector<uint8_t> buf(capacity * Stride);
+  uint32_t next = 0;
+  bool flushed = false;
+  while (next < total && !(done.load(std::memory_order_acquire) && ring.Fill() == 0)) {
+    const uint32_t want = 1 + rnd(capacity);
+    uint32_t n;
+    const uint8_t* p;
+    if (rnd(2)) {
+      n = ring.Read(buf.data(), want);
+      p = buf.data();
+    }
+    else {
+      uint32_t contiguous;
+      p = ring.ReadPtr(contiguous);
+      n = min(want, contiguous);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+      const uint32_t seq = Check(p + i * Stride);
+      if (seq == ~0u)
+        Error("torn frame", next, seq);
+      else if (flushed ? seq < next : seq != next)
+        Error("out of order", next, seq);
+      else
+        next = seq + 1;
+      flushed = false;
+    }
+    if (p != buf.data())
+      ring.Release(n);
+
+    if (n == 0)
+      std::this_thread::yield();
+    else if (rnd(4096) == 0) {
+      ring.Flush();
+      flushed = true;
+    }
+  }
+  producer.join();
+}
+
+//whole blocks through the pointers, a block must always be contiguous
+static void RunBlocks(uint32_t block, uint32_t blocks, uint32_t total)
+{
+  const uint32_t capacity = block * blocks;
+  std::vector<uint8_t> mem(capacity * Stride);
+  SpscRing ring;
+  ring.Init(mem.data(), Stride, capacity);
+
+  std::thread producer([&] {
+    for (uint32_t seq = 0; seq < total; ) {
+      if (ring.Space() < block) {
+        std::this_thread::yield();
+        continue;
+      }
+      uint32_t contiguous;
+      uint8_t* p = ring.WritePtr(contiguous);
+      if (contiguous < block)
+        Error("block split on write", block, contiguous);
+      for (uint32_t i = 0; i < block; i++)
+        Stamp(p + i * Stride, seq + i);
+      ring.Commit(block);
+      seq += block;
+    }
+  });
+
+  uint32_t next = 0;
+  while (next < total) {
+    if (ring.Fill() < block) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint32_t contiguous;
+    const uint8_t* p = ring.ReadPtr(contiguous);
+    if (contiguous < block)
+      Error("block split on read", block, contiguous);
+    for (uint32_t i = 0; i < block; i++, next++) {
+      const uint32_t seq = Check(p + i * Stride);
+      if (seq != next)
+        Error("block out of order", next, seq);
+    }
+    ring.Release(block);
+  }
+  producer.join();
+}
+
+int main(int argc, char** argv)
+{
+  const bool quick = Bench::Quick(argc, argv);
+  const uint32_t total = quick ? 200000 : 20000000;
+
+  const int64_t start = Bench::Nanos();
+  for (uint32_t capacity : { 1u, 7u, 100u, 1023u })
+    RunFree(capacity, total / 4);
+  for (uint32_t block : { 16u, 37u, 255u })
+    RunBlocks(block, 3, (total / 4 / block) * block);
+
+  printf("SpscRing stress, %u frames a run, %.1f s, %u errors\n", total / 4, (Bench::Nanos() - start) / 1e9, sErrors.load());
+  return sErrors == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include "Bench.h"
+
+/*The few Win32 types and calls the ipc code makes, SpinWake and ClientMix, on Linux, so it builds here unchanged
+
+  An auto reset event is a word and a futex on it. SetEvent is always a syscall, the way it is always a
+  kernel call on Windows, WaitForSingleObject one as soon as the event isn't set already. Both count
+  their calls, a benchmark tells what went to the kernel. QPC runs in ns.
+*/
+typedef void* HANDLE;
+typedef void* HWND;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int BOOL;
+typedef char TCHAR;
+typedef const char* LPCTSTR;
+struct CLSID { uint32_t Data[4]; };
+#define MAX_PATH 260
+#ifndef FALSE
+#define FALSE 0
+#define TRUE 1
+#endif
+#define WAIT_OBJECT_0 0u
+#define WAIT_TIMEOUT 258u
+#define INFINITE 0xFFFFFFFFu
+
+union LARGE_INTEGER
+{
+  int64_t QuadPart;
+};
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* freq)
+{
+  freq->QuadPart = 1000000000;
+  return TRUE;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* now)
+{
+  now->QuadPart = Bench::Nanos();
+  return TRUE;
+}
+
+inline LONG InterlockedIncrement(volatile LONG* value)
+{
+  return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedAnd(volatile LONG* value, LONG mask)
+{
+  return __atomic_fetch_and(value, mask, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedOr(volatile LONG* value, LONG mask)
+{
+  return __atomic_fetch_or(value, mask, __ATOMIC_SEQ_CST);
+}
+
+inline DWORD GetLastError()
+{
+  return 0;
+}
+
+#define ZeroMemory(ptr, size) memset((ptr), 0, (size))
+
+inline void YieldProcessor()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  _mm_pause();
+#endif
+}
+
+namespace Win32Event
+{
+  struct Event
+  {
+    std::atomic<int> state;
+  };
+
+  //kernel calls so far
+  extern std::atomic<uint32_t> sSets;
+  extern std::atomic<uint32_t> sWaits;
+}
+
+//auto reset only, the name is ignored
+inline HANDLE CreateEvent(void*, BOOL, BOOL initial, const char*)
+{
+  Win32Event::Event* e = new Win32Event::Event;
+  e->state.store(initial ? 1 : 0);
+  return e;
+}
+
+inline BOOL CloseHandle(HANDLE h)
+{
+  delete (Win32Event::Event*)h;
+  return TRUE;
+}
+
+inline BOOL SetEvent(HANDLE h)
+{
+  Win32Event::Event* e = (Win32Event::Event*)h;
+  Win32Event::sSets.fetch_add(1, std::memory_order_relaxed);
+  e->state.store(1, std::memory_order_seq_cst);
+  syscall(SYS_futex, (int*)&e->state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  return TRUE;
+}
+
+inline DWORD WaitForSingleObject(HANDLE h, DWORD timeoutMs)
+{
+  Win32Event::Event* e = (Win32Event::Event*)h;
+  const int64_t deadline = Bench::Nanos() + (int64_t)timeoutMs * 1000000;
+  for (;;) {
+    if (e->state.exchange(0, std::memory_order_acquire) == 1)
+      return WAIT_OBJECT_0;
+
+    timespec ts = {};
+    if (timeoutMs != INFINITE) {
+      const int64_t left = deadline - Bench::Nanos();
+      if (left <= 0)
+        return WAIT_TIMEOUT;
+      ts.tv_sec = left / 1000000000;
+      ts.tv_nsec = left % 1000000000;
+    }
+    Win32Event::sWaits.fetch_add(1, std::memory_order_relaxed);
+    syscall(SYS_futex, (int*)&e->state, FUTEX_WAIT_PRIVATE, 0, timeoutMs != INFINITE ? &ts : nullptr, nullptr, 0);
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+//stands in for the projects' precompiled header when the portable sources are built on their own
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+//the Windows min/max macros the sources use
+using std::min;
+using std::max;
+
+#define LOG0(x) fprintf(stderr, x "\n")
+#define LOGN(x, ...) fprintf(stderr, x, __VA_ARGS__)
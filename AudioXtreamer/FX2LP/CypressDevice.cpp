@@ -9,6 +9,7 @@
 #include "UsbBackend.h"
 
 #include "ZTEXDev\ztexdev.h"
+#include "Trace\Trace.h"
 #include "resource.h"
 
 
@@ -41,15 +42,46 @@ uint8_t setyb[256];
 
 CypressDevice::CypressDevice(UsbDeviceClient & client, ASIOSettings::Settings &params )
   : UsbDevice(client,params)
-  , asioInPtr(nullptr)
-  , asioOutPtr(nullptr)
   , mDevStatus({ 0 })
   , mFileHandle(NULL)
   , mASIOHandle(NULL)
   , mTxRequests(nullptr)
   , mRxRequests(nullptr)
+  , mNrXfers(0)
+  , mPktCount(0)
+  , mPktSize(0)
+  , mIsoSize(0)
+  , mSyncClient(false)
+  , mSwitchPending(false)
+  , mSpinSwitch(false)
+  , mSpinWakes(0)
+  , mRxFrames(0)
+  , mHwRate(0)
+  , mSRCandidate(0)
+  , mSRHold(0)
+  , mClientBusy(false)
+  , mBlockFrames(0)
+  , mRingFrames(0)
+  , mQueueDepth(0)
+  , mTxTrim(0)
+  , mClientOut(nullptr)
+  , mTraceClient(0)
+  , mTelemetry(nullptr)
+  , mFifoMax(0)
+  , mRxPackets(0)
+  , mRxLost(0)
+  , mLastOutSkip(0)
+  , mLastInFull(0)
+  , mLastPageFaults(0)
+  , mProfRx("RxIsochCB")
+  , mProfHdr("ProcessHdr")
+  , mProfMidiIn("MidiIn")
+  , mProfTx("TxIsochCB")
+  , mProfTxInit("TxHeaders")
+  , mProfMidiOut("MidiOut")
 {
   LOG0("CypressDevice::CypressDevice");
+  Trace::Open();
 
   mDefOutEP = 0;
   mDefInEP = 0;
@@ -76,14 +108,19 @@ CypressDevice::CypressDevice(UsbDeviceClient & client, ASIOSettings::Settings &p
       ((b & 1) << 7);
   }
 
-  HRSRC hrc = FindResource(NULL, MAKEINTRESOURCE(IDR_FPGA_BIN), _T("RC_DATA"));
-  HGLOBAL hg = LoadResource(NULL, hrc);
+  //the bitstream lives in the module we are linked into, the exe or the asio dll in direct mode
+  HMODULE hModule = NULL;
+  GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+    (LPCTSTR)&setyb, &hModule);
+
+  HRSRC hrc = FindResource(hModule, MAKEINTRESOURCE(IDR_FPGA_BIN), _T("RC_DATA"));
+  HGLOBAL hg = LoadResource(hModule, hrc);
   uint8_t* bits = (uint8_t*)LockResource(hg);
   mBitstream = nullptr;
 
   if (bits)
   {
-    mResourceSize = SizeofResource(NULL, hrc);
+    mResourceSize = SizeofResource(hModule, hrc);
     
     uint8_t * bitstream = (uint8_t *)malloc(mResourceSize +512);
     ZeroMemory(bitstream, 512);
@@ -113,6 +150,7 @@ CypressDevice::~CypressDevice()
 
 
   CloseHandle(hSem);
+  Trace::Close();
 }
 
 bool CypressDevice::Start()
@@ -299,27 +337,6 @@ bool CypressDevice::IsPresent() {
 template<typename T1, typename T2>
 constexpr auto NrPackets(T1 size, T2 len) { return ( (size / len) + (size % len ? 1 : 0) ); }
 
-#define SNAP_TOLERANCE 100
-#define SNAP_TO_AND_RET(val,snapto) { if(val > (snapto - SNAP_TOLERANCE) && val < (snapto + SNAP_TOLERANCE)) return snapto; }
-
-constexpr auto ConvertSampleRate(uint32_t srReg)
-{
-  uint16_t count = (uint16_t)(srReg & 0xFFFF);
-  uint16_t fract = (uint16_t)(srReg >> 16);
-  uint32_t sr = count * 10;
-  //mSRacc -= mSRvals[mSRidx];
-  //mSRacc += sr;
-  //mSRvals[mSRidx] = sr;
-  //mSRidx = (mSRidx + 1) & 0xf;
-
-  SNAP_TO_AND_RET(sr, 44100);
-  SNAP_TO_AND_RET(sr, 48000);
-  SNAP_TO_AND_RET(sr, 88200);
-  SNAP_TO_AND_RET(sr, 96000);
-
-  return 0;
-}
-
 static const uint16_t Sine48[48] =
 { 32768, 37045, 41248, 45307, 49151, 52715, 55938, 58764,
 61145, 63041, 64418, 65255, 65535, 65255, 64418, 63041,
@@ -328,40 +345,49 @@ static const uint16_t Sine48[48] =
 4390, 2494, 1117, 280, 0, 280, 1117, 2494,
 4390, 6771, 9597, 12820, 16384, 20228, 24287, 28490 };
 
-#pragma pack (push,1)
-struct RxHeader
-{
-  uint16_t Hdr1;
-  uint16_t Hdr2;
-  uint16_t SamplingRate;
-  uint16_t FifoLevel;
-  uint16_t OutSkipCount;
-  uint16_t InFullCount;
-  uint8_t midi_in[8];
-};
-#pragma pack (pop)
-
-static const uint32_t scTxHeaderSize = 4;
+//rx headers in a row, one per packet, a new rate must show in before it is taken
+static const uint32_t scSRHold = 32;
 
 bool CypressDevice::ProcessHdr(uint8_t* pHdr)
 {
-  struct RxHeader* hdr = (struct RxHeader* )pHdr;
+  const RxHeader* hdr = RxHeaderAt(pHdr);
 
-  if (hdr->Hdr1 == 0xaaaa && hdr->Hdr2 == 0x5555)
+  if (hdr != nullptr)
   {
 
+    //the raw count for the rate estimate, the snapped rate for the host
+    mHwRate = (uint32_t)hdr->SamplingRate * 10;
     uint32_t SR = ConvertSampleRate(hdr->SamplingRate);
-    if (mDevStatus.LastSR != SR && mDevStatus.LastSR != -1 && mDevStatus.LastSR != 0)
-    {
-      devClient.SampleRateChanged();
+
+    //a new rate has to hold for a few ms before the host hears of it, a header at the old rate starts over
+    if (SR == mDevStatus.LastSR) {
+      mSRCandidate = 0;
+      mSRHold = 0;
+    } else if (mDevStatus.LastSR != -1) {
+      if (SR != mSRCandidate) {
+        mSRCandidate = SR;
+        mSRHold = 0;
+      }
+      if (++mSRHold < scSRHold)
+        SR = mDevStatus.LastSR;
     }
+
+    //the client may ask for the rate right away, it gets the new one
+    const bool changed = mDevStatus.LastSR != SR && mDevStatus.LastSR != -1 && mDevStatus.LastSR != 0;
     mDevStatus.LastSR = SR;
+    if (changed)
+      devClient.SampleRateChanged();
 
     mDevStatus.FifoLevel    = hdr->FifoLevel;
+    mFifoMax = max(mFifoMax, (uint32_t)hdr->FifoLevel);
     mDevStatus.OutSkipCount = hdr->OutSkipCount;
     mDevStatus.InFullCount  = hdr->InFullCount;
 
+    mJitter.Sample(hdr->FifoLevel, hdr->OutSkipCount);
+
+    mProfMidiIn.Begin();
     midi.MidiIn(hdr->midi_in);
+    mProfMidiIn.End(0, sizeof(hdr->midi_in));
     return true;
   }
   return false;
@@ -370,16 +396,13 @@ bool CypressDevice::ProcessHdr(uint8_t* pHdr)
 //initialize header mark
 void CypressDevice::InitTxHeaders(uint8_t* ptr, uint32_t Samples)
 {
+  mProfTxInit.Begin();
+  FillTxHeaders(ptr, Samples, OUTStride);
+#if LOOPBACK_TEST
   USHORT w = 0;
-  ZeroMemory(ptr, Samples * OUTStride);
   for (uint32_t i = 0; i < Samples; i++)
   {
     PUCHAR p = ptr + i * OUTStride;
-    *p = 0xAA;
-    *(p + 1) = 0x55;
-    *(p + 2) = 0x55;
-    *(p + 3) = 0xAA;
-#if LOOPBACK_TEST
     /*for (uint32_t c = 0; c < (nrOuts/2)*3; ++c)
     {
       *(PUSHORT)(ptr + i * OUTStride + TxHeaderSize + c * 2) = w >>8 | w <<8;
@@ -391,21 +414,47 @@ void CypressDevice::InitTxHeaders(uint8_t* ptr, uint32_t Samples)
       *(p + scTxHeaderSize + c * 3 + 1) = uint8_t(Sine48[i % 48] & 0xff);
       *(p + scTxHeaderSize + c * 3 + 2) = uint8_t(Sine48[i % 48] >> 8);
     }
-#endif
   }
+#endif
+  mProfTxInit.End(Samples, Samples * OUTStride);
 }
 
 //---------------------------------------------------------------------------------------------
-static const uint16_t rxpktSize = 1024;
-static const uint16_t rxpktCount = 8;
-static const uint16_t IsoSize = rxpktCount * rxpktSize;
-static const uint16_t precharge = 44;
+//defaults when the backend can't tell its limits, 1ms requests of 1k packets at high speed
+static const uint32_t defPktSize = 1024;
+static const uint32_t defPktMultiple = 8;
+static const uint32_t defMaxPkts = 1024;
 
-//must be a power of two
-static const uint8_t NrXfers = 2;
-inline void NextXfer(uint8_t& val) { ++val &= (NrXfers - 1); }
-static const uint8_t NrASIOBuffs = 16;
-inline void NextASIO(uint8_t& val) { ++val &= (NrASIOBuffs - 1); }
+static const uint8_t MaxXfers = 8;
+static_assert(2 * MaxXfers <= scXferPoolSize, "the backends' pools don't hold a context for every request");
+inline void NextXfer(uint8_t& val, uint8_t count) { if (++val >= count) val = 0; }
+
+//the iso pipeline from the XferCount and XferPackets settings, held to what both endpoints take
+void CypressDevice::SetupXfers()
+{
+  IsoLimits limits = { defPktMultiple, defMaxPkts, defPktSize };
+  IsoLimits epLimits;
+  for (uint8_t ep : { mDefInEP, mDefOutEP }) {
+    if (bknd_iso_limits(mDevHandle, ep, &epLimits)) {
+      limits.pktMultiple = max(limits.pktMultiple, epLimits.pktMultiple);
+      limits.maxPkts = min(limits.maxPkts, epLimits.maxPkts);
+      limits.pktSize = min(limits.pktSize, epLimits.pktSize);
+    }
+    else
+      LOGN("CypressDevice::SetupXfers no iso limits for ep 0x%02X, using defaults\n", ep);
+  }
+
+  const uint32_t maxPkts = max(limits.pktMultiple, (limits.maxPkts / limits.pktMultiple) * limits.pktMultiple);
+  uint32_t pkts = (uint32_t)max(1, devParams[XferPackets].val);
+  pkts = ((pkts + limits.pktMultiple - 1) / limits.pktMultiple) * limits.pktMultiple;
+  mPktCount = min(pkts, maxPkts);
+  mPktSize = limits.pktSize;
+  mIsoSize = mPktCount * mPktSize;
+  mNrXfers = (uint8_t)max(1, min(devParams[XferCount].val, (int)MaxXfers));
+
+  LOGN("CypressDevice::SetupXfers %u requests of %u x %u bytes (%u asked, multiple of %u)\n",
+    mNrXfers, mPktCount, mPktSize, devParams[XferPackets].val, limits.pktMultiple);
+}
 
 //---------------------------------------------------------------------------------------------
 
@@ -422,6 +471,7 @@ void CypressDevice::main()
   DWORD proAudioIndex = 0;
   HANDLE AvrtHandle = AvSetMmThreadCharacteristics(L"Pro Audio", &proAudioIndex);
   AvSetMmThreadPriority(AvrtHandle, AVRT_PRIORITY_CRITICAL);
+  Trace::AttachThread("usb worker");
 
 
   const uint32_t nrIns = (devParams[NrIns].val + 1) * 2;
@@ -451,27 +501,49 @@ void CypressDevice::main()
     (uint32_t)devParams[NrOuts].val , (uint32_t)devParams[NrIns].val, nrSamples, fifoDepth, 0
   };
 
-  uint8_t* mINBuff = nullptr, * mOUTBuff = nullptr;
-  devClient.AllocBuffers(INBuffSize * 2, mINBuff, OUTBuffSize * 2, mOUTBuff);
+  //the client's block size is only known once it comes in, the rings take the queue of the largest one
+  mQueueDepth = max(2, min(devParams[QueueDepth].val, (int)MaxQueueDepth));
+  mRingFrames = mQueueDepth * MaxBlockFrames;
+  mBlockFrames = nrSamples;
 
-  uint8_t* inPtr[NrASIOBuffs];
-  uint8_t* outPtr[NrASIOBuffs];
-  asioInPtr = inPtr;
-  asioOutPtr = outPtr;
-  for (uint32_t c = 0; c < NrASIOBuffs; ++c)
-  {
-    inPtr[c] = mINBuff + (c* INBuffSize);
-    outPtr[c] = mOUTBuff + (c * OUTBuffSize);
-    InitTxHeaders(outPtr[c], nrSamples);
+  uint8_t* mINBuff = nullptr, * mOUTBuff = nullptr;
+  if (!devClient.AllocBuffers(mRingFrames * InStride, mINBuff, mRingFrames * OUTStride, mOUTBuff, MaxBlockFrames * OUTStride)) {
+    //nothing is streaming yet, the device stays idle until the next start
+    LOGN("CypressDevice::main no rings for %u frames, not starting\n", mRingFrames);
+    devClient.FreeBuffers(mINBuff, mOUTBuff);
+    Trace::DetachThread();
+    AvRevertMmThreadCharacteristics(AvrtHandle);
+    CloseHandle(mExitHandle);
+    mExitHandle = INVALID_HANDLE_VALUE;
+    devClient.DeviceStopped(false);
+    return;
   }
 
-  XferReq RxRequests[NrXfers];
-  XferReq TxRequests[NrXfers];
-  ZeroMemory(RxRequests, sizeof(mRxRequests));
+  mInRing.Init(mINBuff, InStride, mRingFrames);
+  mOutRing.Init(mOUTBuff, OUTStride, mRingFrames);
+  mTelemetry = devClient.TelemetryBlock();
+  mFifoMax = mRxPackets = mRxLost = 0;
+  mLastOutSkip = mLastInFull = 0;
+  mLastPageFaults = PinnedArena::PageFaults();
+  InitTxHeaders(mOUTBuff, mRingFrames);
+
+  SetupXfers();
+
+  XferReq RxRequests[MaxXfers];
+  XferReq TxRequests[MaxXfers];
+  ZeroMemory(RxRequests, sizeof(RxRequests));
   ZeroMemory(TxRequests, sizeof(TxRequests));
   mRxRequests = RxRequests;
   mTxRequests = TxRequests;
 
+  //the backends allocate the buffers themselves if there is no arena
+  const uint32_t isoPages = (mIsoSize + 4095) & ~4095;
+  mArena.Reserve(2 * mNrXfers * isoPages);
+  for (uint32_t c = 0; c < mNrXfers; ++c) {
+    mTxRequests[c].buff = (uint8_t*)mArena.Alloc(mIsoSize, 4096);
+    mRxRequests[c].buff = (uint8_t*)mArena.Alloc(mIsoSize, 4096);
+  }
+
   //CALL PROC
   midi.Init();
 
@@ -484,24 +556,28 @@ void CypressDevice::main()
 
   InitFpga(ch_params.u32);
 
-  for (uint32_t c = 0; c < NrXfers; ++c)
+  mJitter.Init(fifoDepth);
+  mTxTrim = 0;
+  const uint32_t precharge = mJitter.Precharge();
+
+  for (uint32_t c = 0; c < mNrXfers; ++c)
   {
     mTxRequests[c].handle = mDevHandle;
     mTxRequests[c].endpoint = mDefOutEP;
-    mTxRequests[c].bufflen = IsoSize;
+    mTxRequests[c].bufflen = mIsoSize;
 
-    if (bknd_init_write_xfer(mDevHandle, &mTxRequests[c], rxpktCount, rxpktSize)) {
+    if (bknd_init_write_xfer(mDevHandle, &mTxRequests[c], mPktCount, mPktSize)) {
       mTxRequests[c].ovlp.hEvent = CreateEvent(NULL, FALSE, FALSE, nullptr);
-      ZeroMemory(mTxRequests[c].buff, IsoSize);
+      ZeroMemory(mTxRequests[c].buff, mIsoSize);
       InitTxHeaders(mTxRequests[c].buff, precharge);
       bknd_iso_write(&mTxRequests[c]);
     }
 
     mRxRequests[c].handle = mDevHandle;
     mRxRequests[c].endpoint = mDefInEP;
-    mRxRequests[c].bufflen = IsoSize;
+    mRxRequests[c].bufflen = mIsoSize;
 
-    if (bknd_init_read_xfer(mDevHandle, &mRxRequests[c], rxpktCount, rxpktSize)) {
+    if (bknd_init_read_xfer(mDevHandle, &mRxRequests[c], mPktCount, mPktSize)) {
       mRxRequests[c].ovlp.hEvent = CreateEvent(NULL, FALSE, FALSE, nullptr);
       bknd_iso_read(&mRxRequests[c]);
     }
@@ -509,23 +585,27 @@ void CypressDevice::main()
 
   mDevStatus.LastSR = -1;
 
-  /*The shared mem is a single linear space where we put samples for the asio client
-    and where the asio client puts output samples.
-    The rxptr is the start point where isoch can write the input data
-    The asioptr is the sample point for the asio client
-    The txptr is the sample point where we have audio samples for the output data
+  /*The shared mem holds one ring per direction, mQueueDepth blocks of the client's block size each.
 
-    |-------|-------------|-------------------|----------------|
-    0     txptr         asioptr             rxptr             len
+    in:   |-------|=====================|---------|
+          0    client(read)        isoch(write)  len
+    out:  |-------|=====================|---------|
+          0    isoch(read)        client(write)  len
 
-    Each completion will process and advance the pointers until they wrap around.
-    To keep the communication with the asio client simple, no buffer to asio will cross the wrap around boundary
+    Isoch moves its cursor any number of frames, the client always a whole block.
+    The rings are laid out again whenever the client comes in, its side starts at 0 and
+    no block to asio crosses the wrap around.
+    The usb side runs at its own nrSamples cadence, the client block can be anything in
+    MinBlockFrames..MaxBlockFrames, the rings do the re-blocking.
   */
-  RxProgress = 0;
-  RxBuff = 0;
-  AsioBuff = 0;
-  TxBuff = 0;
-  TxBuffPos = 0;
+  mRxFramer.Init(InStride);
+  mClientBusy = false;
+  mClock.Reset();
+  mProbe.Abort();
+  mRxFrames = 0;
+  mHwRate = 0;
+  mSRCandidate = 0;
+  mSRHold = 0;
   IsoTxSamples = 0;
   ClientActive = false;
 
@@ -534,6 +614,16 @@ void CypressDevice::main()
   mASIOHandle = devClient.GetSwitchHandle();
   ResetEvent(mASIOHandle);
 
+  mSyncClient = mASIOHandle == NULL;
+  mSwitchPending = false;
+  mSpinSwitch = false;
+  mAsioWake.Init(mSyncClient ? nullptr : devClient.SwitchWake(), mASIOHandle);
+  SetClientActive(mSyncClient && devClient.ClientPresent());
+
+  QueryPerformanceFrequency(&mQpcFreq);
+  mWakes = mSwitches = mSwitchLatMax = mSpinWakes = 0;
+  mSwitchLatSum = 0;
+
 
   HANDLE timerH = CreateWaitableTimer(NULL, FALSE, nullptr);
   LARGE_INTEGER li;
@@ -544,9 +634,26 @@ void CypressDevice::main()
 
   while (WaitForSingleObject(mExitHandle, 0) == WAIT_TIMEOUT)
   {
+    //the client's answer to a block usually comes within a few us, catch it before going to sleep
+    if (mSpinSwitch) {
+      mSpinSwitch = false;
+      if (mAsioWake.Spin()) {
+        mSpinWakes++;
+        AsioClientCB();
+        continue;
+      }
+    }
+
+    //a client that doesn't answer in time is dropped from the block at its deadline, not on whatever wakes next
+    const DWORD switchWait = mSwitchPending ? devClient.SwitchWaitMs() : INFINITE;
+    const DWORD timeout = min(switchWait, (DWORD)500);
 
+    //an answer that came before the arming is taken right away, one after it sets the event
+    const bool sleep = mAsioWake.Arm();
     HANDLE events[4] = { mTxRequests[mTxReqIdx].ovlp.hEvent, mRxRequests[mRxReqIdx].ovlp.hEvent, timerH, mASIOHandle };
-    DWORD wfmo = WaitForMultipleObjects(mASIOHandle == NULL ? 3 : 4, events, false, 500);
+    DWORD wfmo = sleep ? WaitForMultipleObjects(mASIOHandle == NULL ? 3 : 4, events, false, timeout) : WAIT_OBJECT_0 + 3;
+    mAsioWake.Disarm();
+    mWakes++;
 
     switch (wfmo)
     {
@@ -555,6 +662,10 @@ void CypressDevice::main()
     case WAIT_OBJECT_0 + 2: TimerCB(); break;//1sec timer
     case WAIT_OBJECT_0 + 3: AsioClientCB(); break;//ASIO ready
 
+    case WAIT_TIMEOUT:
+      if (timeout == switchWait)
+        break;//the switch deadline, PollSwitch below
+      //no transfer for 500ms, falls through
     default: //not good
       if (wfmo == 0xffffffff)
       {
@@ -569,11 +680,23 @@ void CypressDevice::main()
       }
       break;
     };
+
+    PollSwitch();
   }
 
   CancelWaitableTimer(timerH);
   CloseHandle(timerH);
 
+  DriverLoad* load = devClient.LoadBlock();
+  if (load != nullptr)
+    LoadHistogram::Clear(load->RoundTrip);
+  //readers take a zero time for a device not streaming
+  if (mTelemetry != nullptr) {
+    SeqLock::WriteBegin(mTelemetry->Sequence);
+    mTelemetry->Time = 0;
+    SeqLock::WriteEnd(mTelemetry->Sequence);
+    mTelemetry = nullptr;
+  }
   devClient.FreeBuffers(mINBuff, mOUTBuff);
 
   if (ErrorBreak)
@@ -582,7 +705,7 @@ void CypressDevice::main()
     bknd_abort_pipe(mDevHandle, mDefInEP);
   }
 
-  for (uint32_t c = 0; c < NrXfers; ++c){
+  for (uint32_t c = 0; c < mNrXfers; ++c){
     WaitForSingleObject(mRxRequests[c].ovlp.hEvent, 500);
     CloseHandle(mRxRequests[c].ovlp.hEvent);
     bknd_xfer_cleanup(&mRxRequests[c]);
@@ -590,11 +713,15 @@ void CypressDevice::main()
     CloseHandle(mTxRequests[c].ovlp.hEvent);
     bknd_xfer_cleanup(&mTxRequests[c]);
   }
+  mArena.Release();
 
+  Trace::DetachThread();
   AvRevertMmThreadCharacteristics(AvrtHandle);
 
   CloseHandle(mExitHandle);
   mExitHandle = INVALID_HANDLE_VALUE;
+
+  devClient.DeviceStopped(ErrorBreak);
   LOG0("CypressDevice::main Exit");
 }
 
@@ -603,7 +730,112 @@ void CypressDevice::main()
 
 void CypressDevice::UpdateClient()
 {
-  devClient.Switch(0, InStride, asioInPtr[AsioBuff], OUTStride, asioOutPtr[AsioBuff] + scTxHeaderSize);
+  uint32_t inFrames, outFrames;
+  uint8_t* inPtr = mInRing.ReadPtr(inFrames);
+  uint8_t* outPtr = mOutRing.WritePtr(outFrames);
+  ASSERT(inFrames >= mBlockFrames && outFrames >= mBlockFrames);
+
+  mClientBusy = true;
+  mClientOut = outPtr;
+  mProbe.Input(inPtr, InStride, mBlockFrames);
+  //the oldest frame in the ring starts the block, the frame after its end dates it
+  devClient.SetBlockTime(mClock.Time(mRxFrames - mInRing.Fill() + mBlockFrames));
+  QueryPerformanceCounter(&mSwitchStart);
+  mTraceClient = Trace::Now();
+  //the client rebuilds whole tx frames, header included
+  devClient.Switch(mBlockFrames, InStride, inPtr, OUTStride, outPtr);
+
+  if (mSyncClient)
+    SwitchDone();
+  else
+    mSwitchPending = mSpinSwitch = true;
+}
+
+//the client is done with its block
+void CypressDevice::SwitchDone()
+{
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  const uint32_t lap = LAP(mSwitchStart, now, mQpcFreq);
+
+  mSwitches++;
+  mSwitchLatSum += lap;
+  if (lap > mSwitchLatMax)
+    mSwitchLatMax = lap;
+
+  //the deadline is the next block, a client slower than that falls behind the stream
+  const uint32_t sr = mDevStatus.LastSR;
+  if (sr != 0 && sr != (uint32_t)-1)
+    mSwitchLoad.Add(now.QuadPart - mSwitchStart.QuadPart, mBlockFrames * mQpcFreq.QuadPart / sr);
+
+  Trace::Span(Trace::evClientBlock, mTraceClient, mBlockFrames);
+  mProbe.Output(mClientOut + scTxHeaderSize, OUTStride, mBlockFrames);
+  mInRing.Release(mBlockFrames);
+  mOutRing.Commit(mBlockFrames);
+  mClientBusy = false;
+}
+
+//the block is done once all the clients answered or were left behind
+void CypressDevice::PollSwitch()
+{
+  if (mSwitchPending && devClient.SwitchComplete()) {
+    mSwitchPending = false;
+    SwitchDone();
+    NextBlock();
+  }
+}
+
+//hands the client the next block as soon as there are input samples and room for the output
+void CypressDevice::NextBlock()
+{
+  //a host may re-create its buffers at another size and keep its slot, the rings follow once the
+  //block it holds is back
+  if (ClientActive && !mClientBusy) {
+    const uint32_t block = ClientBlock();
+    if (block != mBlockFrames)
+      LayoutRings(block);
+  }
+
+  while (ClientActive && !mClientBusy &&
+    mInRing.Fill() >= mBlockFrames && mOutRing.Space() >= mBlockFrames)
+    UpdateClient();
+}
+
+//the client's block size within what the rings hold
+uint32_t CypressDevice::ClientBlock()
+{
+  uint32_t block = devClient.BlockFrames();
+  if (block == 0)
+    block = nrSamples;
+  return max((uint32_t)MinBlockFrames, min(block, min((uint32_t)MaxBlockFrames, mRingFrames / 2)));
+}
+
+//a fresh start with the block size, both rings hold a whole number of blocks. Not while the client holds one
+void CypressDevice::LayoutRings(uint32_t block)
+{
+  mBlockFrames = block;
+  const uint32_t capacity = min(mQueueDepth, mRingFrames / mBlockFrames) * mBlockFrames;
+
+  mInRing.Init(mInRing.Data(), InStride, capacity);
+  mOutRing.Init(mOutRing.Data(), OUTStride, capacity);
+  mClientBusy = false;
+  mProbe.Abort();
+  LOGN("CypressDevice client in, %u blocks of %u samples, usb at %u\n", capacity / mBlockFrames, mBlockFrames, nrSamples);
+}
+
+void CypressDevice::SetClientActive(bool active)
+{
+  if (active && !ClientActive)
+    LayoutRings(ClientBlock());
+  else if (!active) {
+    //nobody consumes the input, what is queued for the output is stale
+    mInRing.Reset();
+    mOutRing.Flush();
+    mClientBusy = false;
+    mSwitchPending = false;
+    mProbe.Abort();
+  }
+  ClientActive = active;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -611,58 +843,46 @@ static uint32_t sSampleCounter = 0;
 void CypressDevice::TxIsochCB()
 {
         XferReq& TxReq = mTxRequests[mTxReqIdx];
-        uint16_t txIsoSize = IsoSize;
         uint8_t* ptr = TxReq.buff;
+        uint8_t* const end = TxReq.buff + mIsoSize;
+        const uint64_t trace = Trace::Now();
+        mProfTx.Begin();
+
+        mProfMidiOut.Begin();
+        uint8_t s = midi.MidiOut(ptr);
+        mProfMidiOut.End(0, s);
+        ptr += s;
 
-        if (uint8_t s = midi.MidiOut(ptr))
+        //jitter control, extra silence raises the fifo level
+        if (mTxTrim > 0)
         {
-          ptr += s;
-          txIsoSize -= s;
+          uint16_t count = (uint16_t)min((uint32_t)mTxTrim, (uint32_t)((end - ptr) / OUTStride));
+          InitTxHeaders(ptr, count);
+          ptr += count * OUTStride;
+          mTxTrim -= count;
         }
-
-        uint16_t TxSamples = min(IsoTxSamples, txIsoSize / OUTStride);
-
-        //partial TxBuff
-        if (TxSamples > 0 && TxBuffPos > 0 && TxBuff != AsioBuff)
+        //dropped frames lower it, queued audio while streaming, otherwise silence not sent
+        else if (mTxTrim < 0)
         {
-          uint32_t count = min(nrSamples - TxBuffPos, TxSamples);
-          memcpy(ptr, asioOutPtr[TxBuff] + (TxBuffPos * OUTStride), count * OUTStride);
-          TxBuffPos += count;
-
-          ASSERT(TxBuffPos <= nrSamples);
-
-          if (TxBuffPos >= nrSamples)
-          {
-            TxBuffPos = 0;
-            NextASIO(TxBuff);
+          uint32_t count = (uint32_t)(-mTxTrim);
+          if (ClientActive) {
+            count = min(count, mOutRing.Fill());
+            mOutRing.Release(count);
           }
-
-          ptr += count * OUTStride;
-          IsoTxSamples -= count;
-          TxSamples -= count;
+          else {
+            count = min(count, (uint32_t)IsoTxSamples);
+            IsoTxSamples -= (uint16_t)count;
+          }
+          mTxTrim += (int32_t)count;
         }
 
-        //whole TxBuff
-
-        while (TxSamples >= nrSamples && TxBuff != AsioBuff)
-        {
-          memcpy(ptr, asioOutPtr[TxBuff], OUTBuffSize);
-          NextASIO(TxBuff);
+        uint16_t TxSamples = (uint16_t)min((uint32_t)IsoTxSamples, (uint32_t)((end - ptr) / OUTStride));
 
-          ptr += OUTBuffSize;
-          IsoTxSamples -= nrSamples;
-          TxSamples -= nrSamples;
-        }
-        //Partial TxBuff
-        if (TxSamples > 0 && TxBuff != AsioBuff)
-        {
-          uint32_t count = min(nrSamples - TxBuffPos, TxSamples);
-          memcpy(ptr, asioOutPtr[TxBuff] + (TxBuffPos * OUTStride), count * OUTStride);
-          ptr += count * OUTStride;
-          TxBuffPos += count;
-          TxSamples -= count;
-          IsoTxSamples -= count;
-        }
+        //whatever the client completed, blocks or not
+        uint16_t count = (uint16_t)mOutRing.Read(ptr, TxSamples);
+        ptr += count * OUTStride;
+        IsoTxSamples -= count;
+        TxSamples -= count;
 
         // silence samples
         if (TxSamples && !ClientActive)
@@ -675,122 +895,198 @@ void CypressDevice::TxIsochCB()
 
         //ASSERT(IsoTxSamples == 0);
 
+        const uint32_t frames = (uint32_t)((ptr - TxReq.buff - s) / OUTStride);
         //zero the rest of the buffer
-        ZeroMemory(ptr, (TxReq.buff + txIsoSize) - ptr);
+        ZeroMemory(ptr, end - ptr);
+        mProfTx.End(frames, mIsoSize);
+        Trace::Span(Trace::evTxIso, trace, frames);
 
+        const uint64_t traceSubmit = Trace::Now();
         bknd_iso_write(&TxReq);
-        NextXfer(mTxReqIdx);
+        Trace::Span(Trace::evTxSubmit, traceSubmit, mIsoSize);
+        NextXfer(mTxReqIdx, mNrXfers);
 }
 
 //---------------------------------------------------------------------------------------------
 
 void CypressDevice::TimerCB()
 {
+  mDevStatus.Wakes = mWakes;
+  mDevStatus.Switches = mSwitches;
+  mDevStatus.SwitchLatAvg = mSwitches ? (uint32_t)(mSwitchLatSum / mSwitches) : 0;
+  mDevStatus.SwitchLatMax = mSwitchLatMax;
+  mDevStatus.SpinWakes = mSpinWakes;
+  const uint32_t faults = PinnedArena::PageFaults();
+  mDevStatus.PageFaults = faults - mLastPageFaults;
+  mLastPageFaults = faults;
+  mDevStatus.NonResident = mArena.NonResident();
+  mDevStatus.MidiOutDrops = midi.TakeOutDrops();
+  if (mDevStatus.MidiOutDrops != 0)
+    LOGN("CypressDevice %u midi messages dropped on full port queues\n", mDevStatus.MidiOutDrops);
+  mWakes = mSwitches = mSwitchLatMax = mSpinWakes = 0;
+  mSwitchLatSum = 0;
+
+  DriverLoad* load = devClient.LoadBlock();
+  const uint32_t sr = mDevStatus.LastSR;
+  const uint32_t periodUs = (sr != 0 && sr != (uint32_t)-1) ? (uint32_t)((uint64_t)mBlockFrames * 1000000 / sr) : 0;
+  if (load != nullptr)
+    mSwitchLoad.Publish(load->RoundTrip, periodUs);
+  else {
+    //no reader, the interval starts over all the same
+    LoadInfo dropped;
+    mSwitchLoad.Take(dropped);
+  }
 
-  LOGN(" %u Samples/sec\r", sSampleCounter);
+  if (mDevStatus.LastSR != 0 && mDevStatus.LastSR != (uint32_t)-1)
+    mTxTrim += mJitter.Update();
+  mDevStatus.FifoMargin = mJitter.Margin();
+  mDevStatus.FifoMinLevel = mJitter.MinLevel();
+  mDevStatus.PrerollTrim = mJitter.TotalTrim();
+  mDevStatus.Trims = mJitter.Trims();
+
+  //measured rate in mHz, 0 while unlocked
+  mDevStatus.SwSR = (uint32_t)(mClock.Rate() * 1000 + 0.5);
+  mDevStatus.DriftPpb = mClock.Drift(mDevStatus.LastSR);
+  mDevStatus.ProbeState = mProbe.State();
+  mDevStatus.ProbeRoundTrip = mProbe.RoundTrip();
+  uint32_t roundTrip;
+  if (mProbe.TakeResult(roundTrip))
+    devClient.LatencyMeasured(roundTrip);
+
+  //the fpga counters saturate, a step down is a restart of the fifos
+  auto Steps = [](uint32_t count, uint32_t& last) {
+    const uint32_t steps = count >= last ? count - last : count;
+    last = count;
+    return steps;
+  };
+  mDevStatus.OutSkips = Steps(mDevStatus.OutSkipCount, mLastOutSkip);
+  mDevStatus.InFulls = Steps(mDevStatus.InFullCount, mLastInFull);
+  mDevStatus.FifoMaxLevel = mFifoMax;
+  mDevStatus.RxFrames = sSampleCounter;
+  mDevStatus.RxPackets = mRxPackets;
+  mDevStatus.RxLost = mRxLost;
+  mFifoMax = mRxPackets = mRxLost = 0;
+  PublishTelemetry();
+
+  if (mTxTrim != 0)
+    LOGN("CypressDevice jitter trim %d, fifo min %u margin %u\n", mTxTrim, mDevStatus.FifoMinLevel, mDevStatus.FifoMargin);
+
+  LOGN(" %u Samples/sec %u wakes %u spun, %u switches %u/%u us, %u page faults %u pages out\r", sSampleCounter,
+    mDevStatus.Wakes, mDevStatus.SpinWakes, mDevStatus.Switches, mDevStatus.SwitchLatAvg, mDevStatus.SwitchLatMax,
+    mDevStatus.PageFaults, mDevStatus.NonResident);
   sSampleCounter = 0;
 }
 
 //---------------------------------------------------------------------------------------------
 
+void CypressDevice::PushRx(const uint8_t* ptr, uint16_t samples)
+{
+  IsoTxSamples += samples;
+  sSampleCounter += samples;
+  mRxFrames += samples;
+
+  //without a client the samples only pace the output
+  if (!ClientActive)
+    return;
+
+  const uint64_t trace = Trace::Now();
+  const uint32_t written = mInRing.Write(ptr, samples);
+  Trace::Span(Trace::evRxEnqueue, trace, written);
+  if (written < samples) {
+    LOG0("ASIO queue full!");
+    Trace::Mark(Trace::evQueueFull, samples - written);
+    SetClientActive(devClient.ClientPresent());
+  }
+}
+
+//---------------------------------------------------------------------------------------------
+
 void CypressDevice::RxIsochCB()
 {
         XferReq& RxReq = mRxRequests[mRxReqIdx];
-        for (uint32_t i = 0; i < rxpktCount; i++)
+        //the request just completed, as close to the arrival of its last frame as the thread gets
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        const uint64_t trace = Trace::Now();
+        uint32_t lost = 0;
+
+        for (uint32_t i = 0; i < mPktCount; i++)
         {
           IsoReqResult result = bknd_iso_get_result(&RxReq, i);
+          if (result.status != 0)
+            lost++;
           if (result.status == 0 && result.length > 0) //a filled block
           {
-            uint8_t* ptr = RxReq.buff + (i * rxpktSize);
-            uint16_t len = 0;
+            uint8_t* ptr = RxReq.buff + (i * mPktSize);
+            //per packet, leaving out the client switch NextBlock runs in direct mode
+            mProfRx.Begin();
+            const uint64_t rxFrames = mRxFrames;
             //-------------------------------------------------
-            if (ProcessHdr(ptr)) {
-              ptr += sizeof(RxHeader);
-              len = (uint16_t)(result.length - sizeof(RxHeader));
-              uint16_t samples = len / InStride;
-              IsoTxSamples += samples;
-
-              sSampleCounter += samples;
-
-              if ((len + RxProgress) <= INBuffSize) {
-                memcpy(asioInPtr[RxBuff] + RxProgress, ptr, len);
-                RxProgress += len;
-                len = 0;
-              }
-              else {
-                memcpy(asioInPtr[RxBuff] + RxProgress, ptr, INBuffSize - RxProgress);
-                len -= INBuffSize - RxProgress;
-                ptr += INBuffSize - RxProgress;
-                RxProgress = INBuffSize;
-              }
+            mProfHdr.Begin();
+            const uint64_t traceHdr = Trace::Now();
+            const bool hdr = ProcessHdr(ptr);
+            Trace::Span(Trace::evProcessHdr, traceHdr, mDevStatus.FifoLevel);
+            mProfHdr.End(0, sizeof(RxHeader));
+            if (hdr) {
+              mRxFramer.Packet(ptr + sizeof(RxHeader), result.length - (uint32_t)sizeof(RxHeader),
+                [this](const uint8_t* frames, uint32_t count) { PushRx(frames, (uint16_t)count); });
+              mProfRx.End((uint32_t)(mRxFrames - rxFrames), result.length);
+
+              NextBlock();
             }
             else
             {
               LOG0("ISOCH Rx buff malformed!");
-            }
-
-            if (RxProgress == INBuffSize) {//Packet complete, dispatch to client
-              uint8_t next = RxBuff;
-              NextASIO(next);
-              if (ClientActive) {
-
-                if (RxBuff == AsioBuff)
-                  UpdateClient();
-
-                if (next != TxBuff)
-                  RxBuff = next;
-                else
-                {
-                  ClientActive = devClient.ClientPresent();
-                  LOG0("ASIO queue full!");
-                }
-              }
-              else
-              {//just keep filling new ones 
-                AsioBuff = RxBuff;
-                TxBuff = RxBuff;
-                RxBuff = next;
-                TxBuffPos = 0;
-              }
-
-              RxProgress = len;
-              memcpy(asioInPtr[RxBuff], ptr, len);
-            }
-
-            if (RxProgress > INBuffSize) //missed something, start again
-            {
               mDevStatus.ResyncErrors++;
-              LOGN("Missed %u ISOCH packets\n", mDevStatus.ResyncErrors);
-              RxProgress = 0;
             }
           }
         }
+        mClock.Update(now.QuadPart, mRxFrames, mHwRate);
+        if (lost)
+          Trace::Mark(Trace::evRxError, lost);
+        mRxPackets += mPktCount - lost;
+        mRxLost += lost;
+        mDevStatus.Ep6IsoErr += lost;
+        PublishTelemetry();
+
         //fire again
         bknd_iso_read(&RxReq);
-        NextXfer(mRxReqIdx);
+        NextXfer(mRxReqIdx, mNrXfers);
+        Trace::Span(Trace::evRxIso, trace, mPktCount);
 }
 
 //---------------------------------------------------------------------------------------------
 
-void CypressDevice::AsioClientCB()
+void CypressDevice::PublishTelemetry()
 {
-        bool present = devClient.ClientPresent();
-        if (present) {
+  if (mTelemetry == nullptr)
+    return;
 
-          if (ClientActive)
-            NextASIO(AsioBuff);
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  mTelemetry->Version = scTelemetryVersion;
+  mTelemetry->Size = sizeof(UsbDeviceStatus);
+  SeqLock::WriteBegin(mTelemetry->Sequence);
+  mTelemetry->Time = now.QuadPart;
+  memcpy(&mTelemetry->Status, &mDevStatus, sizeof(mDevStatus));
+  SeqLock::WriteEnd(mTelemetry->Sequence);
+}
 
-          if (!ClientActive || AsioBuff != RxBuff)
-            UpdateClient();
-        }
-        else
-        {
-          AsioBuff = RxBuff;
-          TxBuff = RxBuff;
-          TxBuffPos = 0;
+//---------------------------------------------------------------------------------------------
+
+void CypressDevice::AsioClientCB()
+{
+        //the event may still be set for an answer taken while spinning
+        if (!mAsioWake.Take())
+          return;
+
+        if (mSwitchPending && devClient.SwitchComplete()) {
+          mSwitchPending = false;
+          SwitchDone();
         }
 
-        ClientActive = present;
+        SetClientActive(devClient.ClientPresent());
+        NextBlock();
 }
 
 //---------------------------------------------------------------------------------------------
@@ -816,6 +1112,17 @@ bool CypressDevice::GetStatus(UsbDeviceStatus & status)
 
 //---------------------------------------------------------------------------------------------
 
+bool CypressDevice::MeasureLatency()
+{
+  //taken up by the worker with the next client block
+  if (!IsRunning())
+    return false;
+  mProbe.Request();
+  return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
 uint32_t CypressDevice::GetSampleRate()
 {
   uint32_t lastSR = (uint32_t)(-1);
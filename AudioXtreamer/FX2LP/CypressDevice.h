@@ -3,6 +3,15 @@
 #include "UsbDev\UsbDev.h"
 #include "UsbBackend.h"
 #include "midi\midi.h"
+#include "LockFree\SpscRing.h"
+#include "LockFree\LoadHistogram.h"
+#include "LockFree\SeqLock.h"
+#include "LockFree\SpinWake.h"
+#include "JitterControl.h"
+#include "SampleClock.h"
+#include "LatencyProbe.h"
+#include "StageProfile.h"
+#include "PinnedArena\PinnedArena.h"
 
 
 class CypressDevice : public UsbDevice
@@ -21,7 +30,13 @@ public:
   bool GetStatus(UsbDeviceStatus &status) override;
   uint32_t GetSampleRate() override;
   bool ConfigureDevice() override { return false; }
+  bool MeasureLatency() override;
   
+protected:
+
+  //once a second from the worker thread, mDevStatus is up to date
+  virtual void TimerCB();
+  UsbDeviceStatus mDevStatus;
 
 private:
 
@@ -42,8 +57,14 @@ private:
   bool ProcessHdr(uint8_t* pHdr);
   void InitTxHeaders(uint8_t* ptr, uint32_t Samples);
   void UpdateClient();
+  void SwitchDone();
+  void PollSwitch();
+  void NextBlock();
+  void SetClientActive(bool active);
+  uint32_t ClientBlock();
+  void LayoutRings(uint32_t block);
+  void PushRx(const uint8_t* ptr, uint16_t samples);
 
-  uint32_t RxProgress;
   uint16_t InStride;
   uint16_t INBuffSize;
   void RxIsochCB();
@@ -52,14 +73,17 @@ private:
   uint16_t OUTStride;
   void TxIsochCB();
 
-  void TimerCB();
-
   void AsioClientCB();
 
+  void SetupXfers();
   XferReq *mRxRequests;
   XferReq *mTxRequests;
-  uint8_t** asioInPtr;
-  uint8_t** asioOutPtr;
+  uint8_t mNrXfers;
+  uint32_t mPktCount;
+  uint32_t mPktSize;
+  uint32_t mIsoSize;
+  //the requests' buffers, pinned for as long as the worker runs
+  PinnedArena mArena;
 
   uint8_t mTxReqIdx;
   uint8_t mRxReqIdx;
@@ -72,26 +96,86 @@ private:
   HANDLE mDevHandle;
   HANDLE mFileHandle;
   HANDLE hSem;
-  UsbDeviceStatus mDevStatus;
   MidiIO midi;
 
-  //the Sample where IsoIn data gets transfered
-  uint8_t RxBuff;
+  //IsoIn frames for the asio client, it takes them nrSamples at a time from the read side
+  SpscRing mInRing;
+
+  //the asio client writes nrSamples frames at a time, IsoOut takes what the pace allows
+  SpscRing mOutRing;
+
+  //the frames of the iso packets, one split between two of them put back together
+  RxFramer mRxFramer;
+
+  //the client has a block and hasn't given it back yet
+  bool mClientBusy;
+
+  //frames per client block, what the asio host asked for, re-blocked from the usb cadence
+  uint32_t mBlockFrames;
+  //frames the ring memory holds and how many blocks of them to use
+  uint32_t mRingFrames;
+  uint32_t mQueueDepth;
+
+  //output pre-roll trims decided by the jitter control, applied by TxIsochCB
+  JitterControl mJitter;
+  int32_t mTxTrim;
 
-  //The buffer we sent to the asio client
-  uint8_t AsioBuff;
+  //input frames since the start and their timing, the client gets the time each block was complete
+  SampleClock mClock;
+  uint64_t mRxFrames;
+  //the rate the fpga counts, in Hz, and a new snapped rate waiting to be confirmed
+  uint32_t mHwRate;
+  uint32_t mSRCandidate;
+  uint32_t mSRHold;
 
-  //The buffer where we have completed samples to IsoOut
-  uint8_t TxBuff;
+  //round trip of the client's blocks, output 1 to input 1, and the output block the client is writing
+  LatencyProbe mProbe;
+  uint8_t* mClientOut;
 
-  //The offset(in samples) of the partial buffer we managed to transmit
-  uint16_t TxBuffPos;
+  //start of the block the client has, for the trace
+  uint64_t mTraceClient;
 
   //throttles the output based on the input pace and if no audio is available, helps send as many silence samples
   uint16_t IsoTxSamples;
 
   bool ClientActive;
 
+  //the client has no switch event and is done with the buffer when Switch returns
+  bool mSyncClient;
+  bool mSwitchPending;
+  //the client's answers, spun on once per block before the worker goes to sleep
+  SpinWake mAsioWake;
+  bool mSpinSwitch;
+
+  //wake and switch latency counters, published in mDevStatus by TimerCB
+  LARGE_INTEGER mQpcFreq;
+  LARGE_INTEGER mSwitchStart;
+  uint32_t mWakes;
+  uint32_t mSwitches;
+  uint32_t mSpinWakes;
+  uint32_t mSwitchLatMax;
+  uint64_t mSwitchLatSum;
+  //the same round trips against the block period, published as the driver load
+  LoadHistogram mSwitchLoad;
+
+  //mDevStatus for every process through the shared memory, nullptr without it
+  void PublishTelemetry();
+  Telemetry* mTelemetry;
+  //per second figures being counted and the fpga counters they were last taken at
+  uint32_t mFifoMax;
+  uint32_t mRxPackets;
+  uint32_t mRxLost;
+  uint32_t mLastOutSkip;
+  uint32_t mLastInFull;
+  uint32_t mLastPageFaults;
+
+  //hot path costs, STAGE_PROFILE builds print them once a second off the stream threads
+  StageProfile mProfRx;
+  StageProfile mProfHdr;
+  StageProfile mProfMidiIn;
+  StageProfile mProfTx;
+  StageProfile mProfTxInit;
+  StageProfile mProfMidiOut;
 
 
 };
@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include "JitterControl.h"
+
+//lowest margin and the step it moves by, in frames
+static const uint32_t scMinMargin = 4;
+static const uint32_t scMarginStep = 8;
+//clean windows before the margin comes down a step
+static const uint32_t scRelaxWindows = 8;
+//excess over the margin tolerated before dropping frames, and the most dropped at once
+static const uint32_t scHysteresis = 8;
+static const uint32_t scMaxDrop = 16;
+//how close to its depth the out fifo may run before it counts as overflowing, an eighth of a small one
+static const uint32_t scFullGuard = 8;
+//the level is the fifo's 8 bit read count
+static const uint32_t scMaxLevel = 255;
+//the pre-roll the device always started with
+static const uint32_t scPrecharge = 44;
+
+JitterControl::JitterControl()
+{
+  Init(64);
+}
+
+void JitterControl::Init(uint32_t fifoDepth)
+{
+  mFifoDepth = fifoDepth;
+  mPrecharge = min(scPrecharge, fifoDepth * 3 / 4);
+  mMargin = scMarginStep;
+  mCleanWindows = 0;
+
+  mFirst = true;
+  mMinLevel = 0xFFFF;
+  mMaxLevel = 0;
+  mLastSkip = 0;
+  mSkips = 0;
+
+  mLastMin = 0;
+  mTotalTrim = 0;
+  mTrims = 0;
+}
+
+void JitterControl::Sample(uint16_t fifoLevel, uint16_t outSkipCount)
+{
+  if (mFirst) {//the counter runs since the fpga was configured
+    mFirst = false;
+    mLastSkip = outSkipCount;
+  }
+
+  mSkips += (uint16_t)(outSkipCount - mLastSkip);
+  mLastSkip = outSkipCount;
+
+  if (fifoLevel < mMinLevel)
+    mMinLevel = fifoLevel;
+  if (fifoLevel > mMaxLevel)
+    mMaxLevel = fifoLevel;
+}
+
+int32_t JitterControl::Update()
+{
+  int32_t trim = 0;
+
+  if (mMinLevel != 0xFFFF) {
+    const uint32_t minLevel = mMinLevel;
+    const uint32_t maxMargin = mFifoDepth / 2;
+    const uint32_t depth = min(mFifoDepth, scMaxLevel);
+    const uint32_t fullLevel = depth - min(scFullGuard, depth / 8);
+
+    if (mSkips > 0) {//ran dry, more margin and fill up to it right away
+      mMargin = min(mMargin + scMarginStep, maxMargin);
+      trim = (int32_t)scMarginStep;
+      mCleanWindows = 0;
+    }
+    else if (mMaxLevel >= fullLevel) {//about to overflow, the pre-roll is more than the fifo takes
+      trim = -(int32_t)scMarginStep;
+      mCleanWindows = 0;
+    }
+    else {
+      if (++mCleanWindows >= scRelaxWindows && mMargin > scMinMargin) {
+        mMargin--;
+        mCleanWindows = 0;
+      }
+
+      if (minLevel > mMargin + scHysteresis)//half the excess at a time, it converges without overshooting
+        trim = -(int32_t)min((minLevel - mMargin) / 2, scMaxDrop);
+      else if (minLevel < mMargin)
+        trim = (int32_t)(mMargin - minLevel);
+    }
+
+    mLastMin = minLevel;
+  }
+
+  if (trim != 0) {
+    mTotalTrim += trim;
+    mTrims++;
+  }
+
+  mMinLevel = 0xFFFF;
+  mMaxLevel = 0;
+  mSkips = 0;
+  return trim;
+}
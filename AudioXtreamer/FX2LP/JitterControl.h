@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+
+/*Closed loop control of the output pre-roll
+
+  The hardware out fifo is primed with some silence and from then on gets as many frames as come in,
+  its level is the output latency on top of the asio block. Every rx header tells the level and the
+  fifo's underrun counter (OutSkipCount). The fpga has no overrun counter for it, InFullCount counts
+  writes to the full input fifo and says nothing about the output, a level close to the depth does.
+  Once a second the lowest level seen is held against a safety margin:
+  - an underrun raises the margin and adds frames,
+  - a level close to the depth or well above the margin drops frames,
+  - a margin that stayed clean for a while is lowered a step.
+  The device applies the trims on the output stream, silence is added and queued frames are dropped.
+*/
+class JitterControl
+{
+public:
+  JitterControl();
+
+  //at the start of a stream, fifoDepth as configured in the fpga
+  void Init(uint32_t fifoDepth);
+
+  //frames of silence the output starts with
+  uint32_t Precharge() const { return mPrecharge; }
+
+  //per rx header
+  void Sample(uint16_t fifoLevel, uint16_t outSkipCount);
+
+  //once a second, the frames to add (>0) or to drop (<0) from the output
+  int32_t Update();
+
+  uint32_t Margin() const { return mMargin; }
+  uint32_t MinLevel() const { return mLastMin; }
+  int32_t TotalTrim() const { return mTotalTrim; }
+  uint32_t Trims() const { return mTrims; }
+
+private:
+  uint32_t mFifoDepth;
+  uint32_t mPrecharge;
+  uint32_t mMargin;
+  uint32_t mCleanWindows;
+
+  //this window
+  bool mFirst;
+  uint16_t mMinLevel;
+  uint16_t mMaxLevel;
+  uint16_t mLastSkip;
+  uint32_t mSkips;
+
+  //published
+  uint32_t mLastMin;
+  int32_t mTotalTrim;
+  uint32_t mTrims;
+};
@@ -0,0 +1,171 @@
+#include "stdafx.h"
+#include "LatencyProbe.h"
+#include <stdlib.h>
+
+//-6dB, loud enough through a cable whatever the levels, short enough not to hurt
+static const int32_t scImpulse = 0x400000;
+//the lowest level taken for an impulse, -30dB
+static const int32_t scMinLevel = 0x40000;
+//frames of silence before each impulse, the last one rings out and the noise is measured
+static const uint32_t scGap = 4096;
+//frames an impulse is waited for, more than a full queue of the biggest blocks
+static const uint32_t scTimeout = 65536;
+//frames after the first crossing the peak is looked for in
+static const uint32_t scPeakWindow = 64;
+
+static inline int32_t ReadSample(const uint8_t* p)
+{
+  return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+}
+
+LatencyProbe::LatencyProbe()
+  : mRequests(0)
+  , mSeen(0)
+  , mState(probeIdle)
+  , mPhase(phQuiet)
+  , mResultTaken(true)
+  , mRoundTrip(0)
+{
+}
+
+void LatencyProbe::Abort()
+{
+  if (mState == probeRunning) {
+    LOG0("LatencyProbe aborted, the client blocks changed");
+    mState = probeFailed;
+  }
+}
+
+void LatencyProbe::Start()
+{
+  mState = probeRunning;
+  mResultTaken = false;
+  mInPos = mOutPos = 0;
+  mImpulses = mFound = 0;
+  Next();
+}
+
+//silence before the next impulse, or the end. Two lost in a row from the start, there is no loop
+void LatencyProbe::Next()
+{
+  if (mImpulses == scImpulses || (mFound == 0 && mImpulses == 2)) {
+    Finish();
+    return;
+  }
+  mPhase = phQuiet;
+  mPhaseStart = mInPos;
+  mNoise = 0;
+}
+
+void LatencyProbe::Finish()
+{
+  if (mFound == 0) {
+    LOG0("LatencyProbe no impulse came back");
+    mState = probeFailed;
+    return;
+  }
+
+  //a handful, sorted in place
+  for (uint32_t i = 1; i < mFound; i++)
+    for (uint32_t j = i; j > 0 && mResults[j - 1] > mResults[j]; j--) {
+      const uint32_t t = mResults[j];
+      mResults[j] = mResults[j - 1];
+      mResults[j - 1] = t;
+    }
+  const uint32_t median = mResults[mFound / 2];
+  uint32_t agree = 0;
+  for (uint32_t i = 0; i < mFound; i++)
+    if (mResults[i] + 1 >= median && mResults[i] <= median + 1)
+      agree++;
+
+  LOGN("LatencyProbe %u of %u impulses back, round trip %u frames (%u to %u), %u agree\n",
+    mFound, scImpulses, median, mResults[0], mResults[mFound - 1], agree);
+
+  //the jitter control may trim during a probe, a few off is fine
+  if (agree * 4 >= scImpulses * 3) {
+    mRoundTrip = median;
+    mState = probeDone;
+  }
+  else
+    mState = probeFailed;
+}
+
+void LatencyProbe::Input(const uint8_t* ptr, uint32_t stride, uint32_t frames)
+{
+  if (mSeen != mRequests) {
+    mSeen = mRequests;
+    Start();
+  }
+  if (mState != probeRunning)
+    return;
+
+  for (uint32_t i = 0; i < frames && mState == probeRunning; i++, ptr += stride, mInPos++) {
+    const int32_t v = abs(ReadSample(ptr));
+
+    switch (mPhase) {
+    case phQuiet:
+      mNoise = max(mNoise, v);
+      if (mInPos - mPhaseStart >= scGap) {
+        mThreshold = max(scMinLevel, min(mNoise * 4, scImpulse / 2));
+        mPhase = phFire;
+      }
+      break;
+
+    case phFire: //waits for the output
+      break;
+
+    case phListen:
+      if (v > mThreshold) {
+        mPeakPos = mInPos;
+        mPeak = v;
+        mPhase = phPeak;
+      }
+      else if (mInPos - mFirePos > scTimeout) {
+        mImpulses++;
+        Next();
+      }
+      break;
+
+    case phPeak:
+      if (v > mPeak) {
+        mPeakPos = mInPos;
+        mPeak = v;
+      }
+      if (mInPos - mPeakPos >= scPeakWindow) {
+        mResults[mFound++] = (uint32_t)(mPeakPos - mFirePos);
+        mImpulses++;
+        Next();
+      }
+      break;
+    }
+  }
+}
+
+void LatencyProbe::Output(uint8_t* ptr, uint32_t stride, uint32_t frames)
+{
+  if (mState != probeRunning)
+    return;
+
+  for (uint32_t i = 0; i < frames; i++, ptr += stride)
+    ptr[0] = ptr[1] = ptr[2] = 0;
+
+  //the first frame of the block, the input position it will be compared against
+  if (mPhase == phFire) {
+    ptr -= frames * stride;
+    ptr[0] = (uint8_t)scImpulse;
+    ptr[1] = (uint8_t)(scImpulse >> 8);
+    ptr[2] = (uint8_t)(scImpulse >> 16);
+    mFirePos = mOutPos;
+    mPhase = phListen;
+  }
+  mOutPos += frames;
+}
+
+bool LatencyProbe::TakeResult(uint32_t& roundTrip)
+{
+  if (mState != probeDone || mResultTaken)
+    return false;
+  mResultTaken = true;
+  roundTrip = mRoundTrip;
+  return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include "UsbDev\UsbDev.h"
+
+/*Round trip latency as the asio host sees it, for a cable from output 1 to input 1
+
+  The probe works on the client's blocks: the input is scanned before the client gets it, output 1 is
+  overwritten once the client wrote its block. Block k of the input and block k of the output are at the
+  same sample position for the host, so the frame an impulse written at output position p shows up at
+  input position q makes a round trip of q - p, everything in between included: the ring, the iso
+  requests in flight, the pre-roll and fpga fifos, the converters.
+  Output 1 is silent while probing but for an impulse every few thousand frames, each is looked for
+  above the noise seen before it and taken at its peak, the converter filters smear it over a few frames.
+  The round trip is the median of the impulses found, if most of them agree on it to a frame.
+*/
+class LatencyProbe
+{
+public:
+  LatencyProbe();
+
+  //any thread, the probe starts with the next client block
+  void Request() { InterlockedIncrement(&mRequests); }
+  //the client blocks are laid out again, a probe running fails
+  void Abort();
+
+  //the worker, per client block: the input before the client gets it, the output once it wrote it.
+  //ptr is channel 1 of the first frame, 24 bit samples stride bytes apart
+  void Input(const uint8_t* ptr, uint32_t stride, uint32_t frames);
+  void Output(uint8_t* ptr, uint32_t stride, uint32_t frames);
+
+  ProbeState State() const { return mState; }
+  //frames, valid once done
+  uint32_t RoundTrip() const { return mRoundTrip; }
+  //true once for every probe done
+  bool TakeResult(uint32_t& roundTrip);
+
+private:
+  enum Phase { phQuiet, phFire, phListen, phPeak };
+  static const uint32_t scImpulses = 8;
+
+  void Start();
+  void Next();
+  void Finish();
+
+  volatile LONG mRequests;
+  LONG mSeen;
+
+  ProbeState mState;
+  Phase mPhase;
+  bool mResultTaken;
+  uint32_t mRoundTrip;
+
+  //sample positions of the client's blocks since the start
+  uint64_t mInPos;
+  uint64_t mOutPos;
+
+  uint64_t mPhaseStart;
+  uint64_t mFirePos;
+  int32_t mNoise;
+  int32_t mThreshold;
+  uint64_t mPeakPos;
+  int32_t mPeak;
+
+  uint32_t mImpulses;
+  uint32_t mFound;
+  uint32_t mResults[scImpulses];
+};
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "SampleClock.h"
+#include <math.h>
+
+//loop bandwidth in Hz, low enough to ride over the wake up jitter, high enough to follow the device clock drift
+static const double scBandwidth = 0.25;
+//the bandwidth a lock starts with, halved every second down to scBandwidth
+static const double scLockBandwidth = 2;
+//the fpga count is good to about a step of 10Hz, a rate off by more than that moved
+static const double scHwTolerance = 50;
+//completions further off than that restart the loop, the stream stalled or the rate moved
+static const double scMaxError = 0.005;
+
+SampleClock::SampleClock()
+{
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  mQpcFreq = (double)freq.QuadPart;
+  Reset();
+}
+
+void SampleClock::Reset()
+{
+  mLocked = false;
+  mBandwidth = scLockBandwidth;
+  mBandwidthFrames = 0;
+  mWinCount = mWinIdx = 0;
+  mT0 = 0;
+  mN0 = 0;
+  mPeriod = 0;
+}
+
+void SampleClock::Lock(int64_t qpc, uint64_t frames, uint32_t hwRate)
+{
+  mLocked = true;
+  mBandwidth = scLockBandwidth;
+  mBandwidthFrames = 0;
+  mWinCount = mWinIdx = 0;
+  mT0 = (double)qpc;
+  mN0 = frames;
+  mPeriod = mQpcFreq / hwRate;
+}
+
+void SampleClock::Update(int64_t qpc, uint64_t frames, uint32_t hwRate)
+{
+  if (hwRate == 0) {
+    Reset();
+    return;
+  }
+
+  //while settling the estimate is too noisy to hold against the count, big moves show up as timing errors
+  if (!mLocked || (!Settling() && fabs(Rate() - hwRate) > scHwTolerance)) {
+    Lock(qpc, frames, hwRate);
+    return;
+  }
+
+  if (frames <= mN0)
+    return;
+
+  const double dn = (double)(frames - mN0);
+  const double predicted = mT0 + dn * mPeriod;
+  const double e = (double)qpc - predicted;
+
+  if (fabs(e) > scMaxError * mQpcFreq) {
+    Lock(qpc, frames, hwRate);
+    return;
+  }
+
+  //fast lock, a second at each bandwidth
+  mBandwidthFrames += frames - mN0;
+  if (mBandwidth > scBandwidth && mBandwidthFrames >= hwRate) {
+    mBandwidth = max(mBandwidth / 2, scBandwidth);
+    mBandwidthFrames = 0;
+  }
+
+  //the gains follow the time between completions, XferPackets sets it
+  const double w = 2 * 3.14159265358979 * mBandwidth * dn * mPeriod / mQpcFreq;
+  mT0 = predicted + sqrt(2.0) * w * e;
+  mN0 = frames;
+  mPeriod += w * w * e / dn;
+
+  //the rate window starts once settled
+  if (!Settling() && (mWinCount == 0 || mN0 - mWinN[(mWinIdx + scRateWindow - 1) % scRateWindow] >= hwRate)) {
+    mWinT[mWinIdx] = mT0;
+    mWinN[mWinIdx] = mN0;
+    mWinIdx = (mWinIdx + 1) % scRateWindow;
+    if (mWinCount < scRateWindow)
+      mWinCount++;
+  }
+}
+
+uint64_t SampleClock::Time(uint64_t frame) const
+{
+  if (!mLocked)
+    return 0;
+
+  //frames handed out are always near the last completion, the distance fits a double well
+  const double t = mT0 + ((double)(int64_t)(frame - mN0)) * mPeriod;
+  return (uint64_t)(t / mQpcFreq * 1e9);
+}
+
+bool SampleClock::Settling() const
+{
+  return mLocked && mBandwidth > scBandwidth;
+}
+
+double SampleClock::Rate() const
+{
+  if (!mLocked)
+    return 0;
+
+  //the oldest snapshot, a second or more back
+  if (mWinCount > 1) {
+    const uint32_t oldest = mWinCount < scRateWindow ? 0 : mWinIdx;
+    if (mT0 > mWinT[oldest])
+      return (mN0 - mWinN[oldest]) * mQpcFreq / (mT0 - mWinT[oldest]);
+  }
+  return mQpcFreq / mPeriod;
+}
+
+int32_t SampleClock::Drift(uint32_t nominal) const
+{
+  if (!mLocked || nominal == 0 || nominal == (uint32_t)-1)
+    return 0;
+  return (int32_t)((Rate() / nominal - 1.0) * 1e9);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+
+/*Delay locked loop from the rx iso completions to the time of every input frame, and the true sample rate
+
+  Each rx request completes with the frames the device sampled since the last one, the completion
+  is seen by the worker thread a scheduling latency later. Feeding the QPC time of every completion
+  and the frame count so far, a second order loop tracks the time of a frame and the frame period:
+    e = t - (t0 + (n - n0) * period)
+    t0 += (n - n0) * period + b * e,   period += c * e / (n - n0)
+  with b = sqrt(2) * w, c = w * w and w = 2 * pi * bandwidth * time since the last completion.
+  The wake up jitter is filtered out and the period follows the real rate of the device clock.
+
+  The fpga counts the sample clock too, in 10Hz steps. That count seeds the period when the loop locks
+  and is the sanity check after: an estimate off by more than a few counts means the clock moved and
+  the loop locks again. A lock starts with a wide bandwidth, halved every second down to the narrow
+  one. The rate reported is taken over the last seconds of the filtered frame times rather than from the
+  instant period, which still carries some of the jitter, and is steady to about a ppm.
+  The rate is against the host clock (QPC), what resampling to or from other host devices wants.
+*/
+class SampleClock
+{
+public:
+  SampleClock();
+
+  //forget the lock, the next Update starts over
+  void Reset();
+
+  //per rx completion: its QPC time, the input frames up to it and the rate the fpga counts, 0 if none.
+  //Locks again on a rate change or when the completions are too far off
+  void Update(int64_t qpc, uint64_t frames, uint32_t hwRate);
+
+  //QPC time of an input frame in ns, 0 until locked
+  uint64_t Time(uint64_t frame) const;
+
+  bool Locked() const { return mLocked; }
+  //still narrowing the bandwidth after a lock
+  bool Settling() const;
+  //frames per second the loop measured, 0 until locked
+  double Rate() const;
+  //deviation from a nominal rate in parts per billion
+  int32_t Drift(uint32_t nominal) const;
+
+private:
+  void Lock(int64_t qpc, uint64_t frames, uint32_t hwRate);
+
+  double mQpcFreq;
+
+  bool mLocked;
+  //loop bandwidth in Hz and the frames it has been in use
+  double mBandwidth;
+  uint64_t mBandwidthFrames;
+  //QPC ticks of frame mN0 and ticks per frame
+  double mT0;
+  uint64_t mN0;
+  double mPeriod;
+
+  //mT0 and mN0 once a second, the span the rate is measured over
+  static const uint32_t scRateWindow = 8;
+  double mWinT[scRateWindow];
+  uint64_t mWinN[scRateWindow];
+  uint32_t mWinCount;
+  uint32_t mWinIdx;
+};
@@ -0,0 +1,144 @@
+#include "stdafx.h"
+#include "StageProfile.h"
+#include <stdio.h>
+#include <process.h>
+
+#ifdef STAGE_PROFILE
+//the profiles alive and the thread that reports them
+struct StageReporter
+{
+  static const DWORD scPeriod = 1000;
+
+  //sLock guards the thread, sListLock the list the thread walks
+  static SRWLOCK sLock;
+  static SRWLOCK sListLock;
+  static StageProfile* sFirst;
+  static uint32_t sRefs;
+  static HANDLE sThread;
+  static HANDLE sExit;
+
+  static unsigned __stdcall Thread(void*)
+  {
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    uint64_t tscStart = __rdtsc();
+
+    while (WaitForSingleObject(sExit, scPeriod) == WAIT_TIMEOUT)
+    {
+      QueryPerformanceCounter(&now);
+      const uint64_t tsc = __rdtsc();
+      const double ns = (double)(now.QuadPart - start.QuadPart) * 1e9 / freq.QuadPart;
+      const double tscPerNs = ns > 0 ? (double)(tsc - tscStart) / ns : 0.;
+      start = now;
+      tscStart = tsc;
+
+      AcquireSRWLockShared(&sListLock);
+      for (StageProfile* p = sFirst; p != nullptr; p = p->mNext)
+        p->Report(tscPerNs);
+      ReleaseSRWLockShared(&sListLock);
+    }
+    return 0;
+  }
+
+  static void Add(StageProfile* profile)
+  {
+    AcquireSRWLockExclusive(&sLock);
+    AcquireSRWLockExclusive(&sListLock);
+    profile->mNext = sFirst;
+    sFirst = profile;
+    ReleaseSRWLockExclusive(&sListLock);
+
+    if (sRefs++ == 0) {
+      sExit = CreateEvent(NULL, TRUE, FALSE, NULL);
+      sThread = (HANDLE)_beginthreadex(NULL, 0, Thread, nullptr, 0, nullptr);
+      if (sThread == NULL)
+        LOG0("StageProfile reporter thread not started");
+    }
+    ReleaseSRWLockExclusive(&sLock);
+  }
+
+  static void Remove(StageProfile* profile)
+  {
+    AcquireSRWLockExclusive(&sLock);
+    AcquireSRWLockExclusive(&sListLock);
+    for (StageProfile** p = &sFirst; *p != nullptr; p = &(*p)->mNext)
+      if (*p == profile) {
+        *p = profile->mNext;
+        break;
+      }
+    ReleaseSRWLockExclusive(&sListLock);
+
+    //the thread only takes sListLock, it can be joined under sLock
+    if (sRefs > 0 && --sRefs == 0) {
+      SetEvent(sExit);
+      if (sThread != NULL) {
+        WaitForSingleObject(sThread, INFINITE);
+        CloseHandle(sThread);
+        sThread = NULL;
+      }
+      CloseHandle(sExit);
+      sExit = NULL;
+    }
+    ReleaseSRWLockExclusive(&sLock);
+  }
+};
+
+SRWLOCK StageReporter::sLock = SRWLOCK_INIT;
+SRWLOCK StageReporter::sListLock = SRWLOCK_INIT;
+StageProfile* StageReporter::sFirst = nullptr;
+uint32_t StageReporter::sRefs = 0;
+HANDLE StageReporter::sThread = NULL;
+HANDLE StageReporter::sExit = NULL;
+#endif
+
+StageProfile::StageProfile(const char* name)
+  : mName(name)
+  , mNext(nullptr)
+  , mStart(0)
+  , mCycles(0)
+  , mCalls(0)
+  , mFrames(0)
+  , mBytes(0)
+  , mLastCycles(0)
+  , mLastCalls(0)
+  , mLastFrames(0)
+  , mLastBytes(0)
+{
+#ifdef STAGE_PROFILE
+  StageReporter::Add(this);
+#endif
+}
+
+StageProfile::~StageProfile()
+{
+#ifdef STAGE_PROFILE
+  StageReporter::Remove(this);
+#endif
+}
+
+void StageProfile::Report(double tscPerNs)
+{
+  const uint64_t cycles = mCycles.load(std::memory_order_relaxed);
+  const uint64_t calls = mCalls.load(std::memory_order_relaxed);
+  const uint64_t frames = mFrames.load(std::memory_order_relaxed);
+  const uint64_t bytes = mBytes.load(std::memory_order_relaxed);
+
+  //the counts are loaded one by one, a call may be in some of them only, off by one at most
+  const uint64_t dCycles = cycles - mLastCycles;
+  const uint64_t dCalls = calls - mLastCalls;
+  const uint64_t dFrames = frames - mLastFrames;
+  const uint64_t dBytes = bytes - mLastBytes;
+  mLastCycles = cycles;
+  mLastCalls = calls;
+  mLastFrames = frames;
+  mLastBytes = bytes;
+
+  if (dCalls > 0 && tscPerNs > 0) {
+    const double stageNs = dCycles / tscPerNs;
+    char line[160];
+    sprintf_s(line, "profile %-10s %7llu calls %9.1f ns/call %8.2f ns/frame %6.2f cycles/byte\n", mName, dCalls,
+      stageNs / dCalls, dFrames ? stageNs / dFrames : 0., dBytes ? (double)dCycles / dBytes : 0.);
+    OutputDebugStringA(line);
+  }
+}
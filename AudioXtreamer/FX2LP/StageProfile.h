@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include <intrin.h>
+#include <atomic>
+
+/*Cost of a real time stage, counted in place on the live stream
+
+  Begin/End go around the stage with the frames and bytes it moved, on the stage's own thread, which
+  only ever adds to the counts. A reporter thread, started with the first profile and stopped with
+  the last, prints every profile once a second to the debugger output, release builds included,
+  DebugView picks it up: calls, ns per call and per frame and TSC cycles per byte over the second.
+  The real time threads never format or print. The TSC rate is measured against QPC over each
+  interval, its cycles are reference cycles, the same at any core clock.
+  Compiled in with STAGE_PROFILE defined for the project, otherwise every call is empty.
+*/
+class StageProfile
+{
+public:
+  explicit StageProfile(const char* name);
+  ~StageProfile();
+
+#ifdef STAGE_PROFILE
+  void Begin() { mStart = __rdtsc(); }
+  void End(uint32_t frames, uint32_t bytes)
+  {
+    //one writer, the reporter only loads, no locked add needed
+    mCycles.store(mCycles.load(std::memory_order_relaxed) + __rdtsc() - mStart, std::memory_order_relaxed);
+    mCalls.store(mCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mFrames.store(mFrames.load(std::memory_order_relaxed) + frames, std::memory_order_relaxed);
+    mBytes.store(mBytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+  }
+#else
+  void Begin() {}
+  void End(uint32_t frames, uint32_t bytes) {}
+#endif
+
+private:
+  friend struct StageReporter;
+  //on the reporter thread, what was added since its last call
+  void Report(double tscPerNs);
+
+  const char* mName;
+  StageProfile* mNext;
+  uint64_t mStart;
+  //running totals
+  std::atomic<uint64_t> mCycles;
+  std::atomic<uint64_t> mCalls;
+  std::atomic<uint64_t> mFrames;
+  std::atomic<uint64_t> mBytes;
+  //the totals at the last report, the reporter's own
+  uint64_t mLastCycles;
+  uint64_t mLastCalls;
+  uint64_t mLastFrames;
+  uint64_t mLastBytes;
+};
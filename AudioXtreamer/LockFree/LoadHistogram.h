@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <atomic>
+#include "UsbDev\UsbDev.h"
+#include "SeqLock.h"
+
+/*Durations of a real time call against its deadline, the buffer period, in tenths of it
+
+  The real time thread adds, any other thread takes what the interval counted and starts a new one.
+  Every count is an atomic of its own, a take may put a call into the next interval, it never loses one.
+  The last bucket counts the calls that took longer than the period, one of exactly the period is in
+  time and in the one below. Publish writes under the LoadInfo's seqlock, readers use ReadLoad.
+*/
+class LoadHistogram
+{
+public:
+  LoadHistogram()
+    : mSum(0)
+    , mMax(0)
+  {
+    for (uint32_t i = 0; i < LoadBuckets; i++)
+      mCounts[i].store(0, std::memory_order_relaxed);
+  }
+
+  //the time the call took and the period, in the same unit. Nothing is counted without a period
+  void Add(uint64_t ticks, uint64_t period)
+  {
+    if (period == 0)
+      return;
+
+    const uint64_t pct = ticks * 100 / period;
+    const uint32_t load = pct < scMaxPct ? (uint32_t)pct : scMaxPct;
+    const uint32_t bucket = ticks > period ? LoadBuckets - 1 : min(load / 10, LoadBuckets - 2);
+    mCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(load, std::memory_order_relaxed);
+
+    uint32_t max = mMax.load(std::memory_order_relaxed);
+    while (load > max && !mMax.compare_exchange_weak(max, load, std::memory_order_relaxed))
+      ;
+  }
+
+  //the interval so far, the counts start over
+  void Take(LoadInfo& info)
+  {
+    uint32_t calls = 0;
+    for (uint32_t i = 0; i < LoadBuckets; i++) {
+      info.Buckets[i] = mCounts[i].exchange(0, std::memory_order_relaxed);
+      calls += info.Buckets[i];
+    }
+    const uint64_t sum = mSum.exchange(0, std::memory_order_relaxed);
+    info.Calls = calls;
+    info.Overruns = info.Buckets[LoadBuckets - 1];
+    info.AvgPct = calls ? (uint32_t)(sum / calls) : 0;
+    info.MaxPct = mMax.exchange(0, std::memory_order_relaxed);
+  }
+
+  //takes the interval into the shared memory
+  void Publish(LoadInfo& shared, uint32_t periodUs)
+  {
+    LoadInfo info;
+    Take(info);
+    info.PeriodUs = periodUs;
+    Write(shared, info);
+  }
+
+  //zeroes the shared half once its writer stops, the sequence goes on
+  static void Clear(LoadInfo& shared)
+  {
+    LoadInfo info;
+    memset(&info, 0, sizeof(info));
+    Write(shared, info);
+  }
+
+private:
+  static void Write(LoadInfo& shared, const LoadInfo& info)
+  {
+    SeqLock::WriteBegin(shared.Sequence);
+    memcpy((void*)&shared.PeriodUs, &info.PeriodUs, sizeof(info) - offsetof(LoadInfo, PeriodUs));
+    SeqLock::WriteEnd(shared.Sequence);
+  }
+
+  //ten periods, a call that long is a stall anyway
+  static const uint32_t scMaxPct = 1000;
+
+  std::atomic<uint32_t> mCounts[LoadBuckets];
+  std::atomic<uint64_t> mSum;
+  std::atomic<uint32_t> mMax;
+};
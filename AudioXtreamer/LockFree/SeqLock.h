@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/*One writer, any number of readers, in any process sharing the memory. No locks, no syscalls
+
+  The sequence is odd while the writer is in. A reader copies the data out and keeps the copy if the
+  sequence was even and the same before and after, otherwise it tries again. The writer never waits,
+  a reader only for as long as a write takes.
+*/
+namespace SeqLock
+{
+  inline void WriteBegin(volatile uint32_t& seq)
+  {
+    seq = seq + 1;
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  inline void WriteEnd(volatile uint32_t& seq)
+  {
+    std::atomic_thread_fence(std::memory_order_release);
+    seq = seq + 1;
+  }
+
+  //false if every try ran into a write
+  inline bool Read(const volatile uint32_t& seq, void* dst, const volatile void* src, size_t size, uint32_t tries = 64)
+  {
+    for (; tries > 0; tries--) {
+      const uint32_t before = seq;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (before & 1) {
+        YieldProcessor();
+        continue;
+      }
+      memcpy(dst, (const void*)src, size);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq == before)
+        return true;
+    }
+    return false;
+  }
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "WakeWord.h"
+
+/*Wake ups between two processes that spin on a counter in the shared memory before blocking on an event
+
+  The signalling side bumps the WakeWord's sequence and sets the event only if the waiting side said
+  it may block. The waiting side spins for a while first, an answer that comes within that costs no
+  kernel call on either side.
+  The spin adapts: a wake caught spinning makes room for twice what it took, one that wasn't caught
+  halves the spin, down to a floor. Every 64th spin goes the whole way, a client that got quicker
+  is found again.
+  Without a word it is the event alone.
+*/
+class SpinWake
+{
+public:
+  SpinWake()
+    : mWord(nullptr)
+    , mEvent(NULL)
+    , mLast(0)
+    , mSpins(0)
+    , mSpinTicks(0)
+    , mMinTicks(0)
+    , mMaxTicks(0)
+  {
+  }
+
+  //the waiting side, the wakes from now on count
+  void Init(WakeWord* word, HANDLE event, uint32_t maxSpinUs = scMaxSpinUs)
+  {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    mWord = word;
+    mEvent = event;
+    mLast = word != nullptr ? word->Seq : 0;
+    mSpins = 0;
+    mMaxTicks = freq.QuadPart * maxSpinUs / 1000000;
+    mMinTicks = mMaxTicks / 16;
+    mSpinTicks = mMaxTicks / 4;
+  }
+
+  //the signalling side, any number of them per word. False if the event couldn't be set
+  static bool Signal(WakeWord* word, HANDLE event)
+  {
+    if (word == nullptr)
+      return SetEvent(event) != FALSE;
+
+    //a full barrier, against Arm either it sees the new sequence or we see it waiting
+    InterlockedIncrement((volatile LONG*)&word->Seq);
+    if (word->Waiting)
+      return SetEvent(event) != FALSE;
+    return true;
+  }
+
+  //true if there was a wake since the last one taken. With the event alone every call is one
+  bool Take()
+  {
+    if (mWord == nullptr)
+      return true;
+
+    const uint32_t seq = mWord->Seq;
+    if (seq == mLast)
+      return false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    mLast = seq;
+    return true;
+  }
+
+  //true if a wake came in while spinning, it is left for Take
+  bool Spin()
+  {
+    if (mWord == nullptr || mMaxTicks == 0)
+      return false;
+
+    const int64_t budget = (++mSpins & 63) == 0 ? mMaxTicks : mSpinTicks;
+    LARGE_INTEGER start, now;
+    QueryPerformanceCounter(&start);
+    for (;;) {
+      for (uint32_t i = 0; i < 32; i++) {
+        if (mWord->Seq != mLast) {
+          QueryPerformanceCounter(&now);
+          mSpinTicks = min(mMaxTicks, max(mSpinTicks, 2 * (now.QuadPart - start.QuadPart)));
+          return true;
+        }
+        YieldProcessor();
+      }
+      QueryPerformanceCounter(&now);
+      if (now.QuadPart - start.QuadPart >= budget)
+        break;
+    }
+    mSpinTicks = max(mMinTicks, mSpinTicks / 2);
+    return false;
+  }
+
+  //before blocking on the event, false if a wake came in meanwhile and there is no need to.
+  //Disarm once awake again, whichever way
+  bool Arm()
+  {
+    if (mWord == nullptr)
+      return true;
+
+    mWord->Waiting = 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return mWord->Seq == mLast;
+  }
+
+  void Disarm()
+  {
+    if (mWord != nullptr)
+      mWord->Waiting = 0;
+  }
+
+  //spin, then block on the event, for a thread waiting on nothing else. WAIT_OBJECT_0 with the wake taken,
+  //otherwise what WaitForSingleObject returned
+  DWORD Wait(DWORD timeout)
+  {
+    if (Spin()) {
+      Take();
+      return WAIT_OBJECT_0;
+    }
+
+    for (;;) {
+      DWORD result = WAIT_OBJECT_0;
+      if (Arm())
+        result = WaitForSingleObject(mEvent, timeout);
+      Disarm();
+      if (result != WAIT_OBJECT_0)
+        return result;
+      //an event set for a wake that was taken without it, wait again
+      if (Take())
+        return WAIT_OBJECT_0;
+    }
+  }
+
+private:
+  //well below a buffer period, a wake that takes longer is better off in the kernel
+  static const uint32_t scMaxSpinUs = 50;
+
+  WakeWord* mWord;
+  HANDLE mEvent;
+  uint32_t mLast;
+  uint32_t mSpins;
+  int64_t mSpinTicks;
+  int64_t mMinTicks;
+  int64_t mMaxTicks;
+};
@@ -0,0 +1,142 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+/*Single producer, single consumer ring of fixed size frames on caller provided memory
+
+  The cursors count frames and run over [0, 2*capacity), that tells a full ring from an empty one
+  without wasting a slot and the capacity doesn't need to be a power of two.
+  The producer only moves the write cursor, the consumer only the read cursor, each side publishes
+  its own with release and looks at the other one with acquire. No locks, no interlocked ops.
+
+  A side that always moves whole blocks, starting from a reset ring with a capacity multiple of the
+  block size, never sees a block crossing the end of the memory. The asio client relies on that.
+*/
+class SpscRing
+{
+public:
+  SpscRing()
+    : mMem(nullptr)
+    , mStride(0)
+    , mCapacity(0)
+    , mWrite(0)
+    , mRead(0)
+  {}
+
+  //capacity in frames. Not thread safe, neither side may be running
+  void Init(uint8_t* mem, uint32_t stride, uint32_t capacity)
+  {
+    mMem = mem;
+    mStride = stride;
+    mCapacity = capacity;
+    Reset();
+  }
+
+  //empties the ring and puts both cursors at the start of the memory, same rules as Init
+  void Reset()
+  {
+    mWrite.store(0, std::memory_order_relaxed);
+    mRead.store(0, std::memory_order_release);
+  }
+
+  uint8_t* Data() const { return mMem; }
+  uint32_t Capacity() const { return mCapacity; }
+  uint32_t Stride() const { return mStride; }
+
+  //frames ready for the consumer, seen from the producer it can only grow
+  uint32_t Fill() const
+  {
+    return Distance(mWrite.load(std::memory_order_acquire), mRead.load(std::memory_order_acquire));
+  }
+
+  //frames the producer may write, seen from the consumer it can only grow
+  uint32_t Space() const { return mCapacity - Fill(); }
+
+  //---- producer side
+
+  //where the next frame goes, contiguous: frames that fit before the end of the memory or the read cursor
+  uint8_t* WritePtr(uint32_t & contiguous) const
+  {
+    const uint32_t idx = Index(mWrite.load(std::memory_order_relaxed));
+    contiguous = Min(Space(), mCapacity - idx);
+    return mMem + idx * mStride;
+  }
+
+  //publishes frames written through WritePtr
+  void Commit(uint32_t frames)
+  {
+    mWrite.store(Advance(mWrite.load(std::memory_order_relaxed), frames), std::memory_order_release);
+  }
+
+  //copies as many frames as there is space for, wrapping around as needed
+  uint32_t Write(const uint8_t* src, uint32_t frames)
+  {
+    const uint32_t pos = mWrite.load(std::memory_order_relaxed);
+    const uint32_t idx = Index(pos);
+    frames = Min(frames, Space());
+
+    const uint32_t first = Min(frames, mCapacity - idx);
+    memcpy(mMem + idx * mStride, src, first * mStride);
+    memcpy(mMem, src + first * mStride, (frames - first) * mStride);
+
+    mWrite.store(Advance(pos, frames), std::memory_order_release);
+    return frames;
+  }
+
+  //---- consumer side
+
+  //the oldest frame, contiguous: frames readable before the end of the memory or the write cursor
+  uint8_t* ReadPtr(uint32_t & contiguous) const
+  {
+    const uint32_t idx = Index(mRead.load(std::memory_order_relaxed));
+    contiguous = Min(Fill(), mCapacity - idx);
+    return mMem + idx * mStride;
+  }
+
+  //gives frames read through ReadPtr back to the producer
+  void Release(uint32_t frames)
+  {
+    mRead.store(Advance(mRead.load(std::memory_order_relaxed), frames), std::memory_order_release);
+  }
+
+  //copies out as many frames as are ready, up to frames
+  uint32_t Read(uint8_t* dst, uint32_t frames)
+  {
+    const uint32_t pos = mRead.load(std::memory_order_relaxed);
+    const uint32_t idx = Index(pos);
+    frames = Min(frames, Fill());
+
+    const uint32_t first = Min(frames, mCapacity - idx);
+    memcpy(dst, mMem + idx * mStride, first * mStride);
+    memcpy(dst + first * mStride, mMem, (frames - first) * mStride);
+
+    mRead.store(Advance(pos, frames), std::memory_order_release);
+    return frames;
+  }
+
+  //drops whatever is ready
+  void Flush()
+  {
+    mRead.store(mWrite.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+private:
+  static uint32_t Min(uint32_t a, uint32_t b) { return a < b ? a : b; }
+  uint32_t Distance(uint32_t w, uint32_t r) const { return w >= r ? w - r : w + 2 * mCapacity - r; }
+  uint32_t Index(uint32_t pos) const { return pos >= mCapacity ? pos - mCapacity : pos; }
+  uint32_t Advance(uint32_t pos, uint32_t frames) const
+  {
+    pos += frames;
+    return pos >= 2 * mCapacity ? pos - 2 * mCapacity : pos;
+  }
+
+  uint8_t* mMem;
+  uint32_t mStride;
+  uint32_t mCapacity;
+
+  //each cursor on its own cache line, the two sides don't invalidate each other on every move
+  std::atomic<uint32_t> mWrite;
+  uint8_t mPad[64 - sizeof(std::atomic<uint32_t>)];
+  std::atomic<uint32_t> mRead;
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <stdint.h>
+
+//the ipc handshake, one word per direction next to its event. The signalling side bumps Seq with
+//every wake, the event is only set while the other side said Waiting. See SpinWake.h
+typedef struct _WakeWord
+{
+  volatile uint32_t Seq;
+  volatile uint32_t Waiting;
+} WakeWord;
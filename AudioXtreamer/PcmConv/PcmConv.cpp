@@ -0,0 +1,725 @@
+#include "stdafx.h"
+#include "PcmConv.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PCMCONV_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PCMCONV_TARGET(isa)
+#else
+#include <cpuid.h>
+#define PCMCONV_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace PcmConv
+{
+
+//frames handled per pass, keeps the source tile of a full 32ch frame set inside L1
+static const uint32_t TileFrames = 32;
+
+//float full scale is 2^23 on the way out, the 32bit left aligned sample times 2^-31 on the way in
+static const float Scale24 = 8388608.0f;
+static const float InvScale32 = 1.0f / 2147483648.0f;
+
+#define FMT_SIZE(fmt) ((fmt) == fmtInt24 ? 3u : 4u)
+
+//---------------------------------------------------------------------------------------------
+//one sample at a time, the device side is always fmtInt24
+//the value passed around holds the sample in its low 3 bytes
+
+template<int Fmt>
+static inline uint32_t get1(const uint8_t* p)
+{
+  if (Fmt == fmtInt24)
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+
+  if (Fmt == fmtInt32) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v >> 8;
+  }
+
+  //same clamping order as the simd kernels so both give the same results, NaN included
+  float x;
+  memcpy(&x, p, sizeof(x));
+  x *= Scale24;
+  x = x < Scale24 - 1.0f ? x : Scale24 - 1.0f;
+  x = x > -Scale24 ? x : -Scale24;
+  return (uint32_t)lrintf(x);
+}
+
+template<int Fmt>
+static inline void put1(uint8_t* p, uint32_t v)
+{
+  if (Fmt == fmtInt24) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    return;
+  }
+
+  const int32_t s = (int32_t)(v << 8);
+  if (Fmt == fmtInt32)
+    memcpy(p, &s, sizeof(s));
+  else {
+    const float x = (float)s * InvScale32;
+    memcpy(p, &x, sizeof(x));
+  }
+}
+
+template<int Fmt>
+static void deinterleave_run_c(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, uint32_t nrChannels, uint32_t nrFrames)
+{
+  for (uint32_t f0 = 0; f0 < nrFrames; f0 += TileFrames)
+  {
+    const uint32_t frames = (nrFrames - f0) < TileFrames ? (nrFrames - f0) : TileFrames;
+    for (uint32_t c = 0; c < nrChannels; ++c)
+    {
+      const uint8_t* s = src + f0 * srcStride + c * 3;
+      uint8_t* d = dst[c] + f0 * FMT_SIZE(Fmt);
+      for (uint32_t f = 0; f < frames; ++f, s += srcStride, d += FMT_SIZE(Fmt))
+        put1<Fmt>(d, get1<fmtInt24>(s));
+    }
+  }
+}
+
+//dst points to the first sample of a frame, the header word is left untouched
+template<int Fmt>
+static void scatter_c(uint8_t* dst, uint32_t dstStride, const uint8_t* const* src, uint32_t srcFrame, uint32_t nrChannels, uint32_t nrFrames)
+{
+  for (uint32_t f = 0; f < nrFrames; ++f, dst += dstStride)
+  {
+    uint8_t* d = dst;
+    for (uint32_t c = 0; c < nrChannels; ++c, d += 3)
+      put1<fmtInt24>(d, get1<Fmt>(src[c] + (srcFrame + f) * FMT_SIZE(Fmt)));
+  }
+}
+
+static inline void put32(uint8_t* p, uint32_t val)
+{
+  memcpy(p, &val, sizeof(val));
+}
+
+//frames from f0 on, also used for the frame tails of the simd kernels
+template<int Fmt>
+static void interleave_from(uint32_t f0, uint8_t* dst, uint32_t dstStride, uint32_t header, const uint8_t* const* src, const Plan& plan, uint32_t nrFrames)
+{
+  if (f0 >= nrFrames)
+    return;
+
+  for (uint32_t f = f0; f < nrFrames; ++f)
+    put32(dst + f * dstStride, header);
+
+  uint8_t* d = dst + f0 * dstStride + sizeof(header);
+  for (uint32_t r = 0; r < plan.nrRuns; ++r)
+  {
+    const Run& run = plan.runs[r];
+    scatter_c<Fmt>(d + run.first * 3, dstStride, src + run.first, f0, run.count, nrFrames - f0);
+  }
+}
+
+template<int Fmt>
+static void deinterleave_c(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, const Plan& plan, uint32_t nrFrames)
+{
+  for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    deinterleave_run_c<Fmt>(src + plan.runs[r].first * 3, srcStride, dst + plan.runs[r].first, plan.runs[r].count, nrFrames);
+}
+
+template<int Fmt>
+static void interleave_c(uint8_t* dst, uint32_t dstStride, uint32_t header, const uint8_t* const* src, const Plan& plan, uint32_t nrFrames)
+{
+  interleave_from<Fmt>(0, dst, dstStride, header, src, plan, nrFrames);
+}
+
+//nrChannels adjacent samples of one frame
+static inline void mix_samples_c(uint8_t* d, const uint8_t* s, uint32_t nrChannels)
+{
+  for (uint32_t c = 0; c < nrChannels; ++c, d += 3, s += 3)
+  {
+    const int32_t sum = ((int32_t)(get1<fmtInt24>(d) << 8) >> 8) + ((int32_t)(get1<fmtInt24>(s) << 8) >> 8);
+    put1<fmtInt24>(d, (uint32_t)(sum > 8388607 ? 8388607 : sum < -8388608 ? -8388608 : sum));
+  }
+}
+
+static void mix_c(uint8_t* dst, uint32_t dstStride, const uint8_t* src, uint32_t srcStride, const Plan& plan, uint32_t nrFrames)
+{
+  for (uint32_t f = 0; f < nrFrames; ++f, dst += dstStride, src += srcStride)
+    for (uint32_t r = 0; r < plan.nrRuns; ++r)
+      mix_samples_c(dst + plan.runs[r].first * 3, src + plan.runs[r].first * 3, plan.runs[r].count);
+}
+
+#ifdef PCMCONV_X86
+
+//exact 12 byte accesses, the buffers are not padded so we must not touch a byte more
+static inline __m128i load12(const uint8_t* p)
+{
+  int32_t hi;
+  memcpy(&hi, p + 8, sizeof(hi));
+  return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)p), _mm_cvtsi32_si128(hi));
+}
+
+static inline void store12(uint8_t* p, __m128i v)
+{
+  _mm_storel_epi64((__m128i*)p, v);
+  int32_t hi = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+  memcpy(p + 8, &hi, sizeof(hi));
+}
+
+//4 packed samples <-> 4 x 32bit lanes with the sample in the low 3 bytes
+#define EXPAND24  -1, 11, 10, 9, -1, 8, 7, 6, -1, 5, 4, 3, -1, 2, 1, 0
+#define COMPACT24 -1, -1, -1, -1, 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0
+
+//4 packed samples <-> 4 x 32bit lanes with the sample in the high 3 bytes, the sign in place for the sums
+#define EXPAND24HI 11, 10, 9, -1, 8, 7, 6, -1, 5, 4, 3, -1, 2, 1, 0, -1
+#define COMPACT24HI -1, -1, -1, -1, 15, 14, 13, 11, 10, 9, 7, 6, 5, 3, 2, 1
+
+//transposes 4 rows of 4 x 32bit lanes
+#define TRANSPOSE4(r0, r1, r2, r3, t0, t1, t2, t3) \
+  t0 = _mm_unpacklo_epi32(r0, r1); \
+  t1 = _mm_unpacklo_epi32(r2, r3); \
+  t2 = _mm_unpackhi_epi32(r0, r1); \
+  t3 = _mm_unpackhi_epi32(r2, r3); \
+  r0 = _mm_unpacklo_epi64(t0, t1); \
+  r1 = _mm_unpackhi_epi64(t0, t1); \
+  r2 = _mm_unpacklo_epi64(t2, t3); \
+  r3 = _mm_unpackhi_epi64(t2, t3);
+
+//4 samples <-> 32bit lanes with the sample in the low 3 bytes, the format conversion happens here
+template<int Fmt>
+PCMCONV_TARGET("ssse3")
+static inline __m128i get4(const uint8_t* p)
+{
+  if (Fmt == fmtInt24)
+    return _mm_shuffle_epi8(load12(p), _mm_set_epi8(EXPAND24));
+
+  if (Fmt == fmtInt32)
+    return _mm_srli_epi32(_mm_loadu_si128((const __m128i*)p), 8);
+
+  __m128 x = _mm_mul_ps(_mm_loadu_ps((const float*)p), _mm_set1_ps(Scale24));
+  x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(Scale24 - 1.0f)), _mm_set1_ps(-Scale24));
+  return _mm_cvtps_epi32(x);
+}
+
+template<int Fmt>
+PCMCONV_TARGET("ssse3")
+static inline void put4(uint8_t* p, __m128i v)
+{
+  if (Fmt == fmtInt24) {
+    store12(p, _mm_shuffle_epi8(v, _mm_set_epi8(COMPACT24)));
+    return;
+  }
+
+  v = _mm_slli_epi32(v, 8);
+  if (Fmt == fmtInt32)
+    _mm_storeu_si128((__m128i*)p, v);
+  else
+    _mm_storeu_ps((float*)p, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(InvScale32)));
+}
+
+//4 frames x 4 channels per step, tails are left to the scalar kernel
+template<int Fmt>
+PCMCONV_TARGET("ssse3")
+static void deinterleave_run_ssse3(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, uint32_t nrChannels, uint32_t nrFrames)
+{
+  const uint32_t chBlk = nrChannels & ~3u;
+  const uint32_t frBlk = nrFrames & ~3u;
+
+  for (uint32_t f0 = 0; f0 < frBlk; f0 += TileFrames)
+  {
+    const uint32_t fEnd = (frBlk - f0) < TileFrames ? frBlk : f0 + TileFrames;
+    for (uint32_t c = 0; c < chBlk; c += 4)
+    {
+      uint8_t* d0 = dst[c], *d1 = dst[c + 1], *d2 = dst[c + 2], *d3 = dst[c + 3];
+      const uint8_t* s = src + f0 * srcStride + c * 3;
+      for (uint32_t f = f0; f < fEnd; f += 4, s += 4 * srcStride)
+      {
+        __m128i r0 = get4<fmtInt24>(s);
+        __m128i r1 = get4<fmtInt24>(s + srcStride);
+        __m128i r2 = get4<fmtInt24>(s + 2 * srcStride);
+        __m128i r3 = get4<fmtInt24>(s + 3 * srcStride);
+        __m128i t0, t1, t2, t3;
+        TRANSPOSE4(r0, r1, r2, r3, t0, t1, t2, t3);
+        put4<Fmt>(d0 + f * FMT_SIZE(Fmt), r0);
+        put4<Fmt>(d1 + f * FMT_SIZE(Fmt), r1);
+        put4<Fmt>(d2 + f * FMT_SIZE(Fmt), r2);
+        put4<Fmt>(d3 + f * FMT_SIZE(Fmt), r3);
+      }
+    }
+  }
+
+  if (chBlk < nrChannels)
+    deinterleave_run_c<Fmt>(src + chBlk * 3, srcStride, dst + chBlk, nrChannels - chBlk, frBlk);
+
+  if (frBlk < nrFrames) {
+    uint8_t* tail[MaxPlanChannels];
+    for (uint32_t c = 0; c < nrChannels; ++c)
+      tail[c] = dst[c] + frBlk * FMT_SIZE(Fmt);
+    deinterleave_run_c<Fmt>(src + frBlk * srcStride, srcStride, tail, nrChannels, nrFrames - frBlk);
+  }
+}
+
+//the frame is written whole, 4 frames x 4 channels per step: transposed back and stored 12 bytes per frame
+template<int Fmt>
+PCMCONV_TARGET("ssse3")
+static void interleave_ssse3(uint8_t* dst, uint32_t dstStride, uint32_t header, const uint8_t* const* src, const Plan& plan, uint32_t nrFrames)
+{
+  const uint32_t frBlk = nrFrames & ~3u;
+
+  for (uint32_t f = 0; f < frBlk; f += 4)
+  {
+    uint8_t* frame = dst + f * dstStride;
+    put32(frame, header);
+    put32(frame + dstStride, header);
+    put32(frame + 2 * dstStride, header);
+    put32(frame + 3 * dstStride, header);
+    frame += sizeof(header);
+
+    for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    {
+      const uint8_t* const* s = src + plan.runs[r].first;
+      const uint32_t nrChannels = plan.runs[r].count;
+      const uint32_t chBlk = nrChannels & ~3u;
+      uint8_t* d = frame + plan.runs[r].first * 3;
+
+      for (uint32_t c = 0; c < chBlk; c += 4, d += 12)
+      {
+        __m128i r0 = get4<Fmt>(s[c] + f * FMT_SIZE(Fmt));
+        __m128i r1 = get4<Fmt>(s[c + 1] + f * FMT_SIZE(Fmt));
+        __m128i r2 = get4<Fmt>(s[c + 2] + f * FMT_SIZE(Fmt));
+        __m128i r3 = get4<Fmt>(s[c + 3] + f * FMT_SIZE(Fmt));
+        __m128i t0, t1, t2, t3;
+        TRANSPOSE4(r0, r1, r2, r3, t0, t1, t2, t3);
+        put4<fmtInt24>(d, r0);
+        put4<fmtInt24>(d + dstStride, r1);
+        put4<fmtInt24>(d + 2 * dstStride, r2);
+        put4<fmtInt24>(d + 3 * dstStride, r3);
+      }
+
+      if (chBlk < nrChannels)
+        scatter_c<Fmt>(d, dstStride, s + chBlk, f, nrChannels - chBlk, 4);
+    }
+  }
+
+  interleave_from<Fmt>(frBlk, dst, dstStride, header, src, plan, nrFrames);
+}
+
+//saturating 32bit adds, with the samples in the high bytes that is the 24bit full scale
+PCMCONV_TARGET("ssse3")
+static inline __m128i adds_epi32(__m128i a, __m128i b)
+{
+  const __m128i sum = _mm_add_epi32(a, b);
+  //overflow: both of the same sign and the sum of the other one
+  const __m128i over = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(a, b), _mm_xor_si128(a, sum)), 31);
+  const __m128i sat = _mm_xor_si128(_mm_srai_epi32(a, 31), _mm_set1_epi32(0x7FFFFFFF));
+  return _mm_or_si128(_mm_and_si128(over, sat), _mm_andnot_si128(over, sum));
+}
+
+//4 channels per step, frame by frame, the frames of a block are too far apart to be worth a transpose
+PCMCONV_TARGET("ssse3")
+static void mix_ssse3(uint8_t* dst, uint32_t dstStride, const uint8_t* src, uint32_t srcStride, const Plan& plan, uint32_t nrFrames)
+{
+  const __m128i expand = _mm_set_epi8(EXPAND24HI);
+  const __m128i compact = _mm_set_epi8(COMPACT24HI);
+
+  for (uint32_t f = 0; f < nrFrames; ++f, dst += dstStride, src += srcStride)
+  {
+    for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    {
+      uint8_t* d = dst + plan.runs[r].first * 3;
+      const uint8_t* s = src + plan.runs[r].first * 3;
+      const uint32_t nrChannels = plan.runs[r].count;
+      uint32_t c = 0;
+      for (; c + 4 <= nrChannels; c += 4, d += 12, s += 12)
+      {
+        const __m128i a = _mm_shuffle_epi8(load12(d), expand);
+        const __m128i b = _mm_shuffle_epi8(load12(s), expand);
+        store12(d, _mm_shuffle_epi8(adds_epi32(a, b), compact));
+      }
+      mix_samples_c(d, s, nrChannels - c);
+    }
+  }
+}
+
+PCMCONV_TARGET("avx2")
+static inline __m256i load12x2(const uint8_t* lo, const uint8_t* hi)
+{
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(load12(lo)), load12(hi), 1);
+}
+
+//get4/put4 for two channels (or two groups of 4 device channels), one per 128bit lane
+template<int Fmt>
+PCMCONV_TARGET("avx2")
+static inline __m256i get4x2(const uint8_t* lo, const uint8_t* hi)
+{
+  if (Fmt == fmtInt24)
+    return _mm256_shuffle_epi8(load12x2(lo, hi), _mm256_broadcastsi128_si256(_mm_set_epi8(EXPAND24)));
+
+  const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lo)), _mm_loadu_si128((const __m128i*)hi), 1);
+  if (Fmt == fmtInt32)
+    return _mm256_srli_epi32(v, 8);
+
+  __m256 x = _mm256_mul_ps(_mm256_castsi256_ps(v), _mm256_set1_ps(Scale24));
+  x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(Scale24 - 1.0f)), _mm256_set1_ps(-Scale24));
+  return _mm256_cvtps_epi32(x);
+}
+
+template<int Fmt>
+PCMCONV_TARGET("avx2")
+static inline void put4x2(uint8_t* lo, uint8_t* hi, __m256i v)
+{
+  if (Fmt == fmtInt24) {
+    v = _mm256_shuffle_epi8(v, _mm256_broadcastsi128_si256(_mm_set_epi8(COMPACT24)));
+    store12(lo, _mm256_castsi256_si128(v));
+    store12(hi, _mm256_extracti128_si256(v, 1));
+    return;
+  }
+
+  v = _mm256_slli_epi32(v, 8);
+  if (Fmt == fmtFloat32)
+    v = _mm256_castps_si256(_mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(InvScale32)));
+  _mm_storeu_si128((__m128i*)lo, _mm256_castsi256_si128(v));
+  _mm_storeu_si128((__m128i*)hi, _mm256_extracti128_si256(v, 1));
+}
+
+//same as the ssse3 kernel but 4 frames x 8 channels per step, one 4x4 block per 128bit lane
+template<int Fmt>
+PCMCONV_TARGET("avx2")
+static void deinterleave_run_avx2(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, uint32_t nrChannels, uint32_t nrFrames)
+{
+  const uint32_t chBlk = nrChannels & ~7u;
+  const uint32_t frBlk = nrFrames & ~3u;
+
+  for (uint32_t f0 = 0; f0 < frBlk; f0 += TileFrames)
+  {
+    const uint32_t fEnd = (frBlk - f0) < TileFrames ? frBlk : f0 + TileFrames;
+    for (uint32_t c = 0; c < chBlk; c += 8)
+    {
+      const uint8_t* s = src + f0 * srcStride + c * 3;
+      for (uint32_t f = f0; f < fEnd; f += 4, s += 4 * srcStride)
+      {
+        __m256i r0 = get4x2<fmtInt24>(s, s + 12);
+        __m256i r1 = get4x2<fmtInt24>(s + srcStride, s + srcStride + 12);
+        __m256i r2 = get4x2<fmtInt24>(s + 2 * srcStride, s + 2 * srcStride + 12);
+        __m256i r3 = get4x2<fmtInt24>(s + 3 * srcStride, s + 3 * srcStride + 12);
+
+        __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+        __m256i t1 = _mm256_unpacklo_epi32(r2, r3);
+        __m256i t2 = _mm256_unpackhi_epi32(r0, r1);
+        __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+
+        const uint32_t o = f * FMT_SIZE(Fmt);
+        put4x2<Fmt>(dst[c] + o, dst[c + 4] + o, _mm256_unpacklo_epi64(t0, t1));
+        put4x2<Fmt>(dst[c + 1] + o, dst[c + 5] + o, _mm256_unpackhi_epi64(t0, t1));
+        put4x2<Fmt>(dst[c + 2] + o, dst[c + 6] + o, _mm256_unpacklo_epi64(t2, t3));
+        put4x2<Fmt>(dst[c + 3] + o, dst[c + 7] + o, _mm256_unpackhi_epi64(t2, t3));
+      }
+    }
+  }
+
+  //whatever is left in channels or frames goes through the narrower kernel. Those are legacy sse
+  //code, with the upper halves still dirty every instruction of theirs pays for the transition
+  _mm256_zeroupper();
+  if (chBlk < nrChannels)
+    deinterleave_run_ssse3<Fmt>(src + chBlk * 3, srcStride, dst + chBlk, nrChannels - chBlk, frBlk);
+
+  if (frBlk < nrFrames) {
+    uint8_t* tail[MaxPlanChannels];
+    for (uint32_t c = 0; c < nrChannels; ++c)
+      tail[c] = dst[c] + frBlk * FMT_SIZE(Fmt);
+    deinterleave_run_c<Fmt>(src + frBlk * srcStride, srcStride, tail, nrChannels, nrFrames - frBlk);
+  }
+}
+
+//4 frames x 8 channels per step, the two compacted lanes are joined so each frame gets one 24 byte store
+template<int Fmt>
+PCMCONV_TARGET("avx2")
+static void interleave_avx2(uint8_t* dst, uint32_t dstStride, uint32_t header, const uint8_t* const* src, const Plan& plan, uint32_t nrFrames)
+{
+  const __m256i compact = _mm256_broadcastsi128_si256(_mm_set_epi8(COMPACT24));
+  const __m256i join = _mm256_set_epi32(7, 7, 6, 5, 4, 2, 1, 0);
+  const uint32_t frBlk = nrFrames & ~3u;
+
+  for (uint32_t f = 0; f < frBlk; f += 4)
+  {
+    uint8_t* frame = dst + f * dstStride;
+    put32(frame, header);
+    put32(frame + dstStride, header);
+    put32(frame + 2 * dstStride, header);
+    put32(frame + 3 * dstStride, header);
+    frame += sizeof(header);
+
+    const uint32_t o = f * FMT_SIZE(Fmt);
+    for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    {
+      const uint8_t* const* s = src + plan.runs[r].first;
+      const uint32_t nrChannels = plan.runs[r].count;
+      const uint32_t chBlk = nrChannels & ~7u;
+      uint8_t* d = frame + plan.runs[r].first * 3;
+      uint32_t c = 0;
+
+      for (; c < chBlk; c += 8, d += 24)
+      {
+        __m256i r0 = get4x2<Fmt>(s[c] + o, s[c + 4] + o);
+        __m256i r1 = get4x2<Fmt>(s[c + 1] + o, s[c + 5] + o);
+        __m256i r2 = get4x2<Fmt>(s[c + 2] + o, s[c + 6] + o);
+        __m256i r3 = get4x2<Fmt>(s[c + 3] + o, s[c + 7] + o);
+
+        __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+        __m256i t1 = _mm256_unpacklo_epi32(r2, r3);
+        __m256i t2 = _mm256_unpackhi_epi32(r0, r1);
+        __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+        r0 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_unpacklo_epi64(t0, t1), compact), join);
+        r1 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_unpackhi_epi64(t0, t1), compact), join);
+        r2 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_unpacklo_epi64(t2, t3), compact), join);
+        r3 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_unpackhi_epi64(t2, t3), compact), join);
+
+        _mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(r0));
+        _mm_storel_epi64((__m128i*)(d + 16), _mm256_extracti128_si256(r0, 1));
+        _mm_storeu_si128((__m128i*)(d + dstStride), _mm256_castsi256_si128(r1));
+        _mm_storel_epi64((__m128i*)(d + dstStride + 16), _mm256_extracti128_si256(r1, 1));
+        _mm_storeu_si128((__m128i*)(d + 2 * dstStride), _mm256_castsi256_si128(r2));
+        _mm_storel_epi64((__m128i*)(d + 2 * dstStride + 16), _mm256_extracti128_si256(r2, 1));
+        _mm_storeu_si128((__m128i*)(d + 3 * dstStride), _mm256_castsi256_si128(r3));
+        _mm_storel_epi64((__m128i*)(d + 3 * dstStride + 16), _mm256_extracti128_si256(r3, 1));
+      }
+
+      //short runs are common with sparse plans, give them the 4 channel block before going scalar
+      if (c + 4 <= nrChannels)
+      {
+        __m128i r0 = get4<Fmt>(s[c] + o);
+        __m128i r1 = get4<Fmt>(s[c + 1] + o);
+        __m128i r2 = get4<Fmt>(s[c + 2] + o);
+        __m128i r3 = get4<Fmt>(s[c + 3] + o);
+        __m128i t0, t1, t2, t3;
+        TRANSPOSE4(r0, r1, r2, r3, t0, t1, t2, t3);
+        put4<fmtInt24>(d, r0);
+        put4<fmtInt24>(d + dstStride, r1);
+        put4<fmtInt24>(d + 2 * dstStride, r2);
+        put4<fmtInt24>(d + 3 * dstStride, r3);
+        c += 4;
+        d += 12;
+      }
+
+      if (c < nrChannels)
+        scatter_c<Fmt>(d, dstStride, s + c, f, nrChannels - c, 4);
+    }
+  }
+
+  interleave_from<Fmt>(frBlk, dst, dstStride, header, src, plan, nrFrames);
+}
+
+PCMCONV_TARGET("avx2")
+static inline __m256i adds_epi32x2(__m256i a, __m256i b)
+{
+  const __m256i sum = _mm256_add_epi32(a, b);
+  const __m256i over = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, sum)), 31);
+  const __m256i sat = _mm256_xor_si256(_mm256_srai_epi32(a, 31), _mm256_set1_epi32(0x7FFFFFFF));
+  return _mm256_blendv_epi8(sum, sat, over);
+}
+
+//8 channels per step, the rest of a run goes through the 4 channel step
+PCMCONV_TARGET("avx2")
+static void mix_avx2(uint8_t* dst, uint32_t dstStride, const uint8_t* src, uint32_t srcStride, const Plan& plan, uint32_t nrFrames)
+{
+  const __m256i expand = _mm256_broadcastsi128_si256(_mm_set_epi8(EXPAND24HI));
+  const __m256i compact = _mm256_broadcastsi128_si256(_mm_set_epi8(COMPACT24HI));
+
+  for (uint32_t f = 0; f < nrFrames; ++f, dst += dstStride, src += srcStride)
+  {
+    for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    {
+      uint8_t* d = dst + plan.runs[r].first * 3;
+      const uint8_t* s = src + plan.runs[r].first * 3;
+      const uint32_t nrChannels = plan.runs[r].count;
+      uint32_t c = 0;
+      for (; c + 8 <= nrChannels; c += 8, d += 24, s += 24)
+      {
+        const __m256i a = _mm256_shuffle_epi8(load12x2(d, d + 12), expand);
+        const __m256i b = _mm256_shuffle_epi8(load12x2(s, s + 12), expand);
+        const __m256i v = _mm256_shuffle_epi8(adds_epi32x2(a, b), compact);
+        store12(d, _mm256_castsi256_si128(v));
+        store12(d + 12, _mm256_extracti128_si256(v, 1));
+      }
+      if (c + 4 <= nrChannels)
+      {
+        const __m128i a = _mm_shuffle_epi8(load12(d), _mm256_castsi256_si128(expand));
+        const __m128i b = _mm_shuffle_epi8(load12(s), _mm256_castsi256_si128(expand));
+        store12(d, _mm_shuffle_epi8(adds_epi32(a, b), _mm256_castsi256_si128(compact)));
+        c += 4;
+        d += 12;
+        s += 12;
+      }
+      mix_samples_c(d, s, nrChannels - c);
+    }
+  }
+}
+
+//the plan wrappers, every run of active channels is converted as one contiguous block
+template<int Fmt>
+PCMCONV_TARGET("ssse3")
+static void deinterleave_ssse3(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, const Plan& plan, uint32_t nrFrames)
+{
+  for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    deinterleave_run_ssse3<Fmt>(src + plan.runs[r].first * 3, srcStride, dst + plan.runs[r].first, plan.runs[r].count, nrFrames);
+}
+
+template<int Fmt>
+PCMCONV_TARGET("avx2")
+static void deinterleave_avx2(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, const Plan& plan, uint32_t nrFrames)
+{
+  for (uint32_t r = 0; r < plan.nrRuns; ++r)
+    deinterleave_run_avx2<Fmt>(src + plan.runs[r].first * 3, srcStride, dst + plan.runs[r].first, plan.runs[r].count, nrFrames);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void cpuid(int info[4], int leaf)
+{
+#ifdef _MSC_VER
+  __cpuidex(info, leaf, 0);
+#else
+  __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static Isa DetectIsa()
+{
+  int info[4];
+  cpuid(info, 0);
+  const int maxLeaf = info[0];
+
+  cpuid(info, 1);
+  const bool ssse3 = (info[2] & (1 << 9)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+
+  bool avx2 = false;
+  if (maxLeaf >= 7 && osxsave && avx && (xgetbv0() & 0x6) == 0x6) {
+    cpuid(info, 7);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+
+  return avx2 ? isaAVX2 : ssse3 ? isaSSSE3 : isaScalar;
+}
+
+#else
+
+static Isa DetectIsa() { return isaScalar; }
+
+#endif
+
+//---------------------------------------------------------------------------------------------
+
+void Plan::Build(const uint8_t* active, uint32_t nrChannels)
+{
+  nrRuns = 0;
+  this->nrChannels = 0;
+  for (uint32_t c = 0; c < nrChannels; ++c)
+  {
+    if (!active[c])
+      continue;
+
+    if (nrRuns && runs[nrRuns - 1].first + runs[nrRuns - 1].count == c)
+      runs[nrRuns - 1].count++;
+    else {
+      runs[nrRuns].first = (uint16_t)c;
+      runs[nrRuns].count = 1;
+      nrRuns++;
+    }
+    this->nrChannels++;
+  }
+}
+
+void Plan::All(uint32_t nrChannels)
+{
+  nrRuns = nrChannels ? 1 : 0;
+  runs[0].first = 0;
+  runs[0].count = (uint16_t)nrChannels;
+  this->nrChannels = nrChannels;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#define PCMCONV_SELECT(isa) \
+  Deinterleave[fmtInt24] = deinterleave_##isa<fmtInt24>; \
+  Deinterleave[fmtInt32] = deinterleave_##isa<fmtInt32>; \
+  Deinterleave[fmtFloat32] = deinterleave_##isa<fmtFloat32>; \
+  Interleave[fmtInt24] = interleave_##isa<fmtInt24>; \
+  Interleave[fmtInt32] = interleave_##isa<fmtInt32>; \
+  Interleave[fmtFloat32] = interleave_##isa<fmtFloat32>; \
+  Mix = mix_##isa;
+
+DEINTERLEAVE Deinterleave[MaxFormat] = { deinterleave_c<fmtInt24>, deinterleave_c<fmtInt32>, deinterleave_c<fmtFloat32> };
+INTERLEAVE Interleave[MaxFormat] = { interleave_c<fmtInt24>, interleave_c<fmtInt32>, interleave_c<fmtFloat32> };
+MIX Mix = mix_c;
+static Isa sIsa = isaScalar;
+
+Isa Init(Isa limit)
+{
+  sIsa = DetectIsa();
+  if (sIsa > limit)
+    sIsa = limit;
+  switch (sIsa)
+  {
+#ifdef PCMCONV_X86
+  case isaAVX2:
+    PCMCONV_SELECT(avx2);
+    break;
+  case isaSSSE3:
+    PCMCONV_SELECT(ssse3);
+    break;
+#endif
+  default:
+    PCMCONV_SELECT(c);
+    break;
+  }
+  return sIsa;
+}
+
+Isa ActiveIsa()
+{
+  return sIsa;
+}
+
+const char* IsaName(Isa isa)
+{
+  switch (isa)
+  {
+  case isaAVX2:  return "AVX2";
+  case isaSSSE3: return "SSSE3";
+  default:       return "scalar";
+  }
+}
+
+uint32_t SampleSize(Format fmt)
+{
+  return FMT_SIZE(fmt);
+}
+
+const char* FormatName(Format fmt)
+{
+  switch (fmt)
+  {
+  case fmtInt32:   return "Int32LSB";
+  case fmtFloat32: return "Float32LSB";
+  default:         return "Int24LSB";
+  }
+}
+
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+
+/*Sample conversion between the device stream and the ASIO channel buffers
+
+  The device moves interleaved frames, one packed little endian 24bit sample per channel:
+    L1 M1 H1 L2 M2 H2 ... Ln Mn Hn
+  while the ASIO client works on one contiguous buffer per channel, in any of the Format types.
+  The sample format conversion is done in the same pass.
+  The kernels are selected once at runtime for the best instruction set of the cpu,
+  all of them produce bit exact results.
+*/
+namespace PcmConv
+{
+  enum Isa { isaScalar = 0, isaSSSE3, isaAVX2 };
+
+  //client side sample types: ASIOSTInt24LSB, ASIOSTInt32LSB (msb aligned) and ASIOSTFloat32LSB (+-1.0 full scale)
+  enum Format { fmtInt24 = 0, fmtInt32, fmtFloat32, MaxFormat };
+
+  static const uint32_t MaxPlanChannels = 256;
+
+  //a block of adjacent channels converted in one go
+  typedef struct _Run {
+    uint16_t first;
+    uint16_t count;
+  } Run;
+
+  //the channels to convert, built once when the buffers are created
+  //channels outside the plan are not touched at all
+  typedef struct _Plan {
+    Run runs[MaxPlanChannels / 2];
+    uint32_t nrRuns;
+    uint32_t nrChannels;
+
+    //active: one entry per channel, non zero to convert it
+    void Build(const uint8_t* active, uint32_t nrChannels);
+    void All(uint32_t nrChannels);
+  } Plan;
+
+  //src: first sample of the first frame, srcStride: bytes between frames
+  //dst: one pointer per channel (indexed by channel number) where nrFrames samples are written
+  typedef void(*DEINTERLEAVE)(const uint8_t* src, uint32_t srcStride, uint8_t* const* dst, const Plan& plan, uint32_t nrFrames);
+
+  //dst: start of the first frame, each frame gets the 32bit header word followed by the samples of the plan
+  //src: one pointer per channel (indexed by channel number) with nrFrames samples
+  //floats beyond full scale are clipped
+  typedef void(*INTERLEAVE)(uint8_t* dst, uint32_t dstStride, uint32_t header, const uint8_t* const* src, const Plan& plan, uint32_t nrFrames);
+
+  //adds the plan's channels of src to the same channels of dst, both device frames from their first sample
+  //on, the sums saturate at the 24bit full scale. Mixes the outputs of more than one client
+  typedef void(*MIX)(uint8_t* dst, uint32_t dstStride, const uint8_t* src, uint32_t srcStride, const Plan& plan, uint32_t nrFrames);
+
+  //selects the kernels for the best instruction set up to limit, safe to be called more than once.
+  //A lower limit is for the tests and benchmarks, they hold the simd kernels against the scalar ones
+  Isa Init(Isa limit = isaAVX2);
+  Isa ActiveIsa();
+  const char* IsaName(Isa isa);
+
+  //bytes per sample on the client side
+  uint32_t SampleSize(Format fmt);
+  const char* FormatName(Format fmt);
+
+  //indexed by Format
+  extern DEINTERLEAVE Deinterleave[MaxFormat];
+  extern INTERLEAVE Interleave[MaxFormat];
+  extern MIX Mix;
+};
@@ -0,0 +1,137 @@
+#include "stdafx.h"
+#include "PinnedArena.h"
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+//the arenas of a process move its working set limits one at a time
+static SRWLOCK sWorkingSetLock = SRWLOCK_INIT;
+
+//what goes on top of the block for the lock to hold, the pages of the calls around it
+static const size_t scWorkingSetSlack = 64 * 1024;
+
+static bool GrowWorkingSet(SSIZE_T delta)
+{
+  AcquireSRWLockExclusive(&sWorkingSetLock);
+  SIZE_T wsMin, wsMax;
+  bool done = GetProcessWorkingSetSize(GetCurrentProcess(), &wsMin, &wsMax) != FALSE;
+  if (done) {
+    wsMin = (SIZE_T)((SSIZE_T)wsMin + delta);
+    done = SetProcessWorkingSetSize(GetCurrentProcess(), wsMin, max(wsMax, wsMin)) != FALSE;
+  }
+  ReleaseSRWLockExclusive(&sWorkingSetLock);
+  return done;
+}
+
+static size_t PageSize()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+}
+
+//---------------------------------------------------------------------------------------------
+
+PinnedArena::PinnedArena()
+  : mBase(nullptr)
+  , mSize(0)
+  , mUsed(0)
+  , mLocked(false)
+{
+}
+
+PinnedArena::~PinnedArena()
+{
+  Release();
+}
+
+bool PinnedArena::Reserve(size_t size)
+{
+  Release();
+  if (size == 0)
+    return true;
+
+  const size_t page = PageSize();
+  size = (size + page - 1) & ~(page - 1);
+  mBase = (uint8_t*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (mBase == nullptr) {
+    LOGN("PinnedArena::Reserve %u bytes failed (%u)\n", (uint32_t)size, GetLastError());
+    return false;
+  }
+  mSize = size;
+
+  //committed pages come in zeroed on the first touch, that touch happens here
+  for (size_t offset = 0; offset < size; offset += page)
+    mBase[offset] = 0;
+
+  if (GrowWorkingSet((SSIZE_T)(size + scWorkingSetSlack))) {
+    mLocked = VirtualLock(mBase, size) != FALSE;
+    if (!mLocked) {
+      LOGN("PinnedArena::Reserve %u bytes not locked (%u)\n", (uint32_t)size, GetLastError());
+      GrowWorkingSet(-(SSIZE_T)(size + scWorkingSetSlack));
+    }
+  }
+
+  const uint32_t missing = NonResident();
+  LOGN("PinnedArena::Reserve %u bytes%s, %u pages not resident\n", (uint32_t)size, mLocked ? " locked" : "", missing);
+  return true;
+}
+
+void PinnedArena::Release()
+{
+  if (mBase == nullptr)
+    return;
+
+  if (mLocked) {
+    VirtualUnlock(mBase, mSize);
+    GrowWorkingSet(-(SSIZE_T)(mSize + scWorkingSetSlack));
+  }
+  VirtualFree(mBase, 0, MEM_RELEASE);
+  mBase = nullptr;
+  mSize = mUsed = 0;
+  mLocked = false;
+}
+
+void* PinnedArena::Alloc(size_t size, size_t align)
+{
+  if (mBase == nullptr)
+    return nullptr;
+
+  const size_t offset = (mUsed + align - 1) & ~(align - 1);
+  if (offset + size > mSize)
+    return nullptr;
+
+  mUsed = offset + size;
+  return mBase + offset;
+}
+
+//---------------------------------------------------------------------------------------------
+
+uint32_t PinnedArena::NonResident() const
+{
+  if (mBase == nullptr)
+    return 0;
+
+  //a few pages per call, the worker asks once a second and keeps off the heap
+  const size_t page = PageSize();
+  PSAPI_WORKING_SET_EX_INFORMATION info[64];
+  uint32_t missing = 0;
+  for (size_t offset = 0; offset < mSize; ) {
+    ULONG count = 0;
+    for (; count < ARRAYSIZE(info) && offset < mSize; count++, offset += page)
+      info[count].VirtualAddress = mBase + offset;
+    if (!QueryWorkingSetEx(GetCurrentProcess(), info, count * sizeof(info[0])))
+      return 0;
+    for (ULONG i = 0; i < count; i++)
+      if (!info[i].VirtualAttributes.Valid)
+        missing++;
+  }
+  return missing;
+}
+
+uint32_t PinnedArena::PageFaults()
+{
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PageFaultCount;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*Memory for the buffers a real time thread touches, set up before the stream starts
+
+  One block is committed, faulted in and locked in the working set when it is reserved. The buffers
+  are carved out of it, an allocation only moves a cursor and nothing is given back but the whole
+  block. The working set minimum of the process is raised by the block's size so the lock holds and
+  lowered again on Release, a host short of memory trims other pages before these.
+  NonResident checks the pages are still there, PageFaults tells how many the process took.
+  Reserve, Alloc and Release belong to the thread that owns the buffers.
+*/
+class PinnedArena
+{
+public:
+  PinnedArena();
+  ~PinnedArena();
+
+  //a block of at least size bytes, the one before is released. False if it could not be committed,
+  //it is still used when only the lock failed, Locked tells
+  bool Reserve(size_t size);
+  void Release();
+
+  //size bytes aligned to align, a power of 2, nullptr once the block is used up
+  void* Alloc(size_t size, size_t align = 64);
+
+  bool Locked() const { return mLocked; }
+  size_t Size() const { return mSize; }
+  size_t Used() const { return mUsed; }
+
+  //pages of the block not in the working set, 0 as long as it stays pinned
+  uint32_t NonResident() const;
+
+  //page faults of the whole process since it started, soft ones included
+  static uint32_t PageFaults();
+
+private:
+  uint8_t* mBase;
+  size_t mSize;
+  size_t mUsed;
+  bool mLocked;
+};
@@ -1,6 +1,9 @@
 #include "stdafx.h"
 #include "AudioXtreamerDevice.h"
 #include <process.h>
+#include "Trace\Trace.h"
+#include "LockFree\SpinWake.h"
+#include <atomic>
 
 #include "avrt.h"
 #pragma comment(lib, "avrt.lib")
@@ -12,9 +15,11 @@ AudioXtreamerDevice::AudioXtreamerDevice(UsbDeviceClient & client, ASIOSettings:
   , hAsioEvent(NULL)
   , hExtreamerEvent(NULL)
   , hWnd(NULL)
-  , pStreamParams(nullptr)
-  , pRxBuf(nullptr)
-  , pTxBuf(nullptr)
+  , hControlEvent(NULL)
+  , pControl(nullptr)
+  , mSlot(nullptr)
+  , mSlotIdx(0)
+  , pShared(nullptr)
 {
   
 
@@ -55,27 +60,40 @@ AudioXtreamerDevice::Open()
   if (hWnd == NULL) {
     _tprintf(TEXT("Xtreamer window not found (%d).\n"), GetLastError());
     goto error;
-  } else {
-    if ( SendMessage(hWnd, WM_XTREAMER, 1, 0) == 0 )
-      goto error;
   }
 
-  pStreamParams = (uint8_t*)MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, (1 << SH_MEM_BLK_SIZE_SHIFT));
-  pRxBuf = (uint8_t*)MapViewOfFile(hMapFile, FILE_MAP_READ, 0, (1 << SH_MEM_BLK_SIZE_SHIFT), (1 << SH_MEM_BLK_SIZE_SHIFT));
-  pTxBuf = (uint8_t*)MapViewOfFile(hMapFile, FILE_MAP_WRITE, 0, (2 << SH_MEM_BLK_SIZE_SHIFT) , 0); //till the end
+  //only reserved past what the layout uses, the pages come in as AudioXtreamer commits them
+  pShared = (uint8_t*)MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  hControlEvent = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, szNameControlEvent);
 
-  if ( (pStreamParams == nullptr) || (pRxBuf == nullptr) || (pTxBuf == nullptr) )
+  SharedLayout layout;
+  if (pShared == nullptr)
     _tprintf(TEXT("Could not map view of file (%d).\n"), GetLastError());
-  else
-    return true;
+  else if (!ReadLayout((SharedLayout*)pShared, layout))
+    _tprintf(TEXT("AudioXtreamer shared memory of another version.\n"));
+  else {
+    pControl = (ControlBlock*)(pShared + scControlOffset);
+    if (pControl->Flags & ctlPresent) {
+      //a slot left behind by a driver that died is free again
+      ClientSlot* slots = (ClientSlot*)(pShared + scClientSlotOffset);
+      for (uint32_t i = 0; i < scMaxClients; i++) {
+        if (ClaimOwner(slots[i].Owner, GetCurrentProcessId(), 1)) {
+          mSlot = &slots[i];
+          mSlotIdx = i;
+          return true;
+        }
+      }
+      _tprintf(TEXT("All %u client slots taken.\n"), scMaxClients);
+    }
+  }
 
 error:
 
-  unmap(pTxBuf);
-  unmap(pRxBuf);
-  unmap(pStreamParams);
+  pControl = nullptr;
+  unmap(pShared);
 
   unhandle(hAsioEvent);
+  unhandle(hControlEvent);
   unhandle(hMapFile);
   return false;
 }
@@ -87,9 +105,11 @@ AudioXtreamerDevice::Start()
   LOG0("AudioXtreamerDevice::Start");
   
   hAsioEvent = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, szNameAsioEvent);
-  hExtreamerEvent = OpenEvent(SYNCHRONIZE, FALSE, szNameXtreamerEvent);
+  TCHAR name[MAX_PATH];
+  SlotEventName(mSlotIdx, name, MAX_PATH);
+  hExtreamerEvent = OpenEvent(SYNCHRONIZE, FALSE, name);
 
-  if (hAsioEvent == NULL || hExtreamerEvent == NULL || SendMessage(hWnd, WM_XTREAMER, 2, 0) == 0)
+  if (hAsioEvent == NULL || hExtreamerEvent == NULL || mSlot == nullptr || pControl == nullptr || !(pControl->Flags & ctlRunning))
     return false;
 
 
@@ -138,30 +158,48 @@ AudioXtreamerDevice::Close()
 {
   LOG0("AudioXtreamerDevice::Close");
   Stop(true);
-  unmap(pTxBuf);
-  unmap(pRxBuf);
-  unmap(pStreamParams);
+  if (mSlot != nullptr) {
+    mSlot->Owner = 0;
+    mSlot = nullptr;
+  }
+  pControl = nullptr;
+  unmap(pShared);
 
   unhandle(hAsioEvent);
   unhandle(hExtreamerEvent);
+  unhandle(hControlEvent);
   unhandle(hMapFile);
   return true;
 }
 
 
+//published by AudioXtreamer's usb worker
 bool AudioXtreamerDevice::GetStatus(UsbDeviceStatus &status)
 {
-  return false;
+  return ReadTelemetry(TelemetryBlock(), status);
 }
 
+//kept up to date by AudioXtreamer, the host may ask as often as it likes
 uint32_t AudioXtreamerDevice::GetSampleRate()
 {
-  return uint32_t( SendMessage(hWnd, WM_XTREAMER, 4, 0));
+  return pControl != nullptr ? pControl->SampleRate : (uint32_t)(-1);
 }
 
 bool AudioXtreamerDevice::ConfigureDevice()
 {
-  return SendMessage(hWnd, WM_XTREAMER, 3, 0) == 1;
+  uint32_t result = 0;
+  return ControlCall(pControl, hWnd, hControlEvent, cmdConfigure, 0, result) && result == 1;
+}
+
+
+DriverLoad* AudioXtreamerDevice::LoadBlock()
+{
+  return pShared != nullptr ? (DriverLoad*)(pShared + scDriverLoadOffset) : nullptr;
+}
+
+Telemetry* AudioXtreamerDevice::TelemetryBlock()
+{
+  return pShared != nullptr ? (Telemetry*)(pShared + scTelemetryOffset) : nullptr;
 }
 
 
@@ -178,6 +216,20 @@ AudioXtreamerDevice::IsPresent()
   return true;
 }
 
+//the rings and this client's tx block, the other clients' blocks are none of its business
+void AudioXtreamerDevice::PrefaultLayout(uint32_t& sequence)
+{
+  SharedLayout layout;
+  if (!ReadLayout((SharedLayout*)pShared, layout))
+    return;
+
+  sequence = layout.Sequence;
+  if (layout.RxOffset == 0)
+    return;
+  PrefaultPages(pShared + layout.RxOffset, layout.SlotTxOffset - layout.RxOffset);
+  PrefaultPages(pShared + SlotTxOffset(layout, mSlotIdx), layout.SlotTxSize);
+}
+
 void
 AudioXtreamerDevice::main()
 {
@@ -187,26 +239,57 @@ AudioXtreamerDevice::main()
   ResetEvent(mExitHandle);
   //once started, fire the event to tell audioextreamer we are alive
 
-  volatile ASIOSettings::StreamInfo* info = (ASIOSettings::StreamInfo*)pStreamParams;
+  volatile ASIOSettings::StreamInfo* info = &mSlot->Stream;
+  //AudioXtreamer writes the flags too, every change is one interlocked operation
+  volatile LONG* flags = (volatile LONG*)&info->Flags;
+  InterlockedAnd(flags, ~(LONG)0x8);
+  //blocks come a period apart, the spin mostly shrinks to its floor here, the device's side gains
+  WakeBlock* wake = (WakeBlock*)(pShared + scWakeOffset);
+  SpinWake fromDevice;
+  fromDevice.Init(&mSlot->ToClient, hExtreamerEvent);
 
   DWORD proAudioIndex = 0;
   HANDLE AvrtHandle = AvSetMmThreadCharacteristics(L"Pro Audio", &proAudioIndex);
   AvSetMmThreadPriority(AvrtHandle, AVRT_PRIORITY_CRITICAL);
+  //Switch runs here in ipc mode
+  Trace::AttachThread("asio ipc");
 
 
+  uint32_t layoutSeq = 0;
+  PrefaultLayout(layoutSeq);
+
   while (WaitForSingleObject(mExitHandle, 0) != WAIT_OBJECT_0)
   {
-    info->Flags |= 0x1; //im alive
-    SetEvent(hAsioEvent);
-    DWORD result = WaitForSingleObject(hExtreamerEvent, 1000);
+    //a device restart lays the rings out anew, they are faulted in as soon as the new layout shows
+    if (((SharedLayout*)pShared)->Sequence != layoutSeq)
+      PrefaultLayout(layoutSeq);
+
+    //the device may have wiped the shared memory when it started, the block size goes with every alive
+    info->BlockFrames = devClient.BlockFrames();
+    mSlot->OutMask = devClient.OutputMask();
+    InterlockedOr(flags, 0x1); //im alive
+    SpinWake::Signal(&wake->ToDevice, hAsioEvent);
+    DWORD result = fromDevice.Wait(1000);
     switch (result)
     {
     case WAIT_OBJECT_0: {
+        const uint32_t block = mSlot->Block;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (info->Flags & 0x4) {
+          InterlockedAnd(flags, ~(LONG)0x4);
+          devClient.LatencyMeasured(info->RoundTrip);
+        }
 
         if (info->Flags & 0x2)
           devClient.SampleRateChanged();
-        else
-          devClient.Switch(0, info->RxStride, pRxBuf + info->RxOffset, info->TxStride, pTxBuf + info->TxOffset);
+        else {
+          devClient.SetBlockTime(info->BlockTime);
+          devClient.Switch(info->BlockFrames, info->RxStride, pShared + info->RxOffset, info->TxStride, pShared + info->TxOffset);
+        }
+        //the block is answered either way, AudioXtreamer doesn't wait for it any longer
+        std::atomic_thread_fence(std::memory_order_release);
+        mSlot->Done = block;
 
     } break;
 
@@ -223,12 +306,15 @@ AudioXtreamerDevice::main()
       break;
   }
 
-  info->Flags &= ~((uint32_t)0x1);//Im gone
-  SetEvent(hAsioEvent);
+  //gone before not alive, AudioXtreamer never finds the slot with neither
+  InterlockedOr(flags, 0x8);//Im gone
+  InterlockedAnd(flags, ~(LONG)0x1);
+  SpinWake::Signal(&wake->ToDevice, hAsioEvent);
 
   unhandle(hAsioEvent);
   unhandle(hExtreamerEvent);
 
+  Trace::DetachThread();
   AvRevertMmThreadCharacteristics(AvrtHandle);
 
   CloseHandle(mExitHandle);
@@ -15,10 +15,13 @@ public:
   bool GetStatus(UsbDeviceStatus &status) override;
   uint32_t GetSampleRate() override;
   bool ConfigureDevice() override;
+  DriverLoad* LoadBlock() override;
+  Telemetry* TelemetryBlock() override;
   
 private:
 
   void main();
+  void PrefaultLayout(uint32_t& sequence);
   volatile HANDLE hth_Worker;
   volatile HANDLE mExitHandle;
 
@@ -33,9 +36,14 @@ private:
   HANDLE hAsioEvent;
   HANDLE hExtreamerEvent;
   HWND   hWnd;
-  uint8_t * pStreamParams;
-  uint8_t * pTxBuf;
-  uint8_t * pRxBuf;
+  //AudioXtreamer's state and mailbox, answers come with hControlEvent
+  HANDLE hControlEvent;
+  ControlBlock * pControl;
+  //the client slot claimed in Open, the blocks come with its event
+  ClientSlot * mSlot;
+  uint32_t mSlotIdx;
+  //the whole mapping in one view, the layout at its start tells what is in use
+  uint8_t * pShared;
 };
 
 
@@ -0,0 +1,137 @@
+#include "stdafx.h"
+#include "DirectDevice.h"
+
+DirectDevice::DirectDevice(UsbDeviceClient & client, ASIOSettings::Settings & params)
+  : CypressDevice(client, params)
+  , hWnd(NULL)
+  , hControlEvent(NULL)
+  , hMapFile(NULL)
+  , pView(nullptr)
+  , pInfo(nullptr)
+  , pControl(nullptr)
+  , mProbeRequests(0)
+{
+}
+
+DirectDevice::~DirectDevice()
+{
+  CloseSideband();
+}
+
+//---------------------------------------------------------------------------------------------
+
+void DirectDevice::OpenSideband()
+{
+  //AudioXtreamer might not be running, then nobody holds the device and nobody watches the status
+  hWnd = FindWindow(szNameClass, szNameApp);
+  if (hWnd == NULL)
+    return;
+
+  hMapFile = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, szNameShMem);
+  if (hMapFile != NULL) {
+    SharedLayout layout;
+    pView = (uint8_t*)MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, scLayoutHeaderSize);
+    if (pView != nullptr && !ReadLayout((SharedLayout*)pView, layout)) {
+      LOG0("DirectDevice AudioXtreamer shared memory of another version");
+      UnmapViewOfFile(pView);
+      pView = nullptr;
+    }
+    if (pView != nullptr) {
+      pInfo = (DirectInfo*)(pView + scDirectInfoOffset);
+      pControl = (ControlBlock*)(pView + scControlOffset);
+      mProbeRequests = pInfo->ProbeRequests;
+    }
+  }
+  hControlEvent = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, szNameControlEvent);
+}
+
+void DirectDevice::CloseSideband()
+{
+  if (pInfo != nullptr)
+    pInfo->Owner = 0;
+  pInfo = nullptr;
+
+  if (hWnd != NULL) {
+    uint32_t result;
+    ControlCall(pControl, hWnd, hControlEvent, cmdReclaim, 0, result);
+    hWnd = NULL;
+  }
+  pControl = nullptr;
+
+  if (hControlEvent != NULL) {
+    CloseHandle(hControlEvent);
+    hControlEvent = NULL;
+  }
+
+  if (pView != nullptr) {
+    UnmapViewOfFile(pView);
+    pView = nullptr;
+  }
+
+  if (hMapFile != NULL) {
+    CloseHandle(hMapFile);
+    hMapFile = NULL;
+  }
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool DirectDevice::Open()
+{
+  LOG0("DirectDevice::Open");
+  OpenSideband();
+
+  //the tray app closes the device and stays away from it until we hand it back
+  uint32_t released = 0;
+  if (hWnd != NULL && (!ControlCall(pControl, hWnd, hControlEvent, cmdRelease, GetCurrentProcessId(), released) || released == 0)) {
+    LOG0("DirectDevice::Open AudioXtreamer did not release the device");
+    CloseSideband();
+    return false;
+  }
+
+  if (CypressDevice::Open())
+    return true;
+
+  CloseSideband();
+  return false;
+}
+
+bool DirectDevice::Close()
+{
+  LOG0("DirectDevice::Close");
+  bool result = CypressDevice::Close();
+  CloseSideband();
+  return result;
+}
+
+bool DirectDevice::ConfigureDevice()
+{
+  //the control panel stays in AudioXtreamer, it only edits the ini file while the device is ours
+  uint32_t result = 0;
+  return ControlCall(pControl, hWnd, hControlEvent, cmdConfigure, 0, result) && result == 1;
+}
+
+DriverLoad* DirectDevice::LoadBlock()
+{
+  return pView != nullptr ? (DriverLoad*)(pView + scDriverLoadOffset) : nullptr;
+}
+
+Telemetry* DirectDevice::TelemetryBlock()
+{
+  return pView != nullptr ? (Telemetry*)(pView + scTelemetryOffset) : nullptr;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void DirectDevice::TimerCB()
+{
+  CypressDevice::TimerCB();
+
+  //the status goes out through the telemetry, the sideband only brings the control panel's requests
+  if (pInfo != nullptr) {
+    if (pInfo->ProbeRequests != mProbeRequests) {
+      mProbeRequests = pInfo->ProbeRequests;
+      MeasureLatency();
+    }
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "FX2LP\CypressDevice.h"
+
+/*The usb device hosted inside the asio driver.
+  The worker thread calls Switch directly, no shared memory buffers and no cross process events.
+  AudioXtreamer is asked through its mailbox to let the device go while we own it and keeps serving
+  the control panel, the status is published for it in the Telemetry.
+*/
+class DirectDevice : public CypressDevice
+{
+public:
+  explicit DirectDevice(UsbDeviceClient & client, ASIOSettings::Settings & params);
+  ~DirectDevice() override;
+
+  bool Open() override;
+  bool Close() override;
+  bool ConfigureDevice() override;
+  DriverLoad* LoadBlock() override;
+  Telemetry* TelemetryBlock() override;
+
+protected:
+  void TimerCB() override;
+
+private:
+  void OpenSideband();
+  void CloseSideband();
+
+  HWND hWnd;
+  HANDLE hControlEvent;
+  HANDLE hMapFile;
+  uint8_t * pView;
+  DirectInfo * pInfo;
+  ControlBlock * pControl;
+  //ProbeRequests of the sideband already taken up
+  uint32_t mProbeRequests;
+};
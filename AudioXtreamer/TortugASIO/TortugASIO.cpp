@@ -18,19 +18,33 @@ Steinberg Audio Stream I/O API
 #include "AudioXtreamer\ASIOSettings.h"
 
 #include "AudioXtreamerDevice.h"
+#include "DirectDevice.h"
+#include "PcmConv\PcmConv.h"
+#include "Trace\Trace.h"
 
 using namespace ASIOSettings;
 
-#include "timeapi.h"
-#pragma comment (lib, "winmm.lib") 
-
 //Time utility
 static const double twoRaisedTo32 = 4294967296.0;
+void setNanoSeconds(ASIOTimeStamp* ts, uint64_t ns)
+{
+  ts->hi = (unsigned long)(ns >> 32);
+  ts->lo = (unsigned long)(ns & 0xFFFFFFFF);
+}
+//QPC based, the same clock the device dates the blocks with
 void getNanoSeconds(ASIOTimeStamp* ts)
 {
-  double nanoSeconds = (double)((unsigned long)timeGetTime()) * 1000000.;
-  ts->hi = (unsigned long)(nanoSeconds / twoRaisedTo32);
-  ts->lo = (unsigned long)(nanoSeconds - (ts->hi * twoRaisedTo32));
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  const uint64_t sec = now.QuadPart / freq.QuadPart;
+  const uint64_t rem = now.QuadPart % freq.QuadPart;
+  setNanoSeconds(ts, sec * 1000000000 + rem * 1000000000 / freq.QuadPart);
+}
+void double2AsioSamples(double value, ASIOSamples* samples)
+{
+  samples->hi = (unsigned long)(value * (1.0 / twoRaisedTo32));
+  samples->lo = (unsigned long)(value - (samples->hi * twoRaisedTo32));
 }
 double AsioSamples2double(ASIOSamples* samples)
 {
@@ -128,73 +142,102 @@ HRESULT _stdcall DllUnregisterServer()
 
 //---------------------------------------------------------------------------------------------
 
-bool TortugASIO::Switch(uint32_t timeout, uint32_t rxStride, uint8_t *rxBuff, uint32_t txStride, uint8_t *txBuff)
+bool TortugASIO::Switch(uint32_t frames, uint32_t rxStride, uint8_t *rxBuff, uint32_t txStride, uint8_t *txBuff)
 {
 
 
     //the device accepts this format.
     // L1 M1 H1 L2 M2 H2... L24 M24 H24
     // N channels * MSB first, 24bit.
-
-  const uint32_t NumSamplesx3 = mNumSamples * 3;
+    const uint64_t trace = Trace::Now();
 
     if (TryEnterCriticalSection(&cs) != FALSE)
     {
-      if (bufferActive)
-      {
-        for (int s = 0; s < mNumSamples; s++)
-        {
-          for (int c = 0; c < mNumInputs; c++)
-          {
-            memcpy(InputBuffers[c] + buffIdx * (NumSamplesx3) + s * 3, rxBuff + s * rxStride + c * 3, 3);
-          }
-        }
+      if (bufferActive) {
+        mProfDeinterleave.Begin();
+        mDeinterleave(rxBuff, rxStride, mInPtrs[buffIdx], mInPlan, (uint32_t)blockFrames);
+        mProfDeinterleave.End((uint32_t)blockFrames, rxStride * (uint32_t)blockFrames);
       }
       LeaveCriticalSection(&cs);
     }
 
     if (callbacks)
     {
-      getNanoSeconds(&theSystemTime);			// latch system time
+      //latch the time the input was complete, dated by the device or our own clock until it locked
+      if (mBlockTime != 0)
+        setNanoSeconds(&theSystemTime, mBlockTime);
+      else
+        getNanoSeconds(&theSystemTime);
       samplePosition += blockFrames;
 
-      callbacks->bufferSwitch(buffIdx, ASIOTrue);
       //client reads the input data and fills the ouput data, no waiting allowed thus ASIOTrue
+      const uint64_t traceHost = Trace::Now();
+      LARGE_INTEGER hostStart, hostEnd;
+      QueryPerformanceCounter(&hostStart);
+      if (timeInfoMode) {
+        asioTime.timeInfo.systemTime = theSystemTime;
+        double2AsioSamples(samplePosition, &asioTime.timeInfo.samplePosition);
+        callbacks->bufferSwitchTimeInfo(&asioTime, buffIdx, ASIOTrue);
+      }
+      else
+        callbacks->bufferSwitch(buffIdx, ASIOTrue);
+      Trace::Span(Trace::evBufferSwitch, traceHost, (uint32_t)buffIdx);
+
+      QueryPerformanceCounter(&hostEnd);
+      mCallbackLoad.Add(hostEnd.QuadPart - hostStart.QuadPart, mBlockTicks);
+      if (hostEnd.QuadPart - mLoadStart >= mQpcFreq.QuadPart) {
+        mLoadStart = hostEnd.QuadPart;
+        if (mLoadBlock != nullptr)
+          mCallbackLoad.Publish(mLoadBlock->Callback, mBlockUs);
+      }
     }
 
     if (TryEnterCriticalSection(&cs) != FALSE)
     {
       if (bufferActive)
       {
-        for (int s = 0; s < mNumSamples; s++)
-        {
-          for (int c = 0; c < mNumOutputs; c++)
-          {
-            memcpy(txBuff + s * txStride + c * 3, OutputBuffers[c] + buffIdx * (NumSamplesx3) + s * 3, 3);
-          }
-        }
+        //unused outputs keep the silence of their zeroed buffers, written until every queued tx buffer got it
+        const PcmConv::Plan& plan = mOutClearCount ? mAllOutPlan : mOutPlan;
+        if (mOutClearCount)
+          mOutClearCount--;
+
+        //txBuff points to the first tx frame, sync word and samples are written in one pass
+        mProfInterleave.Begin();
+        mInterleave(txBuff, txStride, scTxHeaderMark, mOutPtrs[buffIdx], plan, (uint32_t)blockFrames);
+        mProfInterleave.End((uint32_t)blockFrames, txStride * (uint32_t)blockFrames);
       }
       LeaveCriticalSection(&cs);
     }
+    Trace::Span(Trace::evSwitch, trace, (uint32_t)blockFrames);
     buffIdx ^= 1;
     return true;
 }
 
 //------------------------------------------------------------------------------------------
 
-void TortugASIO::AllocBuffers(uint32_t rxSize, uint8_t*&rxBuff, uint32_t txSize, uint8_t*&txBuff)
+//direct mode rings, in this process. The usb worker starts on them right away, they come in pinned
+bool TortugASIO::AllocBuffers(uint32_t rxSize, uint8_t*&rxBuff, uint32_t txSize, uint8_t*&txBuff, uint32_t slotTxSize)
 {
-  rxBuff = (uint8_t*)malloc(rxSize);
-  txBuff = (uint8_t*)malloc(txSize);
+  rxBuff = txBuff = nullptr;
+  if (!mRingArena.Reserve(rxSize + txSize + 4096))
+    return false;
+
+  rxBuff = (uint8_t*)mRingArena.Alloc(rxSize, 4096);
+  txBuff = (uint8_t*)mRingArena.Alloc(txSize, 4096);
+  if (rxBuff == nullptr || txBuff == nullptr) {
+    LOGN("TortugASIO::AllocBuffers rx %u tx %u do not fit in %u bytes\n", rxSize, txSize, (uint32_t)mRingArena.Size());
+    FreeBuffers(rxBuff, txBuff);
+    return false;
+  }
+  return true;
 }
 
 //------------------------------------------------------------------------------------------
 
 void TortugASIO::FreeBuffers(uint8_t*&rxBuff, uint8_t*&txBuff)
 {
-  free(rxBuff);
+  mRingArena.Release();
   rxBuff = nullptr;
-  free(txBuff);
   txBuff = nullptr;
 }
 
@@ -211,6 +254,16 @@ void TortugASIO::SampleRateChanged()
   DeviceStopped(true);
 }
 
+void TortugASIO::LatencyMeasured(uint32_t roundTrip)
+{//called from the device's thread context, the ini is written from the host's
+  LOGN("TortugASIO::LatencyMeasured %u frames at %ld\n", roundTrip, blockFrames);
+  mMeasuredBlock = blockFrames;
+  mMeasuredRoundTrip = roundTrip;
+  if (callbacks && callbacks->asioMessage &&
+    callbacks->asioMessage(kAsioSelectorSupported, kAsioLatenciesChanged, 0, 0))
+    callbacks->asioMessage(kAsioLatenciesChanged, 0, 0, 0);
+}
+
 //------------------------------------------------------------------------------------------
 
 ASIOSettings::Settings gSettings =
@@ -218,23 +271,46 @@ ASIOSettings::Settings gSettings =
   { 15, 15, 15,_T("NrIns"),     _T("; zero index based number of pcm LR lines")},
   { 15, 15, 15,_T("NrOuts"),    _T("; zero index based number of pcm LR lines")},
   { 64, 64, 256,_T("NrSamples"), _T("; Whats necesary to run smooth and the least 512b usb packets")},
-  { 64, 64, 256,_T("FifoSize"),  _T("; Size of the hardware Out FIFO")}
+  { 64, 64, 256,_T("FifoSize"),  _T("; Size of the hardware Out FIFO")},
+  { 0, 0, 2,_T("SampleFormat"), _T("; ASIO sample type 0:Int24LSB 1:Int32LSB 2:Float32LSB")},
+  { 0, 0, 1,_T("DirectMode"), _T("; 1: the asio driver opens the usb device itself, no round trip through AudioXtreamer")},
+  { 16, 16, 32,_T("QueueDepth"), _T("; Nr of NrSamples blocks buffered between the usb device and the asio client")},
+  { 2, 2, 8,_T("XferCount"), _T("; iso requests in flight per direction, more rides out longer stalls at the cost of latency")},
+  { 8, 8, 64,_T("XferPackets"), _T("; iso packets per request, rounded up to what the usb backend takes. 8 at high speed is a request per ms")}
 };
 
+static PcmConv::Format SettingsFormat()
+{
+  const int val = gSettings[SampleFormat].val;
+  return (val >= 0 && val < PcmConv::MaxFormat) ? (PcmConv::Format)val : PcmConv::fmtInt24;
+}
+
 //------------------------------------------------------------------------------------------
 TortugASIO::TortugASIO(LPUNKNOWN pUnk, HRESULT *phr)
 : CUnknown(ifaceName, pUnk, phr)
 , mNumSamples(gSettings[NrSamples].val)
+, mProfDeinterleave("Deinterleave")
+, mProfInterleave("Interleave")
 {
   LOG0("TortugASIO::TortugASIO");
+  Trace::Open();
 
   // typically blockFrames * 2; try to get 1 by offering direct buffer
   // access, and using asioPostOutput for lower latency
   samplePosition = 0;
+  mBlockTime = 0;
+  mMeasuredRoundTrip = 0;
+  mMeasuredBlock = 0;
+  mLoadBlock = nullptr;
+  QueryPerformanceFrequency(&mQpcFreq);
+  mBlockTicks = 0;
+  mBlockUs = 0;
+  mLoadStart = 0;
 
   active = false;
   started = false;
   bufferActive = false;
+  timeInfoMode = false;
 
   OutputBuffers = nullptr;
   outMap = nullptr;
@@ -245,16 +321,30 @@ TortugASIO::TortugASIO(LPUNKNOWN pUnk, HRESULT *phr)
   callbacks = 0;
   activeInputs = activeOutputs = 0;
   buffIdx = 0;
+  mInPlan.All(0);
+  mOutPlan.All(0);
+  mAllOutPlan.All(0);
+  mOutMask = 0;
+  mOutClearCount = 0;
 
   mDevice = nullptr;
   InitializeCriticalSection(&cs);
 
+  mFormat = PcmConv::fmtInt24;
+  mSampleSize = PcmConv::SampleSize(mFormat);
+
+  PcmConv::Isa isa = PcmConv::Init();
+  LOGN("TortugASIO::TortugASIO %s sample conversion\n", PcmConv::IsaName(isa));
+  mDeinterleave = PcmConv::Deinterleave[mFormat];
+  mInterleave = PcmConv::Interleave[mFormat];
+
 
   mIniFile = new ASIOSettingsFile(gSettings);
   if (mIniFile) {
     mIniFile->Load();
     mNumInputs = (gSettings[NrIns].val+1)*2;
     mNumOutputs = (gSettings[NrOuts].val+1)*2;
+    mFormat = SettingsFormat();
   }
 
   blockFrames = mNumSamples;
@@ -279,6 +369,7 @@ TortugASIO::~TortugASIO()
 
   delete mIniFile;
   mIniFile = nullptr;
+  Trace::Close();
 }
 
 //------------------------------------------------------------------------------------------
@@ -313,11 +404,13 @@ ASIOBool TortugASIO::init(void* sysRef)
   if (active)
     return true;
   strcpy(errorMessage, "ASIO Driver open Failure!");
-#if 0
-  mDevice = new CypressDevice( *this, gSettings);
-#else
-  mDevice = new AudioXtreamerDevice(*this, gSettings);
-#endif
+  //direct mode runs the usb worker in this process and calls Switch from it,
+  //AudioXtreamer only keeps the control panel and the status display
+  if (gSettings[DirectMode].val)
+    mDevice = new DirectDevice(*this, gSettings);
+  else
+    mDevice = new AudioXtreamerDevice(*this, gSettings);
+  LOGN("TortugASIO::init %s mode\n", gSettings[DirectMode].val ? "direct" : "ipc");
 
   if (mDevice != nullptr && mDevice->Open()) {
     active = true;
@@ -341,7 +434,18 @@ ASIOError TortugASIO::start()
     started = false;
     samplePosition = 0;
     theSystemTime.lo = theSystemTime.hi = 0;
+    mBlockTime = 0;
     buffIdx = 0;
+    mOutClearCount = MaxQueueDepth;
+
+    const uint32_t rate = mDevice->GetSampleRate();
+    const bool known = rate != 0 && rate != (uint32_t)-1;
+    mBlockTicks = known ? (uint64_t)blockFrames * mQpcFreq.QuadPart / rate : 0;
+    mBlockUs = known ? (uint32_t)((uint64_t)blockFrames * 1000000 / rate) : 0;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    mLoadStart = now.QuadPart;
+    mLoadBlock = mDevice->LoadBlock();
 
     if (mDevice->Start())
     {
@@ -356,6 +460,12 @@ ASIOError TortugASIO::start()
 ASIOError TortugASIO::stop()
 {
   LOG0("TortugASIO::stop");
+  SaveMeasuredLatency();
+  //the worker may still be in a Switch, a last second can slip in after this
+  DriverLoad* load = mLoadBlock;
+  mLoadBlock = nullptr;
+  if (load != nullptr)
+    LoadHistogram::Clear(load->Callback);
   if (mDevice && mDevice->Stop(false)) {
     started = false;
     return ASE_OK;
@@ -374,12 +484,47 @@ ASIOError TortugASIO::getChannels(long *numInputChannels, long *numOutputChannel
   return ASE_OK;
 }
 
+//------------------------------------------------------------------------------------------
+bool TortugASIO::LatencyKey(TCHAR* key, size_t size, long block)
+{
+  const uint32_t rate = mDevice != nullptr ? mDevice->GetSampleRate() : 0;
+  if (rate == 0 || rate == (uint32_t)-1)
+    return false;
+
+  //everything that moves the buffering between the host's output and its input
+  _stprintf_s(key, size, _T("%u_%ld_%d_%d_%d_%d_%d_%d_%d"), rate, block,
+    gSettings[NrIns].val, gSettings[NrOuts].val, gSettings[FifoDepth].val, gSettings[QueueDepth].val,
+    gSettings[XferCount].val, gSettings[XferPackets].val, gSettings[DirectMode].val);
+  return true;
+}
+
+void TortugASIO::SaveMeasuredLatency()
+{
+  TCHAR key[64];
+  if (mMeasuredRoundTrip != 0 && mIniFile && LatencyKey(key, 64, mMeasuredBlock))
+    mIniFile->SaveLatency(key, mMeasuredRoundTrip);
+  mMeasuredRoundTrip = 0;
+}
+
 //------------------------------------------------------------------------------------------
 ASIOError TortugASIO::getLatencies(long *_inputLatency, long *_outputLatency)
 {
-  *_inputLatency = blockFrames;		// typically;
-  *_outputLatency = blockFrames + gSettings[FifoDepth].val;
-  LOGN("TortugASIO::getLatencies %ld:%ld", *_inputLatency, *_outputLatency);
+  SaveMeasuredLatency();
+
+  TCHAR key[64];
+  uint32_t roundTrip = 0;
+  if (mIniFile && LatencyKey(key, 64, blockFrames) && mIniFile->LoadLatency(key, roundTrip)) {
+    //only the sum is measured. The input waits for a block and an iso request worth of frames,
+    //the rest of the round trip is the output's
+    const long rxFrames = (long)((uint64_t)gSettings[XferPackets].val * mDevice->GetSampleRate() / 8000);
+    *_outputLatency = max((long)roundTrip - (blockFrames + rxFrames), blockFrames);
+    *_inputLatency = max((long)roundTrip - *_outputLatency, 0L);
+  }
+  else {//not calibrated for this configuration
+    *_inputLatency = blockFrames;		// typically;
+    *_outputLatency = blockFrames + gSettings[FifoDepth].val;
+  }
+  LOGN("TortugASIO::getLatencies %ld:%ld%s", *_inputLatency, *_outputLatency, roundTrip ? " calibrated" : "");
 
   return ASE_OK;
 }
@@ -389,8 +534,11 @@ ASIOError TortugASIO::getBufferSize(long *minSize, long *maxSize,
   long *preferredSize, long *granularity)
 {
   LOG0("TortugASIO::getBufferSize");
-  *minSize = *maxSize = *preferredSize = blockFrames;//TODO: various sizes in case the ftdi or fpga dont collaborate
-  *granularity = 0;
+  //the device re-blocks its usb cadence to whatever the host picks, NrSamples is only the suggestion
+  *minSize = MinBlockFrames;
+  *maxSize = MaxBlockFrames;
+  *preferredSize = max(min(mNumSamples, (int)MaxBlockFrames), (int)MinBlockFrames);
+  *granularity = 1;
   return ASE_OK;
 }
 
@@ -455,7 +603,8 @@ ASIOError TortugASIO::getChannelInfo(ASIOChannelInfo *info)
   if (info->channel < 0 || (info->isInput ? info->channel >= mNumInputs : info->channel >= mNumOutputs))
     return ASE_InvalidParameter;
 
-  info->type = ASIOSTInt24LSB;
+  static const ASIOSampleType types[PcmConv::MaxFormat] = { ASIOSTInt24LSB, ASIOSTInt32LSB, ASIOSTFloat32LSB };
+  info->type = types[mFormat];
   info->channelGroup = 0;
   info->isActive = ASIOFalse;
   long i;
@@ -490,16 +639,7 @@ ASIOError TortugASIO::getSamplePosition(ASIOSamples *sPos, ASIOTimeStamp *tStamp
 {
   tStamp->lo = theSystemTime.lo;
   tStamp->hi = theSystemTime.hi;
-  if (samplePosition >= twoRaisedTo32)
-  {
-    sPos->hi = (unsigned long)(samplePosition * (1.0 / twoRaisedTo32));
-    sPos->lo = (unsigned long)(samplePosition - (sPos->hi * twoRaisedTo32));
-  }
-  else
-  {
-    sPos->hi = 0;
-    sPos->lo = (unsigned long)samplePosition;
-  }
+  double2AsioSamples(samplePosition, sPos);
   return ASE_OK;
 }
 //------------------------------------------------------------------------------------------
@@ -510,27 +650,47 @@ ASIOError TortugASIO::createBuffers(ASIOBufferInfo *bufferInfos, long numChannel
   ASIOBufferInfo *info = bufferInfos;
   long i;
 
+  if (bufferSize < MinBlockFrames || bufferSize > MaxBlockFrames)
+    return ASE_InvalidMode;
+
   activeInputs = 0;
   activeOutputs = 0;
   blockFrames = bufferSize;
 
+  //the host gets the samples already in its type, converted in Switch
+  mSampleSize = PcmConv::SampleSize(mFormat);
+  mDeinterleave = PcmConv::Deinterleave[mFormat];
+  mInterleave = PcmConv::Interleave[mFormat];
+  const long halfSize = blockFrames * mSampleSize;
+
+  //both halves of every channel in one pinned block, Switch converts into them in real time
+  const size_t outSize = mNumOutputs * halfSize * 2;
+  const size_t inSize = mNumInputs * halfSize * 2;
+  mBufferArena.Reserve(outSize + inSize + 64);
+  uint8_t* outBlock = (uint8_t*)mBufferArena.Alloc(outSize);
+  uint8_t* inBlock = (uint8_t*)mBufferArena.Alloc(inSize);
+  if (outBlock == nullptr || inBlock == nullptr) {
+    mBufferArena.Release();
+    return ASE_NoMemory;
+  }
+
   OutputBuffers = new uint8_t*[mNumOutputs];
   outMap = new long[mNumOutputs];
-  OutputBuffers[0] = new uint8_t[mNumOutputs * blockFrames * 3 * 2];  
-  ZeroMemory(OutputBuffers[0], mNumOutputs * blockFrames * 3 * 2);
+  OutputBuffers[0] = outBlock;
+  ZeroMemory(OutputBuffers[0], outSize);
 
   for (i = 0; i < mNumOutputs; i++) {
-    OutputBuffers[i] = OutputBuffers[0] + (blockFrames * 3 * 2)*i;    
+    OutputBuffers[i] = OutputBuffers[0] + (halfSize * 2)*i;
     outMap[i] = -1;
   }
 
   InputBuffers = new uint8_t*[mNumInputs];
   inMap = new long[mNumInputs];
-  InputBuffers[0] = new uint8_t[mNumInputs * blockFrames * 3 * 2];
-  ZeroMemory(InputBuffers[0], mNumOutputs * blockFrames * 3 * 2);
+  InputBuffers[0] = inBlock;
+  ZeroMemory(InputBuffers[0], inSize);
 
   for (i = 0; i < mNumInputs; i++) {
-	InputBuffers[i] = InputBuffers[0] + (blockFrames * 3 * 2) * i;
+	InputBuffers[i] = InputBuffers[0] + (halfSize * 2) * i;
 	inMap[i] = -1;
   }
 
@@ -540,7 +700,7 @@ ASIOError TortugASIO::createBuffers(ASIOBufferInfo *bufferInfos, long numChannel
     {
       if (info->channelNum >= 0 && info->channelNum < mNumInputs) {
         info->buffers[0] = InputBuffers[info->channelNum];
-        info->buffers[1] = InputBuffers[info->channelNum] + blockFrames * 3;
+        info->buffers[1] = InputBuffers[info->channelNum] + halfSize;
         inMap[activeInputs] = info->channelNum;
         activeInputs++;
       }
@@ -548,15 +708,40 @@ ASIOError TortugASIO::createBuffers(ASIOBufferInfo *bufferInfos, long numChannel
     {
       if (info->channelNum >= 0 && info->channelNum < mNumOutputs) {
         info->buffers[0] = OutputBuffers[info->channelNum];
-        info->buffers[1] = OutputBuffers[info->channelNum] + blockFrames * 3;
+        info->buffers[1] = OutputBuffers[info->channelNum] + halfSize;
         outMap[activeOutputs] = info->channelNum;
         activeOutputs++;
       }
     }
   }
 
+  uint8_t inActive[MaxChannels] = { 0 };
+  uint8_t outActive[MaxChannels] = { 0 };
+  for (i = 0; i < activeInputs; i++)
+    inActive[inMap[i]] = 1;
+  mOutMask = 0;
+  for (i = 0; i < activeOutputs; i++) {
+    outActive[outMap[i]] = 1;
+    mOutMask |= 1u << outMap[i];
+  }
+
+  mInPlan.Build(inActive, mNumInputs);
+  mOutPlan.Build(outActive, mNumOutputs);
+  mAllOutPlan.All(mNumOutputs);
+  mOutClearCount = MaxQueueDepth;
+
+  for (long b = 0; b < 2; b++) {
+    for (i = 0; i < mNumInputs; i++)
+      mInPtrs[b][i] = InputBuffers[i] + b * halfSize;
+    for (i = 0; i < mNumOutputs; i++)
+      mOutPtrs[b][i] = OutputBuffers[i] + b * halfSize;
+  }
+  LOGN("TortugASIO::createBuffers %s, %u/%u inputs in %u runs, %u/%u outputs in %u runs\n", PcmConv::FormatName(mFormat),
+    mInPlan.nrChannels, mNumInputs, mInPlan.nrRuns, mOutPlan.nrChannels, mNumOutputs, mOutPlan.nrRuns);
+
   this->callbacks = callbacks;
   bufferActive = true;
+  timeInfoMode = false;
   if (callbacks->asioMessage != NULL) {
     if (callbacks->asioMessage(kAsioSupportsTimeInfo, 0, 0, 0))
     {
@@ -571,8 +756,6 @@ ASIOError TortugASIO::createBuffers(ASIOBufferInfo *bufferInfos, long numChannel
       asioTime.timeCode.timeCodeSamples.lo = asioTime.timeCode.timeCodeSamples.hi = 0;
       asioTime.timeCode.flags = kTcValid | kTcRunning;
     }
-  } else {
-    timeInfoMode = false;
   }
 
   return ASE_OK;
@@ -586,15 +769,21 @@ ASIOError TortugASIO::disposeBuffers()
   if (bufferActive)
   {
     EnterCriticalSection(&cs);
-      delete OutputBuffers;
+      delete[] OutputBuffers;
       OutputBuffers = nullptr;
-      delete outMap;
+      delete[] outMap;
       outMap = nullptr;
 
-      delete InputBuffers;
+      delete[] InputBuffers;
       InputBuffers = nullptr;
-      delete inMap;
+      delete[] inMap;
       inMap = nullptr;
+      mBufferArena.Release();
+
+      mInPlan.All(0);
+      mOutPlan.All(0);
+      mAllOutPlan.All(0);
+      mOutMask = 0;
 
       bufferActive = false;
       callbacks = 0;
@@ -614,6 +803,7 @@ ASIOError TortugASIO::controlPanel()
   {
     mNumInputs = (gSettings[NrIns].val+1)*2;
     mNumOutputs = (gSettings[NrOuts].val+1)*2;
+    mFormat = SettingsFormat();
     blockFrames = mNumSamples;
     if(mIniFile) 
       mIniFile->Save();
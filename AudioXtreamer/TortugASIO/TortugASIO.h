@@ -5,6 +5,11 @@
 #include <stdint.h>
 
 #include "UsbDev\UsbDev.h"
+#include "AudioXtreamer\ASIOSettings.h"
+#include "PcmConv\PcmConv.h"
+#include "FX2LP\StageProfile.h"
+#include "LockFree\LoadHistogram.h"
+#include "PinnedArena\PinnedArena.h"
 
 class ASIOSettingsFile;
 class TortugASIO : public IASIO, public CUnknown, public UsbDeviceClient
@@ -48,16 +53,28 @@ public:
   ASIOError future(long selector, void *opt);
   ASIOError outputReady();
 
-  bool Switch(uint32_t timeout, uint32_t rxSampleSize, uint8_t *rxBuff, uint32_t txSampleSize, uint8_t *txBuff) override;
-  void AllocBuffers(uint32_t rxSize, uint8_t *&rxBuff, uint32_t txSize, uint8_t *&txBuff) override;
+  bool Switch(uint32_t frames, uint32_t rxSampleSize, uint8_t *rxBuff, uint32_t txSampleSize, uint8_t *txBuff) override;
+  bool AllocBuffers(uint32_t rxSize, uint8_t *&rxBuff, uint32_t txSize, uint8_t *&txBuff, uint32_t slotTxSize) override;
   void FreeBuffers(uint8_t *&rxBuff, uint8_t *&txBuff) override;
   void DeviceStopped(bool error) override;
   void SampleRateChanged() override;
+  uint32_t BlockFrames() override { return (uint32_t)blockFrames; }
+  uint32_t OutputMask() override { return mOutMask; }
+  void SetBlockTime(uint64_t ns) override { mBlockTime = ns; }
+  void LatencyMeasured(uint32_t roundTrip) override;
+  DriverLoad* LoadBlock() override { return mDevice != nullptr ? mDevice->LoadBlock() : nullptr; }
+  Telemetry* TelemetryBlock() override { return mDevice != nullptr ? mDevice->TelemetryBlock() : nullptr; }
+
+  //the configuration a calibrated round trip is kept under, false while the rate is unknown
+  bool LatencyKey(TCHAR* key, size_t size, long block);
+  void SaveMeasuredLatency();
 
   double samplePosition;
 
   ASIOTime asioTime;
   ASIOTimeStamp theSystemTime;
+  //from the device for the next Switch, 0 until its clock has locked
+  uint64_t mBlockTime;
 
   ASIOCallbacks *callbacks;
 
@@ -71,8 +88,43 @@ public:
   long *outMap;
   long *inMap;
 
+  //built in createBuffers, Switch converts only the channels the host activated
+  PcmConv::Plan mInPlan;
+  PcmConv::Plan mOutPlan;
+  PcmConv::Plan mAllOutPlan;
+  //the asio buffers, and the rings of direct mode, the usb worker's thread sets those up
+  PinnedArena mBufferArena;
+  PinnedArena mRingArena;
+  uint8_t* mInPtrs[2][ASIOSettings::MaxChannels];
+  const uint8_t* mOutPtrs[2][ASIOSettings::MaxChannels];
+  //the outputs the host activated, AudioXtreamer mixes only those when other drivers play along
+  uint32_t mOutMask;
+  //switches left writing every output, clears the unused channels once in each queued tx buffer
+  uint32_t mOutClearCount;
+
+  //sample type offered to the host, the kernels and sample size are latched in createBuffers
+  PcmConv::Format mFormat;
+  uint32_t mSampleSize;
+  PcmConv::DEINTERLEAVE mDeinterleave;
+  PcmConv::INTERLEAVE mInterleave;
+  //their cost in Switch, STAGE_PROFILE builds print it once a second from a thread of its own
+  StageProfile mProfDeinterleave;
+  StageProfile mProfInterleave;
+
+  //the host's bufferSwitch against the block period, published once a second from Switch.
+  //Latched in start: the shared block, the period in QPC ticks and us, 0 while the rate is unknown
+  LoadHistogram mCallbackLoad;
+  DriverLoad* mLoadBlock;
+  LARGE_INTEGER mQpcFreq;
+  uint64_t mBlockTicks;
+  uint32_t mBlockUs;
+  int64_t mLoadStart;
+
 
   long blockFrames;
+  //a probe result not in the ini yet and the block size it was measured with
+  volatile uint32_t mMeasuredRoundTrip;
+  volatile long mMeasuredBlock;
   long inputLatency;
   long outputLatency;
   long activeInputs;
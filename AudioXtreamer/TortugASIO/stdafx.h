@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <cfgmgr32.h>
+#include "setupapi.h"
 #include <usb.h>
 
 
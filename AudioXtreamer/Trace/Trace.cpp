@@ -0,0 +1,339 @@
+#include "stdafx.h"
+#include "Trace.h"
+#include "LockFree\SpscRing.h"
+#include "AudioXtreamer\ASIOSettings.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <process.h>
+
+std::atomic<bool> Trace::gOn(false);
+
+using namespace Trace;
+
+//events per thread, a worker at 1ms requests makes some 20k a second, a few drains fit
+static const uint32_t scRingEvents = 16384;
+static const uint32_t scMaxThreads = 8;
+static const DWORD scDrainPeriod = 50;
+
+static const struct {
+  const char* name;
+  const char* cat;
+  const char* arg;
+  bool mark;
+} scEvents[MaxEvent] = {
+  { "RxIso",        "usb",    "packets", false },
+  { "RxError",      "usb",    "packets", true },
+  { "ProcessHdr",   "usb",    "fifo",    false },
+  { "RxEnqueue",    "ring",   "frames",  false },
+  { "QueueFull",    "ring",   "frames",  true },
+  { "ClientBlock",  "client", "frames",  false },
+  { "Switch",       "asio",   "frames",  false },
+  { "bufferSwitch", "asio",   "index",   false },
+  { "TxIso",        "usb",    "frames",  false },
+  { "TxSubmit",     "usb",    "bytes",   false },
+};
+
+typedef struct _TraceEvent {
+  uint64_t start;
+  uint64_t end;
+  uint32_t arg;
+  uint16_t ev;
+  uint16_t pad;
+} TraceEvent;
+
+enum SlotState { slFree = 0, slClaimed, slAttached, slDetached };
+
+//a thread's ring, it writes, the drain reads. The state hands the slot between the two
+typedef struct _Slot {
+  std::atomic<LONG> state;
+  //bumped by every attach, the drain names the thread in a file once per attach
+  uint32_t generation;
+  DWORD tid;
+  char name[32];
+  std::atomic<uint32_t> dropped;
+  TraceEvent* mem;
+  SpscRing ring;
+} Slot;
+
+static Slot sSlots[scMaxThreads];
+static thread_local Slot* tSlot = nullptr;
+
+static SRWLOCK sLock = SRWLOCK_INIT;
+static uint32_t sRefs = 0;
+static HANDLE sThread = NULL;
+static HANDLE sExit = NULL;
+static HANDLE sToggle = NULL;
+
+//---------------------------------------------------------------------------------------------
+
+void Trace::Record(Event ev, uint64_t start, uint64_t end, uint32_t arg)
+{
+  Slot* slot = tSlot;
+  if (slot == nullptr)
+    return;
+
+  const TraceEvent e = { start, end, arg, (uint16_t)ev, 0 };
+  if (slot->ring.Write((const uint8_t*)&e, 1) == 0)
+    slot->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Trace::AttachThread(const char* name)
+{
+  if (tSlot != nullptr)
+    return;
+
+  for (uint32_t i = 0; i < scMaxThreads; i++) {
+    Slot& slot = sSlots[i];
+    LONG expected = slFree;
+    if (!slot.state.compare_exchange_strong(expected, slClaimed, std::memory_order_acquire))
+      continue;
+
+    if (slot.mem == nullptr)
+      slot.mem = (TraceEvent*)malloc(scRingEvents * sizeof(TraceEvent));
+    if (slot.mem == nullptr) {
+      slot.state.store(slFree, std::memory_order_release);
+      return;
+    }
+
+    slot.ring.Init((uint8_t*)slot.mem, sizeof(TraceEvent), scRingEvents);
+    slot.generation++;
+    slot.tid = GetCurrentThreadId();
+    strncpy_s(slot.name, name, _TRUNCATE);
+    slot.dropped.store(0, std::memory_order_relaxed);
+    slot.state.store(slAttached, std::memory_order_release);
+    tSlot = &slot;
+    return;
+  }
+  LOGN("Trace no ring left for thread %s\n", name);
+}
+
+void Trace::DetachThread()
+{
+  //the drain takes what is left and frees the slot
+  if (tSlot != nullptr) {
+    tSlot->state.store(slDetached, std::memory_order_release);
+    tSlot = nullptr;
+  }
+}
+
+//---------------------------------------------------------------------------------------------
+
+//one json file per tracing session, a Chrome trace in the array format
+typedef struct _TraceFile {
+  FILE* f;
+  bool first;
+  DWORD pid;
+  LARGE_INTEGER freq;
+  uint32_t named[scMaxThreads];
+} TraceFile;
+
+static void Separator(TraceFile& tf)
+{
+  fputs(tf.first ? "\n" : ",\n", tf.f);
+  tf.first = false;
+}
+
+//absolute QPC to us with ns digits, every process gets the same value for the same tick
+static void WriteTime(TraceFile& tf, uint64_t qpc)
+{
+  const uint64_t freq = (uint64_t)tf.freq.QuadPart;
+  const uint64_t ns = (qpc / freq) * 1000000000 + (qpc % freq) * 1000000000 / freq;
+  fprintf(tf.f, "%llu.%03u", ns / 1000, (uint32_t)(ns % 1000));
+}
+
+static void WriteEvent(TraceFile& tf, const Slot& slot, const TraceEvent& e)
+{
+  const uint32_t ev = e.ev < MaxEvent ? e.ev : 0;
+  Separator(tf);
+  fprintf(tf.f, "{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":",
+    scEvents[ev].name, scEvents[ev].cat, tf.pid, slot.tid);
+  WriteTime(tf, e.start);
+  if (scEvents[ev].mark)
+    fputs(",\"ph\":\"i\",\"s\":\"t\"", tf.f);
+  else
+    fprintf(tf.f, ",\"ph\":\"X\",\"dur\":%.3f", (double)(e.end - e.start) * 1e6 / tf.freq.QuadPart);
+  fprintf(tf.f, ",\"args\":{\"%s\":%u}}", scEvents[ev].arg, e.arg);
+}
+
+static bool OpenFile(TraceFile& tf)
+{
+  wchar_t* env = _wgetenv(L"APPDATA");
+  if (env == nullptr)
+    return false;
+
+  SYSTEMTIME st;
+  GetLocalTime(&st);
+  tf.pid = GetCurrentProcessId();
+  wchar_t path[MAX_PATH];
+  _snwprintf_s(path, _TRUNCATE, L"%s\\AudioXtreamer\\Trace-%04u%02u%02u-%02u%02u%02u-%u.json", env,
+    st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, tf.pid);
+
+  if (_wfopen_s(&tf.f, path, L"wb") != 0 || tf.f == nullptr) {
+    LOGN("Trace can't create %ls\n", path);
+    tf.f = nullptr;
+    return false;
+  }
+  LOGN("Trace to %ls\n", path);
+  setvbuf(tf.f, nullptr, _IOFBF, 1 << 16);
+
+  QueryPerformanceFrequency(&tf.freq);
+  ZeroMemory(tf.named, sizeof(tf.named));
+  tf.first = true;
+
+  char exe[MAX_PATH];
+  const DWORD len = GetModuleFileNameA(NULL, exe, MAX_PATH);
+  const char* base = exe;
+  for (DWORD i = 0; i < len; i++)
+    if (exe[i] == '\\')
+      base = exe + i + 1;
+
+  fputs("[", tf.f);
+  Separator(tf);
+  fprintf(tf.f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s\"}}",
+    tf.pid, len ? base : "?");
+  return true;
+}
+
+static void CloseFile(TraceFile& tf)
+{
+  //the closing bracket is optional, a trace cut short by a crash still loads
+  fputs("\n]\n", tf.f);
+  fclose(tf.f);
+  tf.f = nullptr;
+}
+
+//empties every ring, into the file if there is one
+static void Drain(TraceFile& tf)
+{
+  for (uint32_t i = 0; i < scMaxThreads; i++) {
+    Slot& slot = sSlots[i];
+    const LONG state = slot.state.load(std::memory_order_acquire);
+    if (state != slAttached && state != slDetached)
+      continue;
+
+    if (tf.f && tf.named[i] != slot.generation) {
+      tf.named[i] = slot.generation;
+      Separator(tf);
+      fprintf(tf.f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        tf.pid, slot.tid, slot.name);
+    }
+
+    uint32_t count;
+    const TraceEvent* e;
+    while ((e = (const TraceEvent*)slot.ring.ReadPtr(count)), count > 0) {
+      if (tf.f)
+        for (uint32_t c = 0; c < count; c++)
+          WriteEvent(tf, slot, e[c]);
+      slot.ring.Release(count);
+    }
+
+    const uint32_t dropped = slot.dropped.exchange(0, std::memory_order_relaxed);
+    if (tf.f && dropped) {
+      Separator(tf);
+      fprintf(tf.f, "{\"name\":\"TraceOverflow\",\"cat\":\"trace\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%u,\"tid\":%u,\"ts\":",
+        tf.pid, slot.tid);
+      WriteTime(tf, Qpc());
+      fprintf(tf.f, ",\"args\":{\"events\":%u}}", dropped);
+    }
+
+    //the thread is gone, everything it wrote was in the ring already
+    if (state == slDetached)
+      slot.state.store(slFree, std::memory_order_release);
+  }
+  if (tf.f)
+    fflush(tf.f);
+}
+
+static unsigned __stdcall DrainThread(void*)
+{
+  TraceFile tf;
+  ZeroMemory(&tf, sizeof(tf));
+
+  while (WaitForSingleObject(sExit, scDrainPeriod) == WAIT_TIMEOUT)
+  {
+    const bool on = WaitForSingleObject(sToggle, 0) == WAIT_OBJECT_0;
+    if (on && tf.f == nullptr) {
+      //whatever is left from before is not part of this trace
+      Drain(tf);
+      if (OpenFile(tf))
+        gOn.store(true, std::memory_order_relaxed);
+    }
+    else if (!on && tf.f != nullptr) {
+      gOn.store(false, std::memory_order_relaxed);
+      Drain(tf);
+      CloseFile(tf);
+    }
+    Drain(tf);
+  }
+
+  gOn.store(false, std::memory_order_relaxed);
+  Drain(tf);
+  if (tf.f)
+    CloseFile(tf);
+  return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void Trace::Open()
+{
+  AcquireSRWLockExclusive(&sLock);
+  if (sRefs++ == 0) {
+    //manual reset, whoever comes first creates it off
+    sToggle = CreateEvent(NULL, TRUE, FALSE, szNameTraceEvent);
+    sExit = CreateEvent(NULL, TRUE, FALSE, NULL);
+    sThread = (HANDLE)_beginthreadex(NULL, 0, DrainThread, nullptr, 0, nullptr);
+    if (sThread == NULL)
+      LOG0("Trace drain thread not started");
+  }
+  ReleaseSRWLockExclusive(&sLock);
+}
+
+void Trace::Close()
+{
+  AcquireSRWLockExclusive(&sLock);
+  if (sRefs > 0 && --sRefs == 0) {
+    SetEvent(sExit);
+    if (sThread != NULL) {
+      WaitForSingleObject(sThread, INFINITE);
+      CloseHandle(sThread);
+      sThread = NULL;
+    }
+    CloseHandle(sExit);
+    sExit = NULL;
+    CloseHandle(sToggle);
+    sToggle = NULL;
+
+    //rings of threads still attached stay, they'd be drained by the next Open
+    for (uint32_t i = 0; i < scMaxThreads; i++) {
+      LONG expected = slFree;
+      if (sSlots[i].state.compare_exchange_strong(expected, slClaimed, std::memory_order_acquire)) {
+        free(sSlots[i].mem);
+        sSlots[i].mem = nullptr;
+        sSlots[i].state.store(slFree, std::memory_order_release);
+      }
+    }
+  }
+  ReleaseSRWLockExclusive(&sLock);
+}
+
+void Trace::Enable(bool on)
+{
+  AcquireSRWLockShared(&sLock);
+  if (sToggle != NULL) {
+    if (on)
+      SetEvent(sToggle);
+    else
+      ResetEvent(sToggle);
+  }
+  ReleaseSRWLockShared(&sLock);
+}
+
+bool Trace::Enabled()
+{
+  AcquireSRWLockShared(&sLock);
+  const bool on = sToggle != NULL && WaitForSingleObject(sToggle, 0) == WAIT_OBJECT_0;
+  ReleaseSRWLockShared(&sLock);
+  return on;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+/*Event trace of the streaming pipeline, for the glitch that only shows once in a while
+
+  Every thread that records has its own lock-free ring, attached when the thread starts. The real time
+  side only writes a QPC time stamp pair to its ring, a thread of the process drains the rings a few
+  times a second and writes the events to a Chrome trace, an array of JSON events chrome://tracing and
+  Perfetto both load. A ring that fills up drops events, the trace shows how many.
+  Tracing is switched on and off by a named event, any process can set it: AudioXtreamer's tray menu
+  does. While it is off a trace point costs a load and a branch.
+  The time stamps are absolute QPC, the same in every process: in ipc mode AudioXtreamer and the asio
+  host each write a file, their events can be put in one array to see both sides on one timeline.
+*/
+namespace Trace
+{
+  enum Event : uint16_t {
+    evRxIso = 0,      //rx request completion handled, arg: packets in it
+    evRxError,        //instant, arg: packets of the request lost or failed
+    evProcessHdr,     //arg: fpga output fifo level
+    evRxEnqueue,      //input frames into the client ring, arg: frames
+    evQueueFull,      //instant, the client ring overflowed and the client was dropped
+    evClientBlock,    //a block handed to the client until it gave it back, arg: frames
+    evSwitch,         //TortugASIO::Switch, arg: frames
+    evBufferSwitch,   //the host's bufferSwitch inside it, arg: buffer index
+    evTxIso,          //tx request refill, arg: frames of audio and silence in it
+    evTxSubmit,       //the tx request handed to the backend, arg: bytes
+    MaxEvent
+  };
+
+  extern std::atomic<bool> gOn;
+
+  void Record(Event ev, uint64_t start, uint64_t end, uint32_t arg);
+
+  inline uint64_t Qpc()
+  {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64_t)now.QuadPart;
+  }
+
+  //the start of a span, 0 while tracing is off
+  inline uint64_t Now() { return gOn.load(std::memory_order_relaxed) ? Qpc() : 0; }
+
+  //a span from a Now() on to now, nothing if tracing was off at its start
+  inline void Span(Event ev, uint64_t start, uint32_t arg = 0)
+  {
+    if (start != 0)
+      Record(ev, start, Qpc(), arg);
+  }
+
+  inline void Mark(Event ev, uint32_t arg = 0)
+  {
+    if (gOn.load(std::memory_order_relaxed)) {
+      const uint64_t now = Qpc();
+      Record(ev, now, now, arg);
+    }
+  }
+
+  //process wide and counted, the rings are drained while anyone has it open
+  void Open();
+  void Close();
+
+  //from the thread itself, when it starts and before it exits. Events of threads not attached are ignored
+  void AttachThread(const char* name);
+  void DetachThread();
+
+  //switches tracing for every process, it takes the drain period to follow
+  void Enable(bool on);
+  bool Enabled();
+}
@@ -278,34 +278,67 @@ struct usbdk_req
   PVOID64 * pkts;
   uint8_t* alloc;
   USB_DK_ISO_TRANSFER_RESULT *results;
+  uint32_t capacity;  //packets the arrays hold, they outlive the request in the pool
+
+  bool Reserve(size_t count)
+  {
+    if (count <= capacity)
+      return true;
+    Free();
+    pkts = new (std::nothrow) PVOID64[count];
+    results = new (std::nothrow) USB_DK_ISO_TRANSFER_RESULT[count];
+    if (pkts == nullptr || results == nullptr) {
+      Free();
+      return false;
+    }
+    capacity = (uint32_t)count;
+    return true;
+  }
+
+  void Free()
+  {
+    delete[] pkts;
+    delete[] results;
+    pkts = nullptr;
+    results = nullptr;
+    capacity = 0;
+  }
 };
 
+static XferPool<usbdk_req> sXferPool;
+
 bool usbdk_init_xfer(HANDLE handle, XferReq* req, const size_t pktCount, const size_t pktSize )
 {
-  struct usbdk_req* ctx = new struct usbdk_req;
+  struct usbdk_req* ctx = sXferPool.Take();
   USB_DK_TRANSFER_TYPE type = BulkTransferType;
 
   if (nullptr != ctx) {
-    ZeroMemory(ctx, sizeof(struct usbdk_req));
+    ZeroMemory(&ctx->req, sizeof(ctx->req));
+    ctx->alloc = nullptr;
+    ctx->pktCount = ctx->pktSize = 0;
     req->ctx = ctx;
     if (pktCount > 0 && pktSize > 0) {
-      ctx->alloc = (uint8_t*)_aligned_malloc(pktCount * pktSize, 4096);
-      req->buff = ctx->alloc;
+      if (!ctx->Reserve(pktCount)) {
+        sXferPool.Give(ctx);
+        req->ctx = nullptr;
+        return false;
+      }
+      if (req->buff == nullptr)
+        req->buff = ctx->alloc = (uint8_t*)_aligned_malloc(pktCount * pktSize, 4096);
 
       ctx->pktCount = (uint32_t)pktCount;
       ctx->pktSize = (uint32_t)pktSize;
 
-      ctx->pkts = new PVOID64[pktCount];
-      ctx->results = new USB_DK_ISO_TRANSFER_RESULT[pktCount];
-
       for (uint32_t c = 0; c < pktCount; ++c)
         ctx->pkts[c] = (PVOID64)(uint64_t)pktSize;
 
       type = IsochronousTransferType;
     }
 
-    ctx->req = { req->endpoint, req->buff, req->bufflen, (ULONG64)type, pktCount, ctx->pkts };
-    ctx->req.Result.IsochronousResultsArray = ctx->results;
+    //a bulk request doesn't get the arrays a pooled context may still have
+    const bool iso = type == IsochronousTransferType;
+    ctx->req = { req->endpoint, req->buff, req->bufflen, (ULONG64)type, pktCount, iso ? ctx->pkts : nullptr };
+    ctx->req.Result.IsochronousResultsArray = iso ? ctx->results : nullptr;
     return true;
   }
   return false;
@@ -355,16 +388,23 @@ bool usbdk_xfer_cleanup(XferReq* req)
       _aligned_free(ctx->alloc);
       req->buff = nullptr;
     }
-    if (ctx->pkts)
-      delete ctx->pkts;
-    if (ctx->results)
-      delete ctx->results;
 
-    delete req->ctx;
+    //the packet arrays stay with the context for the next start
+    sXferPool.Give(ctx);
+    req->ctx = nullptr;
   }
+  return true;
+}
 
+//UsbDk takes the packet layout as given, only the usb limits apply
+bool usbdk_iso_limits(HANDLE handle, uint8_t ep, IsoLimits* limits)
+{
+  limits->pktMultiple = 8;
+  limits->maxPkts = 1024;
+  limits->pktSize = 1024;
   return true;
 }
+
 /*
 bool usbdk_bulk_xfer(XferReq* req)
 {
@@ -388,4 +428,5 @@ const USB_BACKEND_XFER bknd_iso_read            = usbdk_iso_read;
 const USB_BACKEND_XFER bknd_iso_write           = usbdk_iso_write;
 const USB_BACKEND_ISO_GET_RESULT bknd_iso_get_result = usbdk_iso_result;
 const USB_BACKEND_XFER bknd_xfer_cleanup = usbdk_xfer_cleanup;
+const USB_BACKEND_ISO_LIMITS bknd_iso_limits = usbdk_iso_limits;
 */
@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+/*The device stream as it is on the wire, apart from the device and the usb backends
+
+  Every rx packet starts with an RxHeader, the frames follow. A frame may start at the end of one
+  packet and finish in the next, RxFramer puts it back together. Every tx frame starts with the sync
+  word. Nothing here depends on the platform, the benchmarks build it on its own.
+*/
+
+//every tx frame starts with the sync word AA 55 55 AA followed by the samples
+static const uint32_t scTxHeaderSize = 4;
+static const uint32_t scTxHeaderMark = 0xAA5555AA;
+
+//the longest rx frame, 32 channels
+static const uint32_t scMaxRxStride = 32 * 3;
+
+#pragma pack (push,1)
+struct RxHeader
+{
+  uint16_t Hdr1;
+  uint16_t Hdr2;
+  uint16_t SamplingRate;
+  uint16_t FifoLevel;   //the out fifo's read count
+  uint16_t OutSkipCount;//reads of the empty out fifo
+  uint16_t InFullCount; //writes to the full in fifo
+  uint8_t midi_in[8];
+};
+#pragma pack (pop)
+
+//the header at the start of an rx packet, nullptr without its marks
+inline const RxHeader* RxHeaderAt(const uint8_t* packet)
+{
+  const RxHeader* hdr = (const RxHeader*)packet;
+  return hdr->Hdr1 == 0xaaaa && hdr->Hdr2 == 0x5555 ? hdr : nullptr;
+}
+
+//the fpga's rate count in 10Hz steps snapped to 44.1/48/88.2/96k, 0 off all of them
+inline uint32_t ConvertSampleRate(uint32_t srReg)
+{
+  static const uint32_t scRates[] = { 44100, 48000, 88200, 96000 };
+  static const uint32_t scTolerance = 100;
+
+  const uint32_t sr = (srReg & 0xFFFF) * 10;
+  for (uint32_t rate : scRates)
+    if (sr > rate - scTolerance && sr < rate + scTolerance)
+      return rate;
+  return 0;
+}
+
+//tx frames of silence, the sync word and zeroed samples
+inline void FillTxHeaders(uint8_t* ptr, uint32_t frames, uint32_t stride)
+{
+  memset(ptr, 0, frames * stride);
+  for (uint32_t i = 0; i < frames; i++)
+    memcpy(ptr + i * stride, &scTxHeaderMark, scTxHeaderSize);
+}
+
+//the frames of consecutive rx packets, whole, in order
+class RxFramer
+{
+public:
+  RxFramer()
+    : mStride(0)
+    , mCarryLen(0)
+  {}
+
+  //at the start of a stream, stride up to scMaxRxStride
+  void Init(uint32_t stride)
+  {
+    mStride = stride;
+    mCarryLen = 0;
+  }
+
+  //the bytes of a packet after its header. push(const uint8_t* frames, uint32_t count) gets them,
+  //a frame the last packet started on its own first. The start of a frame split off at the end is kept
+  template<typename Push>
+  void Packet(const uint8_t* ptr, uint32_t len, Push&& push)
+  {
+    if (mCarryLen > 0) {
+      const uint32_t count = len < mStride - mCarryLen ? len : mStride - mCarryLen;
+      memcpy(mCarry + mCarryLen, ptr, count);
+      mCarryLen += count;
+      ptr += count;
+      len -= count;
+
+      if (mCarryLen == mStride) {
+        push((const uint8_t*)mCarry, 1u);
+        mCarryLen = 0;
+      }
+    }
+
+    const uint32_t frames = len / mStride;
+    if (frames > 0)
+      push(ptr, frames);
+
+    ptr += frames * mStride;
+    len -= frames * mStride;
+    memcpy(mCarry + mCarryLen, ptr, len);
+    mCarryLen += len;
+  }
+
+private:
+  uint32_t mStride;
+  uint32_t mCarryLen;
+  uint8_t mCarry[scMaxRxStride];
+};
@@ -1,8 +1,134 @@
 #include "stdafx.h"
 #include "UsbDev.h"
+#include "LockFree\SeqLock.h"
+#include <stddef.h>
 
 UsbDevice::~UsbDevice()
 {
   //needs to exist
 }
 
+
+bool ReadTelemetry(const Telemetry* block, UsbDeviceStatus& status)
+{
+  if (block == nullptr || block->Version != scTelemetryVersion || block->Size != sizeof(UsbDeviceStatus))
+    return false;
+
+  struct {
+    uint64_t Time;
+    UsbDeviceStatus Status;
+  } copy;
+  static_assert(sizeof(copy) == sizeof(Telemetry) - offsetof(Telemetry, Time), "Time and Status are copied in one go");
+  if (!SeqLock::Read(block->Sequence, &copy, &block->Time, sizeof(copy)) || copy.Time == 0)
+    return false;
+
+  status = copy.Status;
+  return true;
+}
+
+bool ReadLoad(const LoadInfo& shared, LoadInfo& info)
+{
+  info.Sequence = shared.Sequence;
+  return SeqLock::Read(shared.Sequence, &info.PeriodUs, &shared.PeriodUs, sizeof(LoadInfo) - offsetof(LoadInfo, PeriodUs));
+}
+
+
+static uint32_t AlignUp(uint32_t size, uint32_t align)
+{
+  return (size + align - 1) & ~(align - 1);
+}
+
+//the header first, then each region on a view boundary. The clients' blocks go by pages, they are
+//written by different processes
+void BuildLayout(SharedLayout& layout, uint32_t rxSize, uint32_t txSize, uint32_t slotTxSize)
+{
+  layout.RxOffset = scLayoutHeaderSize;
+  layout.RxSize = rxSize;
+  layout.TxOffset = layout.RxOffset + AlignUp(rxSize, scLayoutAlign);
+  layout.TxSize = txSize;
+  layout.SlotTxOffset = layout.TxOffset + AlignUp(txSize, scLayoutAlign);
+  layout.SlotTxSize = AlignUp(slotTxSize, 4096);
+  layout.Size = AlignUp(layout.SlotTxOffset + scMaxClients * layout.SlotTxSize, scLayoutAlign);
+}
+
+bool ReadLayout(const SharedLayout* shared, SharedLayout& layout)
+{
+  if (shared == nullptr || shared->Magic != scLayoutMagic || shared->Version != scLayoutVersion)
+    return false;
+
+  layout.Magic = scLayoutMagic;
+  layout.Version = scLayoutVersion;
+  layout.Sequence = shared->Sequence;
+  return SeqLock::Read(shared->Sequence, &layout.PageSize, &shared->PageSize, sizeof(SharedLayout) - offsetof(SharedLayout, PageSize));
+}
+
+bool PrefaultPages(void* ptr, size_t size)
+{
+  if (ptr == nullptr || size == 0)
+    return true;
+
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  volatile const uint8_t* page = (volatile const uint8_t*)ptr;
+  for (size_t offset = 0; offset < size; offset += info.dwPageSize)
+    (void)page[offset];
+  return VirtualLock(ptr, size) != FALSE;
+}
+
+
+//the process that held it might have died with it. One we may not open is still there
+bool ClaimOwner(volatile uint32_t& owner, uint32_t self, uint32_t tries)
+{
+  for (; tries > 0; tries--) {
+    const uint32_t held = InterlockedCompareExchange((volatile LONG*)&owner, self, 0);
+    if (held == 0 || held == self)
+      return true;
+
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, held);
+    const bool gone = process == NULL ? GetLastError() == ERROR_INVALID_PARAMETER : WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+    if (process != NULL)
+      CloseHandle(process);
+    if (gone && InterlockedCompareExchange((volatile LONG*)&owner, self, held) == (LONG)held)
+      return true;
+
+    if (tries > 1)
+      Sleep(1);
+  }
+  return false;
+}
+
+void SlotEventName(uint32_t slot, TCHAR* name, size_t size)
+{
+  _stprintf_s(name, size, _T("%s_%u"), szNameXtreamerEvent, slot);
+}
+
+bool ControlCall(ControlBlock* ctl, HWND hWnd, HANDLE done, uint32_t command, uint32_t arg, uint32_t& result)
+{
+  if (ctl == nullptr || hWnd == NULL || done == NULL)
+    return false;
+
+  if (!ClaimOwner(ctl->Owner, GetCurrentProcessId(), 5000)) {
+    LOGN("ControlCall %u mailbox held by %u\n", command, ctl->Owner);
+    return false;
+  }
+
+  ResetEvent(done);
+  ctl->Command = command;
+  ctl->Arg = arg;
+  const uint32_t request = ctl->Request + 1;
+  std::atomic_thread_fence(std::memory_order_release);
+  ctl->Request = request;
+
+  //the control panel can take as long as the user wants, only a tray that went away ends the wait
+  bool answered = false;
+  if (PostMessage(hWnd, WM_XTREAMER, 0, 0)) {
+    while (!(answered = ctl->Done == request) && IsWindow(hWnd))
+      WaitForSingleObject(done, 100);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  result = ctl->Result;
+
+  std::atomic_thread_fence(std::memory_order_release);
+  ctl->Owner = 0;
+  return answered;
+}
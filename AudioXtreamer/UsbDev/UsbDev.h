@@ -1,29 +1,262 @@
 #pragma once
 #include <stdint.h>
 #include "AudioXtreamer\ASIOSettings.h"
+#include "StreamFormat.h"
+#include "LockFree\WakeWord.h"
 
 typedef struct _UsbDeviceStatus
 {
-  uint32_t ResyncErrors;
+  uint32_t ResyncErrors; //rx packets without a valid header, since the start
   uint32_t FifoLevel;
   uint32_t OutSkipCount;
   uint32_t InFullCount;
-  uint32_t LastSR;
-  uint32_t SwSR;
-  uint32_t Ep6IsoErr;
+  uint32_t LastSR;    //nominal rate the fpga counts, snapped to 44.1/48/88.2/96k, 0 if none of them
+  uint32_t SwSR;      //measured rate against the host clock, in mHz, 0 until the estimate locked
+  uint32_t Ep6IsoErr;    //rx packets lost or failed, since the start
+
+  //per second: worker thread wakeups, client switches and the time the client took for them in us
+  //in ipc mode that is the round trip to the asio host process, in direct mode the Switch call itself
+  uint32_t Wakes;
+  uint32_t Switches;
+  uint32_t SwitchLatAvg;
+  uint32_t SwitchLatMax;
+
+  //jitter control: the fifo level it keeps as margin, the lowest level seen last second,
+  //frames added (dropped if negative) to the output since the start and how many times
+  uint32_t FifoMargin;
+  uint32_t FifoMinLevel;
+  int32_t PrerollTrim;
+  uint32_t Trims;
+
+  //SwSR against LastSR, in parts per billion
+  int32_t DriftPpb;
+
+  //latency probe, a ProbeState and the round trip it found in frames
+  uint32_t ProbeState;
+  uint32_t ProbeRoundTrip;
+
+  //last second: the highest fifo level, the input frames and rx packets, the rx packets lost
+  //and the steps of the fpga's skip and full counters, they saturate at 0xFFFF
+  uint32_t FifoMaxLevel;
+  uint32_t RxFrames;
+  uint32_t RxPackets;
+  uint32_t RxLost;
+  uint32_t OutSkips;
+  uint32_t InFulls;
+
+  //per second: client answers caught spinning, without a kernel wait
+  uint32_t SpinWakes;
+
+  //last second: page faults of the process the usb worker runs in, soft ones included, and the
+  //pages of the worker's pinned buffers that were not resident
+  uint32_t PageFaults;
+  uint32_t NonResident;
+
+  //last second: midi messages dropped on a full port queue
+  uint32_t MidiOutDrops;
 
 } UsbDeviceStatus;
 
+enum ProbeState { probeIdle, probeRunning, probeDone, probeFailed };
+
+/*The shared memory starts with its layout. The first block holds the small structures below, the
+  rings and the clients' tx blocks follow, sized for the channels and queue depth the device starts
+  with. AudioXtreamer reserves the mapping for the largest configuration and commits only what the
+  layout in use covers, it writes the layout again under the seqlock whenever the device starts.
+  The offsets go by the allocation granularity, a view may start at any of them. A process that
+  finds another magic or version leaves the memory alone
+*/
+static const uint32_t scLayoutMagic = 0x4D535841; //AXSM
+static const uint32_t scLayoutVersion = 1;
+static const uint32_t scLayoutAlign = 1 << 16;
+static const uint32_t scLayoutHeaderSize = scLayoutAlign;
+
+typedef struct _SharedLayout
+{
+  uint32_t Magic;
+  uint32_t Version;
+  volatile uint32_t Sequence; //seqlock over the rest
+  uint32_t PageSize;      //of the mapping, the large page size if it got them
+  uint32_t Reserved;      //bytes of the mapping
+  uint32_t Size;          //bytes committed and in use, from the start
+  uint32_t RxOffset;      //the input ring
+  uint32_t RxSize;
+  uint32_t TxOffset;      //the output ring
+  uint32_t TxSize;
+  uint32_t SlotTxOffset;  //the clients' tx blocks one after the other, see SlotTxOffset
+  uint32_t SlotTxSize;
+} SharedLayout;
+
+//rings of rxSize and txSize bytes, a client writes up to slotTxSize bytes a block
+void BuildLayout(SharedLayout& layout, uint32_t rxSize, uint32_t txSize, uint32_t slotTxSize);
+//a consistent copy, false if the memory has another layout version or is being written for too long
+bool ReadLayout(const SharedLayout* shared, SharedLayout& layout);
+//touches every page and locks them in the working set if the process may, a real time thread
+//doesn't take a fault on the first access then. False if they couldn't be locked
+bool PrefaultPages(void* ptr, size_t size);
+
+//direct mode sideband, after the layout in the shared memory.
+//The asio host streaming in process owns the usb device, its status goes to the Telemetry
+typedef struct _DirectInfo
+{
+  uint32_t Owner;   //process id of the asio host, 0 while the tray owns the device
+  uint32_t ProbeRequests; //bumped by AudioXtreamer to start a latency probe in the host
+} DirectInfo;
+
+static const uint32_t scDirectInfoOffset = 64;
+static_assert(sizeof(SharedLayout) <= scDirectInfoOffset, "SharedLayout runs into DirectInfo");
+
+//what the asio drivers ask AudioXtreamer, placed after the DirectInfo in the shared memory.
+//The tray keeps the state words up to date, a query is a plain read. The commands that change
+//something go through the mailbox: the caller claims it with its process id, writes the command
+//and bumps Request, the tray runs it on its ui thread, writes Result and sets Done to Request.
+//AudioXtreamer leaves the block alone when the device (re)starts
+enum ControlFlags { ctlPresent = 0x1, ctlRunning = 0x2, ctlDirect = 0x4 };
+enum ControlCommand { cmdNone, cmdConfigure, cmdRelease, cmdReclaim };
+
+typedef struct _ControlBlock
+{
+  volatile uint32_t SampleRate; //what the device runs at, (uint32_t)-1 without one
+  volatile uint32_t Flags;      //ControlFlags
+  volatile uint32_t Owner;      //process id of the caller holding the mailbox, 0 if free
+  volatile uint32_t Command;    //ControlCommand
+  volatile uint32_t Arg;        //cmdRelease: process id of the direct mode host
+  volatile uint32_t Request;
+  volatile uint32_t Done;
+  volatile uint32_t Result;
+} ControlBlock;
+
+static const uint32_t scControlOffset = 128;
+static_assert(scDirectInfoOffset + sizeof(DirectInfo) <= scControlOffset, "DirectInfo runs into ControlBlock");
+
+//takes owner for this process if it is 0 or the process in it is gone, tries times 1ms apart
+bool ClaimOwner(volatile uint32_t& owner, uint32_t self, uint32_t tries);
+
+//runs a command in AudioXtreamer and waits for it, false if the mailbox stayed busy or the tray went away.
+//done is the szNameControlEvent, hWnd the tray window
+bool ControlCall(ControlBlock* ctl, HWND hWnd, HANDLE done, uint32_t command, uint32_t arg, uint32_t& result);
+
+//the ipc handshake words, see LockFree\WakeWord.h. The words towards the clients are in their slots
+typedef struct _WakeBlock
+{
+  WakeWord ToDevice;  //a driver is done with its block or alive, with szNameAsioEvent
+} WakeBlock;
+
+//kept with the ControlBlock when the device (re)starts, both sides go on counting
+static const uint32_t scWakeOffset = 160;
+static_assert(scControlOffset + sizeof(ControlBlock) <= scWakeOffset, "ControlBlock runs into WakeBlock");
+
+//durations of a real time call over the last second, in percent of the buffer period.
+//Buckets of 10%, the last one counts the calls that took longer than the period, one of exactly
+//the period is in time. Read it with ReadLoad
+static const uint32_t LoadBuckets = 11;
+typedef struct _LoadInfo
+{
+  volatile uint32_t Sequence; //seqlock over the rest, odd while the writer is in, once a second
+  uint32_t PeriodUs;
+  uint32_t Calls;
+  uint32_t Overruns;
+  uint32_t AvgPct;
+  uint32_t MaxPct;
+  uint32_t Buckets[LoadBuckets];
+} LoadInfo;
+
+//the driver load in the shared memory, for AudioXtreamer and any other reader that maps it.
+//Each half is written by the process that measures it, zeroed when it stops
+typedef struct _DriverLoad
+{
+  LoadInfo Callback;  //the host's bufferSwitch, measured by the asio driver in TortugASIO::Switch
+  LoadInfo RoundTrip; //a block handed to the client until it is back, measured by the usb worker
+} DriverLoad;
+
+static const uint32_t scDriverLoadOffset = 256;
+static_assert(scWakeOffset + sizeof(WakeBlock) <= scDriverLoadOffset, "WakeBlock runs into DriverLoad");
+
+//the device status in the shared memory, published by the usb worker with every rx request and the
+//per second figures once a second, in whichever process runs it. Any process reads it with ReadTelemetry.
+//A new layout of the status bumps the version, a reader only takes the one it knows
+static const uint32_t scTelemetryVersion = 3;
+typedef struct _Telemetry
+{
+  uint32_t Version;   //scTelemetryVersion once the device published, 0 before
+  uint32_t Size;      //sizeof(UsbDeviceStatus) of the writer
+  volatile uint32_t Sequence; //seqlock over Time and Status, odd while the device writes
+  uint32_t Reserved;
+  uint64_t Time;      //QPC of the publication, 0 once the device stopped
+  UsbDeviceStatus Status;
+} Telemetry;
+
+static const uint32_t scTelemetryOffset = 512;
+static_assert(scDriverLoadOffset + sizeof(DriverLoad) <= scTelemetryOffset, "DriverLoad runs into Telemetry");
+
+//a consistent copy of the status, false if the device isn't streaming or the layout is another one
+bool ReadTelemetry(const Telemetry* block, UsbDeviceStatus& status);
+
+//a consistent copy of one half of the DriverLoad, false if every try ran into a write
+bool ReadLoad(const LoadInfo& shared, LoadInfo& info);
+
+//an asio driver attached to AudioXtreamer, one slot each, claimed with its process id.
+//Every client present gets the same input block, read in place, and writes its output to a block
+//of its own after the rings, AudioXtreamer mixes them. A client alone writes straight into the
+//output ring. The Stream offsets count from the start of the shared memory.
+//Stream.Flags: 0x1 alive, set by the driver with every answer, 0x2 the rate changed,
+//0x4 a latency probe result in Stream.RoundTrip, 0x8 the driver stopped
+static const uint32_t scMaxClients = 4;
+typedef struct _ClientSlot
+{
+  ASIOSettings::StreamInfo Stream;
+  volatile uint32_t Owner;    //process id of the driver, 0 if the slot is free
+  volatile uint32_t OutMask;  //the outputs the client writes, one bit per channel, the others aren't mixed
+  volatile uint32_t Block;    //bumped by AudioXtreamer for every block handed to the slot
+  volatile uint32_t Done;     //set to Block by the driver once the block's output is written
+  volatile uint32_t Late;     //blocks mixed without the client, it didn't answer within the period
+  WakeWord ToClient;          //with the slot's event, SlotEventName
+} ClientSlot;
+
+static const uint32_t scClientSlotOffset = 1024;
+static_assert(sizeof(ClientSlot) == 64, "a cache line per client");
+static_assert(scTelemetryOffset + sizeof(Telemetry) <= scClientSlotOffset, "Telemetry runs into the ClientSlots");
+static_assert(scClientSlotOffset + scMaxClients * sizeof(ClientSlot) <= scLayoutHeaderSize, "the ClientSlots run out of the first block");
+
+//the block a slot's client writes its output to
+inline uint32_t SlotTxOffset(const SharedLayout& layout, uint32_t slot) { return layout.SlotTxOffset + slot * layout.SlotTxSize; }
+
+//the auto reset event a slot's client waits on for its blocks
+void SlotEventName(uint32_t slot, TCHAR* name, size_t size);
+
+static_assert(ASIOSettings::MaxChannels * 3 <= scMaxRxStride, "an rx frame doesn't fit the RxFramer");
+
 class UsbDeviceClient
 {
 public:
-  virtual bool Switch(uint32_t timeout, uint32_t rxSampleSize, uint8_t *rxBuff, uint32_t txSampleSize, uint8_t *txBuff) = 0;
-  virtual void AllocBuffers(uint32_t rxSize, uint8_t *&rxBuff, uint32_t txSize, uint8_t *&txBuff) = 0;
+  //frames: the block size, rxBuff/txBuff: the first frame of the block in and out
+  virtual bool Switch(uint32_t frames, uint32_t rxSampleSize, uint8_t *rxBuff, uint32_t txSampleSize, uint8_t *txBuff) = 0;
+  //polled by the device after a Switch without a switch event of its own, true once the client is done with the block
+  virtual bool SwitchComplete() { return true; }
+  //while SwitchComplete is false, ms until it is worth polling again without a wake, INFINITE if only an answer ends it
+  virtual uint32_t SwitchWaitMs() { return INFINITE; }
+  //the outputs the client writes, one bit per channel
+  virtual uint32_t OutputMask() { return 0xFFFFFFFF; }
+  //the rings, and for AudioXtreamer the largest block a client writes to its own tx block. False and both
+  //null if they could not be had
+  virtual bool AllocBuffers(uint32_t rxSize, uint8_t *&rxBuff, uint32_t txSize, uint8_t *&txBuff, uint32_t slotTxSize) = 0;
   virtual void FreeBuffers(uint8_t *&rxBuff, uint8_t *&txBuff) = 0;
   virtual void SampleRateChanged() = 0;
   virtual void DeviceStopped(bool error) = 0;
   virtual HANDLE GetSwitchHandle() { return NULL; };
+  //the wake word going with it, nullptr if the event alone tells
+  virtual WakeWord* SwitchWake() { return nullptr; }
   virtual bool ClientPresent() { return true; }
+  //frames the client takes per Switch, 0 to follow the device's NrSamples
+  virtual uint32_t BlockFrames() { return 0; }
+  //before every Switch, QPC time in ns the input of the block was complete, 0 if not known yet.
+  //It goes with the sample position right after the block, as the asio sample position does
+  virtual void SetBlockTime(uint64_t ns) {}
+  //the latency probe found the round trip from the client's output to its input, in frames
+  virtual void LatencyMeasured(uint32_t roundTrip) {}
+  //the shared driver load and device telemetry, nullptr if there is no shared memory
+  virtual DriverLoad* LoadBlock() { return nullptr; }
+  virtual Telemetry* TelemetryBlock() { return nullptr; }
 };
 
 
@@ -40,6 +273,11 @@ public:
   virtual bool GetStatus(UsbDeviceStatus &status) = 0;
   virtual uint32_t GetSampleRate() = 0;
   virtual bool ConfigureDevice() = 0;
+  //plays an impulse on output 1 of the client's blocks and finds it on input 1, false if the device can't
+  virtual bool MeasureLatency() { return false; }
+  //the shared driver load and telemetry as mapped by the device, nullptr if it has no shared memory
+  virtual DriverLoad* LoadBlock() { return nullptr; }
+  virtual Telemetry* TelemetryBlock() { return nullptr; }
 
 protected:
   UsbDevice(UsbDeviceClient & client, ASIOSettings::Settings & params)
@@ -0,0 +1,694 @@
+#include "stdafx.h"
+#include "VirtualFpga.h"
+
+#ifdef USB_BACKEND_VIRTUAL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <process.h>
+#include <deque>
+#include <vector>
+#include <random>
+#include <timeapi.h>
+#pragma comment (lib, "winmm.lib")
+
+#include "UsbBackend.h"
+#include "UsbDev\UsbDev.h"
+#include "UsbDev\StreamFormat.h"
+
+static const uint8_t scOutEP = 0x02;
+static const uint8_t scInEP = 0x86;
+static const uint32_t scMicroframes = 8000;
+static const uint32_t scPktSize = 1024;
+//input frames the fpga keeps while the host sends no IN token, the adc drops the ones that do not fit
+static const uint32_t scInFifoFrames = 512;
+static const uint32_t scMaxFifoDepth = 256;
+static const uint32_t scMaxFrameSize = ASIOSettings::MaxChannels * 3;
+static const uint32_t scMaxLoopDelay = 4096;
+//a stalled stream thread catches up a second at most
+static const uint32_t scMaxCatchUp = scMicroframes;
+//midi packet MidiIO::MidiOut may put in front of the tx frames
+static const uint32_t scMidiOutSize = 30;
+static const uint8_t scMidiOutMark[4] = { 0x96, 0x69, 0x69, 0x96 };
+
+struct vfpga_iso_info
+{
+  uint8_t* alloc;
+  uint32_t pktCount;
+  uint32_t pktSize;
+  IsoReqResult* results;
+  //the packet the device is on
+  uint32_t pkt;
+  //OUT: the frames in the buffer and how many of them went to the fifo so far
+  uint32_t txStart;
+  uint32_t txFrames;
+  uint32_t txPushed;
+  //QPC time the completion is signalled
+  int64_t due;
+  //packets results holds, it outlives the request in the pool
+  uint32_t capacity;
+
+  bool Reserve(size_t count)
+  {
+    if (count <= capacity)
+      return true;
+    Free();
+    results = new (std::nothrow) IsoReqResult[count];
+    capacity = results != nullptr ? (uint32_t)count : 0;
+    return results != nullptr;
+  }
+
+  void Free()
+  {
+    delete[] results;
+    results = nullptr;
+    capacity = 0;
+  }
+};
+
+static XferPool<vfpga_iso_info> sXferPool;
+
+//---------------------------------------------------------------------------------------------
+
+class VirtualFpga
+{
+public:
+  explicit VirtualFpga(const VirtualFpgaConfig& config);
+  ~VirtualFpga();
+
+  int64_t Control(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength);
+  bool Submit(XferReq* req);
+  bool Abort(uint8_t ep);
+  //drops a request about to be freed from wherever the device still has it
+  void Forget(XferReq* req);
+
+private:
+  static unsigned __stdcall StaticThread(void* arg) { ((VirtualFpga*)arg)->main(); return 0; }
+  void main();
+
+  void Microframe(uint64_t microframe, int64_t now);
+  void OutPacket(XferReq* req, int64_t now);
+  void InPacket(XferReq* req, int64_t now);
+  void Finish(std::deque<XferReq*>& queue, int64_t& lastDue, int64_t now);
+  void Signal(int64_t now, bool all);
+  bool Lost();
+
+  void Configure(uint32_t chParams);
+  void ResetFifos();
+  void GenerateFrame(uint8_t* dst);
+  const uint8_t* LoopFrame(const uint8_t* dac, uint32_t size);
+
+  VirtualFpgaConfig mConfig;
+  CRITICAL_SECTION mLock;
+  HANDLE mExitHandle;
+  HANDLE mThread;
+  std::mt19937 mRand;
+
+  bool mConfigured;
+  uint32_t mRegs[256];
+
+  //from reg 4
+  uint32_t mInStride;
+  uint32_t mOutStride;  //a tx frame with its sync word
+  uint32_t mFifoDepth;
+
+  //the sample clock, frames produced by the end of each microframe since the start
+  LARGE_INTEGER mQpcFreq;
+  int64_t mStart;
+  uint64_t mMicroframe;
+  double mFramesPerMicroframe;
+  uint64_t mClockFrames;
+
+  std::deque<XferReq*> mInQueue;
+  std::deque<XferReq*> mOutQueue;
+  std::vector<XferReq*> mDone;
+  int64_t mInDue;
+  int64_t mOutDue;
+
+  //input fifo, frames the adc wrote and no IN packet took yet, and the test signal
+  uint8_t mInFifo[scInFifoFrames * scMaxFrameSize];
+  uint32_t mInRead;
+  uint32_t mInLevel;
+  uint32_t mSinePos;
+  int32_t mSine[48];
+
+  //loopback, the last LoopbackDelay + 1 frames the dac played, mLoopPos the newest
+  std::vector<uint8_t> mLoopLine;
+  uint32_t mLoopLength;
+  uint32_t mLoopPos;
+
+  //output fifo, the samples of each frame without the sync word
+  uint8_t mOutFifo[scMaxFifoDepth * ASIOSettings::MaxChannels * 3];
+  uint32_t mOutRead;
+  uint32_t mOutLevel;
+  bool mOutRunning;
+  uint16_t mOutSkip;
+  uint16_t mInFull;
+};
+
+VirtualFpga::VirtualFpga(const VirtualFpgaConfig& config)
+  : mConfig(config)
+  , mRand(0x58545245)
+  , mConfigured(false)
+  , mMicroframe(0)
+  , mClockFrames(0)
+  , mInDue(0)
+  , mOutDue(0)
+  , mSinePos(0)
+  , mLoopLength(0)
+  , mLoopPos(0)
+{
+  InitializeCriticalSection(&mLock);
+
+  if (mConfig.Loopback) {
+    mLoopLength = min(mConfig.LoopbackDelay, scMaxLoopDelay) + 1;
+    mLoopLine.resize(mLoopLength * scMaxFrameSize);
+  }
+
+  const double rate = mConfig.SampleRate * (1.0 + mConfig.ClockPpm * 1e-6);
+  mFramesPerMicroframe = rate / scMicroframes;
+
+  ZeroMemory(mRegs, sizeof(mRegs));
+  memcpy(&mRegs[0], "TRTG", 4);
+  mRegs[1] = 1;
+  //counted in 10Hz steps, what ConvertSampleRate expects
+  mRegs[2] = (uint32_t)(rate / 10 + 0.5);
+
+  //1kHz at 48k, -6dB
+  for (uint32_t i = 0; i < 48; i++)
+    mSine[i] = (int32_t)(sin(2 * 3.14159265358979 * i / 48) * 0x3FFFFF);
+
+  Configure(0);
+
+  QueryPerformanceFrequency(&mQpcFreq);
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  mStart = now.QuadPart;
+
+  mExitHandle = CreateEvent(NULL, TRUE, FALSE, NULL);
+  mThread = (HANDLE)_beginthreadex(NULL, 0, StaticThread, this, 0, NULL);
+  if (mThread != NULL)
+    ::SetThreadPriority(mThread, THREAD_PRIORITY_TIME_CRITICAL);
+
+  LOGN("VirtualFpga %u Hz %+d ppm, jitter %u us, loss %u ppm\n", mConfig.SampleRate, mConfig.ClockPpm, mConfig.JitterUs, mConfig.LossPpm);
+  if (mConfig.Loopback)
+    LOGN("VirtualFpga loopback, %u frames dac to adc\n", mLoopLength - 1);
+}
+
+VirtualFpga::~VirtualFpga()
+{
+  SetEvent(mExitHandle);
+  if (mThread != NULL) {
+    WaitForSingleObject(mThread, INFINITE);
+    CloseHandle(mThread);
+  }
+  CloseHandle(mExitHandle);
+
+  Abort(scInEP);
+  Abort(scOutEP);
+  DeleteCriticalSection(&mLock);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void VirtualFpga::main()
+{
+  LOG0("VirtualFpga::main");
+  timeBeginPeriod(1);
+
+  while (WaitForSingleObject(mExitHandle, 1) == WAIT_TIMEOUT)
+  {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    const uint64_t target = (uint64_t)((now.QuadPart - mStart) * scMicroframes / mQpcFreq.QuadPart);
+
+    EnterCriticalSection(&mLock);
+    if (target - mMicroframe > scMaxCatchUp)
+      mMicroframe = target - scMaxCatchUp;
+    while (mMicroframe < target)
+      Microframe(mMicroframe++, now.QuadPart);
+    Signal(now.QuadPart, false);
+    LeaveCriticalSection(&mLock);
+  }
+
+  timeEndPeriod(1);
+  LOG0("VirtualFpga::main Exit");
+}
+
+void VirtualFpga::Microframe(uint64_t microframe, int64_t now)
+{
+  const uint64_t clockFrames = (uint64_t)((microframe + 1) * mFramesPerMicroframe);
+  const uint32_t frames = (uint32_t)(clockFrames - mClockFrames);
+  mClockFrames = clockFrames;
+
+  const uint32_t outSize = mOutStride - scTxHeaderSize;
+
+  for (uint32_t i = 0; i < frames; i++) {
+    //the dac reads a frame every clock once the first frames came in, a read of an empty fifo is a skip.
+    //The counters stop at 0xFFFF like the fpga ones
+    const uint8_t* dac = nullptr;
+    if (mOutRunning) {
+      if (mOutLevel > 0) {
+        dac = mOutFifo + mOutRead * outSize;
+        mOutRead = (mOutRead + 1) % mFifoDepth;
+        mOutLevel--;
+      }
+      else if (mOutSkip < 0xFFFF)
+        mOutSkip++;
+    }
+
+    //the adc writes a frame every clock, a write to a full fifo is lost and counted
+    if (mInLevel == scInFifoFrames) {
+      if (mInFull < 0xFFFF)
+        mInFull++;
+      if (mConfig.Loopback)
+        LoopFrame(dac, outSize);
+      continue;
+    }
+
+    uint8_t* adc = mInFifo + ((mInRead + mInLevel) % scInFifoFrames) * scMaxFrameSize;
+    if (mConfig.Loopback)
+      memcpy(adc, LoopFrame(dac, outSize), mInStride);
+    else
+      GenerateFrame(adc);
+    mInLevel++;
+  }
+
+  //one packet each way per microframe
+  if (!mOutQueue.empty())
+    OutPacket(mOutQueue.front(), now);
+  if (!mInQueue.empty())
+    InPacket(mInQueue.front(), now);
+}
+
+void VirtualFpga::OutPacket(XferReq* req, int64_t now)
+{
+  vfpga_iso_info* ctx = (vfpga_iso_info*)req->ctx;
+  const uint32_t size = ctx->pktCount * ctx->pktSize;
+
+  //TxIsochCB fills the request as one stream: midi, frames, zeros. Find the frames once
+  if (ctx->pkt == 0) {
+    uint32_t pos = 0;
+    if (size >= scMidiOutSize && memcmp(req->buff, scMidiOutMark, sizeof(scMidiOutMark)) == 0)
+      pos = scMidiOutSize;
+    ctx->txStart = pos;
+    ctx->txFrames = 0;
+    ctx->txPushed = 0;
+    while (pos + mOutStride <= size && memcmp(req->buff + pos, &scTxHeaderMark, scTxHeaderSize) == 0) {
+      ctx->txFrames++;
+      pos += mOutStride;
+    }
+  }
+
+  //the frames that are complete with this packet
+  const uint32_t end = (ctx->pkt + 1) * ctx->pktSize;
+  const uint32_t ready = end > ctx->txStart ? min(ctx->txFrames, (end - ctx->txStart) / mOutStride) : 0;
+  const uint32_t frameSize = mOutStride - scTxHeaderSize;
+  const bool lost = Lost();
+
+  for (; ctx->txPushed < ready; ctx->txPushed++) {
+    if (lost)
+      continue;
+    //the fpga stalls the fx2 fifo rather than dropping, with iso packets coming on regardless the frames are lost there, uncounted
+    if (mOutLevel == mFifoDepth)
+      continue;
+    const uint8_t* src = req->buff + ctx->txStart + ctx->txPushed * mOutStride + scTxHeaderSize;
+    memcpy(mOutFifo + ((mOutRead + mOutLevel) % mFifoDepth) * frameSize, src, frameSize);
+    mOutLevel++;
+    mOutRunning = true;
+  }
+
+  IsoReqResult& result = ctx->results[ctx->pkt];
+  result.length = lost ? 0 : ctx->pktSize;
+  result.status = lost ? USBD_STATUS_ISO_NOT_ACCESSED_BY_HW : USBD_STATUS_SUCCESS;
+
+  if (++ctx->pkt == ctx->pktCount)
+    Finish(mOutQueue, mOutDue, now);
+}
+
+void VirtualFpga::InPacket(XferReq* req, int64_t now)
+{
+  vfpga_iso_info* ctx = (vfpga_iso_info*)req->ctx;
+  uint8_t* ptr = req->buff + ctx->pkt * ctx->pktSize;
+
+  RxHeader* hdr = (RxHeader*)ptr;
+  hdr->Hdr1 = 0xaaaa;
+  hdr->Hdr2 = 0x5555;
+  hdr->SamplingRate = (uint16_t)mRegs[2];
+  hdr->FifoLevel = (uint16_t)mOutLevel;
+  hdr->OutSkipCount = mOutSkip;
+  hdr->InFullCount = mInFull;
+  ZeroMemory(hdr->midi_in, sizeof(hdr->midi_in));
+  ptr += sizeof(RxHeader);
+
+  //whole frames, as many as wait and fit
+  const uint32_t frames = min(mInLevel, (ctx->pktSize - (uint32_t)sizeof(RxHeader)) / mInStride);
+  for (uint32_t i = 0; i < frames; i++, ptr += mInStride) {
+    memcpy(ptr, mInFifo + mInRead * scMaxFrameSize, mInStride);
+    mInRead = (mInRead + 1) % scInFifoFrames;
+  }
+  mInLevel -= frames;
+
+  //a lost packet takes its frames with it
+  IsoReqResult& result = ctx->results[ctx->pkt];
+  const bool lost = Lost();
+  result.length = lost ? 0 : sizeof(RxHeader) + frames * mInStride;
+  result.status = lost ? USBD_STATUS_ISO_NOT_ACCESSED_BY_HW : USBD_STATUS_SUCCESS;
+
+  if (++ctx->pkt == ctx->pktCount)
+    Finish(mInQueue, mInDue, now);
+}
+
+//the request at the head of the queue is through, it completes after the injected jitter, in order
+void VirtualFpga::Finish(std::deque<XferReq*>& queue, int64_t& lastDue, int64_t now)
+{
+  XferReq* req = queue.front();
+  queue.pop_front();
+
+  vfpga_iso_info* ctx = (vfpga_iso_info*)req->ctx;
+  int64_t due = now;
+  if (mConfig.JitterUs > 0)
+    due += (int64_t)(mRand() % (mConfig.JitterUs + 1)) * mQpcFreq.QuadPart / 1000000;
+  ctx->due = max(due, lastDue);
+  lastDue = ctx->due;
+
+  mDone.push_back(req);
+}
+
+void VirtualFpga::Signal(int64_t now, bool all)
+{
+  for (auto it = mDone.begin(); it != mDone.end();) {
+    if (all || ((vfpga_iso_info*)(*it)->ctx)->due <= now) {
+      SetEvent((*it)->ovlp.hEvent);
+      it = mDone.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+bool VirtualFpga::Lost()
+{
+  return mConfig.LossPpm > 0 && (mRand() % 1000000) < mConfig.LossPpm;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void VirtualFpga::Configure(uint32_t chParams)
+{
+  mRegs[4] = chParams;
+  mOutStride = scTxHeaderSize + ((chParams & 0xF) + 1) * 2 * 3;
+  mInStride = (((chParams >> 4) & 0xF) + 1) * 2 * 3;
+  mFifoDepth = max(1u, (chParams >> 16) & 0xFF);
+  ResetFifos();
+}
+
+void VirtualFpga::ResetFifos()
+{
+  mInRead = 0;
+  mInLevel = 0;
+  mOutRead = 0;
+  mOutLevel = 0;
+  mOutRunning = false;
+  mOutSkip = 0;
+  mInFull = 0;
+
+  mLoopPos = 0;
+  if (!mLoopLine.empty())
+    ZeroMemory(mLoopLine.data(), mLoopLine.size());
+}
+
+void VirtualFpga::GenerateFrame(uint8_t* dst)
+{
+  const int32_t v = mSine[mSinePos];
+  mSinePos = (mSinePos + 1) % 48;
+  for (uint32_t c = 0; c < mInStride; c += 3) {
+    dst[c] = (uint8_t)v;
+    dst[c + 1] = (uint8_t)(v >> 8);
+    dst[c + 2] = (uint8_t)(v >> 16);
+  }
+}
+
+//the frame the dac played goes in the line, silence on a skip or before the start, out comes the one
+//LoopbackDelay frames older. Slots are zero past the outputs, inputs beyond them read silence
+const uint8_t* VirtualFpga::LoopFrame(const uint8_t* dac, uint32_t size)
+{
+  uint8_t* slot = &mLoopLine[mLoopPos * scMaxFrameSize];
+  if (dac != nullptr)
+    memcpy(slot, dac, size);
+  else
+    ZeroMemory(slot, size);
+  ZeroMemory(slot + size, scMaxFrameSize - size);
+
+  mLoopPos = (mLoopPos + 1) % mLoopLength;
+  return &mLoopLine[mLoopPos * scMaxFrameSize];
+}
+
+//---------------------------------------------------------------------------------------------
+
+int64_t VirtualFpga::Control(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength)
+{
+  int64_t result = -1;
+  EnterCriticalSection(&mLock);
+
+  if (bmRequestType == 0xc0 && data != nullptr) {
+    switch (bRequest) {
+    case 0x3b: //ztex configuration data
+      if (wLength >= 8) {
+        ZeroMemory(data, wLength);
+        memcpy(data, "CD0", 3);
+        data[3] = 2;    //fx2
+        data[4] = 255;  //unknown board
+        data[5] = 255;
+        result = wLength;
+      }
+      break;
+    case 0x64: //default interface: version, out and in endpoints
+      if (wLength >= 4) {
+        data[0] = 1;
+        data[1] = scOutEP;
+        data[2] = scInEP & 0x7f;
+        data[3] = 0;
+        result = 4;
+      }
+      break;
+    case 0x30: //fpga state, 0 is configured
+      if (wLength >= 1) {
+        ZeroMemory(data, wLength);
+        data[0] = mConfigured ? 0 : 1;
+        result = wLength;
+      }
+      break;
+    case 0x61: //gpio
+      ZeroMemory(data, wLength);
+      result = wLength;
+      break;
+    case 0x63: //lsi read
+      for (uint16_t i = 0; i < wLength / 4; i++) {
+        const uint32_t val = mRegs[(wIndex + i) & 0xff];
+        data[i * 4] = (uint8_t)val;
+        data[i * 4 + 1] = (uint8_t)(val >> 8);
+        data[i * 4 + 2] = (uint8_t)(val >> 16);
+        data[i * 4 + 3] = (uint8_t)(val >> 24);
+      }
+      result = (wLength / 4) * 4;
+      break;
+    }
+  }
+  else if (bmRequestType == 0x40) {
+    switch (bRequest) {
+    case 0x31: //fpga reset, a bitstream follows
+      mConfigured = false;
+      result = 0;
+      break;
+    case 0x32: //bitstream chunk
+      mConfigured = true;
+      result = wLength;
+      break;
+    case 0x60: //reset signal
+    case 0x70: //init fifos
+      ResetFifos();
+      result = 0;
+      break;
+    case 0x62: //lsi write, 4 bytes of value and the address each
+      for (uint16_t i = 0; data != nullptr && i + 5 <= wLength; i += 5) {
+        const uint32_t val = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | (data[i + 3] << 24);
+        const uint8_t addr = data[i + 4];
+        if (addr == 4)
+          Configure(val);
+        else if (addr != 0 && addr != 2)
+          mRegs[addr] = val;
+      }
+      result = wLength;
+      break;
+    }
+  }
+
+  LeaveCriticalSection(&mLock);
+  return result;
+}
+
+bool VirtualFpga::Submit(XferReq* req)
+{
+  vfpga_iso_info* ctx = (vfpga_iso_info*)req->ctx;
+  if (ctx == nullptr)
+    return false;
+
+  EnterCriticalSection(&mLock);
+  ctx->pkt = 0;
+  if (req->endpoint & 0x80)
+    mInQueue.push_back(req);
+  else
+    mOutQueue.push_back(req);
+  LeaveCriticalSection(&mLock);
+  return true;
+}
+
+bool VirtualFpga::Abort(uint8_t ep)
+{
+  EnterCriticalSection(&mLock);
+  std::deque<XferReq*>& queue = (ep & 0x80) ? mInQueue : mOutQueue;
+  for (XferReq* req : queue) {
+    vfpga_iso_info* ctx = (vfpga_iso_info*)req->ctx;
+    for (uint32_t i = ctx->pkt; i < ctx->pktCount; i++) {
+      ctx->results[i].length = 0;
+      ctx->results[i].status = USBD_STATUS_CANCELED;
+    }
+    SetEvent(req->ovlp.hEvent);
+  }
+  queue.clear();
+  Signal(0, true);
+  LeaveCriticalSection(&mLock);
+  return true;
+}
+
+void VirtualFpga::Forget(XferReq* req)
+{
+  EnterCriticalSection(&mLock);
+  for (std::deque<XferReq*>* queue : { &mInQueue, &mOutQueue }) {
+    for (auto it = queue->begin(); it != queue->end();)
+      it = *it == req ? queue->erase(it) : it + 1;
+  }
+  for (auto it = mDone.begin(); it != mDone.end();)
+    it = *it == req ? mDone.erase(it) : it + 1;
+  LeaveCriticalSection(&mLock);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static VirtualFpgaConfig sConfig = { 48000, 0, 0, 0, false, 0 };
+
+void vfpga_configure(const VirtualFpgaConfig& config)
+{
+  sConfig = config;
+}
+
+bool vfpga_open(HANDLE& dev, HANDLE& file)
+{
+  VirtualFpgaConfig config = sConfig;
+  char env[64];
+  size_t len = 0;
+  if (getenv_s(&len, env, sizeof(env), "AUDIOXTREAMER_VFPGA") == 0 && len > 0) {
+    if (sscanf(env, "%u,%d,%u,%u,%u", &config.SampleRate, &config.ClockPpm, &config.JitterUs, &config.LossPpm, &config.LoopbackDelay) == 5)
+      config.Loopback = true;
+  }
+  if (config.SampleRate == 0)
+    return false;
+
+  dev = (HANDLE)new VirtualFpga(config);
+  file = INVALID_HANDLE_VALUE;
+  return true;
+}
+
+bool vfpga_close(HANDLE& dev, HANDLE& file)
+{
+  delete (VirtualFpga*)dev;
+  dev = INVALID_HANDLE_VALUE;
+  return true;
+}
+
+int64_t vfpga_control_transfer(HANDLE handle, uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+  unsigned char* data, uint16_t wLength, unsigned int timeout)
+{
+  return ((VirtualFpga*)handle)->Control(bmRequestType, bRequest, wValue, wIndex, data, wLength);
+}
+
+bool vfpga_init_xfer(HANDLE handle, XferReq* req, const size_t pktCount, const size_t pktSize)
+{
+  if (pktCount == 0 || pktSize == 0)
+    return false;
+
+  vfpga_iso_info* ctx = sXferPool.Take();
+  if (ctx == nullptr)
+    return false;
+  if (!ctx->Reserve(pktCount)) {
+    sXferPool.Give(ctx);
+    return false;
+  }
+  ctx->alloc = nullptr;
+  ctx->pkt = ctx->txStart = ctx->txFrames = ctx->txPushed = 0;
+  ctx->due = 0;
+  ctx->pktCount = (uint32_t)pktCount;
+  ctx->pktSize = (uint32_t)pktSize;
+  if (req->buff == nullptr)
+    req->buff = ctx->alloc = (uint8_t*)_aligned_malloc(pktCount * pktSize, 4096);
+  ZeroMemory(ctx->results, pktCount * sizeof(IsoReqResult));
+
+  req->ctx = ctx;
+  memset(req->buff, 0xff, pktCount * pktSize);
+  return true;
+}
+
+bool vfpga_iso_submit(XferReq* req)
+{
+  return ((VirtualFpga*)req->handle)->Submit(req);
+}
+
+IsoReqResult vfpga_iso_result(XferReq* req, uint32_t idx)
+{
+  return ((vfpga_iso_info*)req->ctx)->results[idx];
+}
+
+bool vfpga_iso_cleanup(XferReq* req)
+{
+  vfpga_iso_info* ctx = (vfpga_iso_info*)req->ctx;
+  if (ctx) {
+    ((VirtualFpga*)req->handle)->Forget(req);
+    if (ctx->alloc != nullptr) {
+      _aligned_free(ctx->alloc);
+      req->buff = nullptr;
+    }
+    sXferPool.Give(ctx);
+    req->ctx = nullptr;
+  }
+  return true;
+}
+
+bool vfpga_abort_pipe(HANDLE handle, uint8_t ep)
+{
+  return ((VirtualFpga*)handle)->Abort(ep);
+}
+
+bool vfpga_iso_limits(HANDLE handle, uint8_t ep, IsoLimits* limits)
+{
+  limits->pktMultiple = 8;
+  limits->maxPkts = 1024;
+  limits->pktSize = scPktSize;
+  return true;
+}
+
+
+const USB_BKND_OPEN_CLOSE bknd_open = vfpga_open;
+const USB_BKND_OPEN_CLOSE bknd_close = vfpga_close;
+const USB_BACKEND_CTRL_XFER control_transfer        = vfpga_control_transfer;
+const USB_BACKEND_INIT_ISO_PRIV bknd_init_read_xfer = vfpga_init_xfer;
+const USB_BACKEND_INIT_ISO_PRIV bknd_init_write_xfer = vfpga_init_xfer;
+const USB_BACKEND_XFER bknd_iso_read            = vfpga_iso_submit;
+const USB_BACKEND_XFER bknd_iso_write           = vfpga_iso_submit;
+const USB_BACKEND_ISO_GET_RESULT bknd_iso_get_result= vfpga_iso_result;
+const USB_BACKEND_XFER bknd_xfer_cleanup = vfpga_iso_cleanup;
+const USB_BACKEND_ABORT bknd_abort_pipe = vfpga_abort_pipe;
+const USB_BACKEND_ISO_LIMITS bknd_iso_limits = vfpga_iso_limits;
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+
+/*A software FX2LP and fpga behind the bknd_* table, the streaming code runs without a board
+
+  Built in place of the WinUSB backend when USB_BACKEND_VIRTUAL is defined for the project.
+  It answers the ztex vendor requests of ztexdev and CypressDevice::Open and the lsi registers
+  (0 the TRTG cookie, 2 the sample rate count, 4 the channel params written by main).
+  The stream runs on its own thread in 125us microframes against QPC, as the fpga does:
+  - the sample clock produces input frames, iso IN packets take them behind an RxHeader,
+  - iso OUT packets fill the output fifo the sample clock drains. Its level, the dac reads of an
+    empty fifo (OutSkipCount) and the adc writes to a full input fifo (InFullCount) go out in every
+    header, as usb2iis_top counts them.
+  In loopback the adc samples what the dac played a fixed number of frames earlier instead of the
+  test tone, output channel n comes back on input n. A frame out of TxIsochCB shows up in RxIsochCB
+  after the output fifo, the delay and the input fifo, the round trip a real cable would measure.
+  Requests complete when their last packet is through, optionally late and with lost packets,
+  to soak the rx/tx paths and the jitter control.
+*/
+typedef struct _VirtualFpgaConfig
+{
+  uint32_t SampleRate;  //nominal rate of the sample clock
+  int32_t ClockPpm;     //its offset against QPC
+  uint32_t JitterUs;    //most delay added to a request completion, the order is kept
+  uint32_t LossPpm;     //iso packets lost per million, either direction
+  bool Loopback;        //dac to adc instead of the test tone
+  uint32_t LoopbackDelay; //frames from the dac to the adc, up to 4096
+} VirtualFpgaConfig;
+
+//takes effect on the next bknd_open. Defaults to 48k with a perfect clock, the environment
+//variable AUDIOXTREAMER_VFPGA="rate,ppm,jitterUs,lossPpm[,loopbackDelay]" overrides it, the
+//delay turns the loopback on
+void vfpga_configure(const VirtualFpgaConfig& config);
@@ -331,28 +331,58 @@ struct winusb_iso_info
   WINUSB_ISOCH_BUFFER_HANDLE isoBuffHandle;
   USBD_ISO_PACKET_DESCRIPTOR* pkts;
   USBD_ISO_PACKET_DESCRIPTOR* results;
+  uint32_t capacity;  //packets the arrays hold, they outlive the request in the pool
   uint8_t* alloc;
   uint32_t pktCount;
   uint32_t pktSize;
+
+  bool Reserve(size_t count)
+  {
+    if (count <= capacity)
+      return true;
+    Free();
+    pkts = new (std::nothrow) USBD_ISO_PACKET_DESCRIPTOR[count];
+    results = new (std::nothrow) USBD_ISO_PACKET_DESCRIPTOR[count];
+    if (pkts == nullptr || results == nullptr) {
+      Free();
+      return false;
+    }
+    capacity = (uint32_t)count;
+    return true;
+  }
+
+  void Free()
+  {
+    delete[] pkts;
+    delete[] results;
+    pkts = results = nullptr;
+    capacity = 0;
+  }
 };
 
+static XferPool<winusb_iso_info> sXferPool;
+
 
 bool winusb_init_xfer(HANDLE handle, XferReq* req, const size_t pktCount, const size_t pktSize)
 {
-  struct winusb_iso_info* bknd_spec = new struct winusb_iso_info;
+  struct winusb_iso_info* bknd_spec = sXferPool.Take();
   if (nullptr != bknd_spec) {
-    ZeroMemory(bknd_spec, sizeof(struct winusb_iso_info));
+    bknd_spec->isoBuffHandle = NULL;
+    bknd_spec->alloc = nullptr;
+    bknd_spec->pktCount = bknd_spec->pktSize = 0;
     req->ctx = bknd_spec;
     if (pktCount > 0 && pktSize > 0) {
-      bknd_spec->alloc = (uint8_t*)_aligned_malloc(pktCount * pktSize, 4096);
-      req->buff = bknd_spec->alloc;
+      if (!bknd_spec->Reserve(pktCount)) {
+        sXferPool.Give(bknd_spec);
+        req->ctx = nullptr;
+        return false;
+      }
+      if (req->buff == nullptr)
+        req->buff = bknd_spec->alloc = (uint8_t*)_aligned_malloc(pktCount * pktSize, 4096);
       memset(req->buff, 0xff, pktCount * pktSize);
 
       bknd_spec->pktCount = (uint32_t)pktCount;
       bknd_spec->pktSize = (uint32_t)pktSize;
-
-      bknd_spec->pkts = new USBD_ISO_PACKET_DESCRIPTOR[pktCount];
-      bknd_spec->results = new USBD_ISO_PACKET_DESCRIPTOR[pktCount];
     }
     BOOL res = WinUsb_RegisterIsochBuffer(handle, req->endpoint, (PUCHAR)req->buff, (ULONG)(pktCount * pktSize), &bknd_spec->isoBuffHandle);
     return (TRUE == res) ? true : false;
@@ -404,17 +434,16 @@ bool winusb_iso_cleanup(XferReq* req)
   struct winusb_iso_info* ctx = (struct winusb_iso_info*)req->ctx;
   if (ctx)
   {
-    WinUsb_UnregisterIsochBuffer(ctx->isoBuffHandle);
+    if (ctx->isoBuffHandle != NULL)
+      WinUsb_UnregisterIsochBuffer(ctx->isoBuffHandle);
     if (ctx->alloc) {
       _aligned_free(ctx->alloc);
       req->buff = nullptr;
     }
-    if (ctx->pkts)
-      delete ctx->pkts;
-    if (ctx->results)
-      delete ctx->results;
 
-    delete req->ctx;
+    //the packet arrays stay with the context for the next start
+    sXferPool.Give(ctx);
+    req->ctx = nullptr;
   }
 
   return true;
@@ -425,7 +454,33 @@ bool winusb_abort_pipe(HANDLE handle, uint8_t ep )
   return WinUsb_AbortPipe((WINUSB_INTERFACE_HANDLE)handle, ep);
 }
 
+bool winusb_iso_limits(HANDLE handle, uint8_t ep, IsoLimits* limits)
+{
+  USB_INTERFACE_DESCRIPTOR ifDesc;
+  if (!WinUsb_QueryInterfaceSettings(handle, 0, &ifDesc))
+    return false;
+
+  UCHAR speed = 0;
+  ULONG len = sizeof(speed);
+  if (!WinUsb_QueryDeviceInformation(handle, DEVICE_SPEED, &len, &speed))
+    return false;
+
+  for (UCHAR i = 0; i < ifDesc.bNumEndpoints; ++i) {
+    WINUSB_PIPE_INFORMATION_EX pipe;
+    if (WinUsb_QueryPipeEx(handle, 0, i, &pipe) && pipe.PipeId == ep) {
+      //high speed intervals are in microframes and a request has to cover whole frames
+      const uint32_t interval = pipe.Interval ? pipe.Interval : 1;
+      limits->pktMultiple = speed == HighSpeed ? max(1u, 8u / interval) : 1;
+      limits->maxPkts = speed == HighSpeed ? 1024 : 255;
+      limits->pktSize = pipe.MaximumBytesPerInterval;
+      return limits->pktSize > 0;
+    }
+  }
+  return false;
+}
 
+//USB_BACKEND_VIRTUAL builds against the software fpga in VirtualFpga instead
+#ifndef USB_BACKEND_VIRTUAL
 const USB_BKND_OPEN_CLOSE bknd_open = winusb_open;
 const USB_BKND_OPEN_CLOSE bknd_close = winusb_close;
 const USB_BACKEND_CTRL_XFER control_transfer        = winusb_control_transfer;
@@ -436,4 +491,6 @@ const USB_BACKEND_XFER bknd_iso_write           = winusb_iso_write;
 const USB_BACKEND_ISO_GET_RESULT bknd_iso_get_result= winusb_iso_result;
 const USB_BACKEND_XFER bknd_xfer_cleanup = winusb_iso_cleanup;
 const USB_BACKEND_ABORT bknd_abort_pipe = winusb_abort_pipe;
+const USB_BACKEND_ISO_LIMITS bknd_iso_limits = winusb_iso_limits;
+#endif
 
@@ -262,7 +262,8 @@ int ztex_default_lsi_set2(HANDLE handle, uint8_t addr, const uint32_t *val, int
   if (length<0) return 0;
   int ia = length - 256;
   if (ia<0) ia = 0;
-  uint8_t *buf = (uint8_t *)malloc((length - ia) * 5);
+  //at most 256 registers go out, they fit the stack
+  uint8_t buf[256 * 5];
   for (int i = ia; i<length; i++) {
     buf[(i - ia) * 5 + 0] = val[i];
     buf[(i - ia) * 5 + 1] = val[i] >> 8;
@@ -272,7 +273,6 @@ int ztex_default_lsi_set2(HANDLE handle, uint8_t addr, const uint32_t *val, int
   }
   int status;
   TWO_TRIES(status, (int)control_transfer(handle, 0x40, 0x62, 0, 0, buf, (length - ia) * 5, 1500));
-  free(buf);
   return status;
 }
 
@@ -292,7 +292,7 @@ int ztex_default_lsi_set3(HANDLE handle, const uint8_t *addr, const uint32_t *va
   if (length<0) return 0;
   int ia = length - 256;
   if (ia<0) ia = 0;
-  uint8_t *buf = (uint8_t *)malloc((length - ia) * 5);
+  uint8_t buf[256 * 5];
   for (int i = ia; i<length; i++) {
     buf[(i - ia) * 5 + 0] = val[i];
     buf[(i - ia) * 5 + 1] = val[i] >> 8;
@@ -302,7 +302,6 @@ int ztex_default_lsi_set3(HANDLE handle, const uint8_t *addr, const uint32_t *va
   }
   int status;
   TWO_TRIES(status, (int)control_transfer(handle, 0x40, 0x62, 0, 0, buf, (length - ia) * 5, 1500));
-  free(buf);
   return status;
 }
 
@@ -337,7 +336,7 @@ int64_t ztex_default_lsi_get1(HANDLE handle, uint8_t addr) {
 int ztex_default_lsi_get2(HANDLE handle, uint8_t addr, uint32_t *val, int length) {
   int l = length;
   if (l>256) l = 256;
-  uint8_t *buf = (uint8_t *)malloc(l * 4);
+  uint8_t buf[256 * 4];
   int status;
   TWO_TRIES(status, (int)control_transfer(handle, 0xc0, 0x63, 0, addr, buf, l * 4, 1500));
   if (status < 0) return status;
@@ -345,6 +344,5 @@ int ztex_default_lsi_get2(HANDLE handle, uint8_t addr, uint32_t *val, int length
     int j = i & 255;
     val[i] = buf[j * 4 + 0] | (buf[j * 4 + 1] << 8) | (buf[j * 4 + 2] << 16) | (buf[j * 4 + 3] << 24);
   }
-  free(buf);
   return 0;
 }
@@ -1,7 +1,8 @@
 #include "stdafx.h"
 #include "midi.h"
 
-#include <intrin.h>
+#include "LockFree\SpscRing.h"
+#include <atomic>
 
 
 typedef struct MIDI_PORT* PMIDI_PORT;
@@ -75,6 +76,9 @@ error_unload:
 
 #define MAX_SYSEX_BUFFER	65535
 
+//bytes a port queues towards the device, a full sysex fits. At 3 bytes a ms that is 20s of midi
+static const uint32_t scTxQueueSize = 65536;
+
 class midiport
 {
 public:
@@ -96,19 +100,21 @@ private:
   struct MIDI_PORT* port;
   uint16_t rxlen;
   uint8_t data[MAX_SYSEX_BUFFER];
-  volatile DWORD txlen;
-  LPBYTE txbuff;
-  HANDLE hevent;
+
+  //the port's callback writes, the usb worker reads 3 bytes a packet
+  SpscRing txq;
+  std::atomic<uint32_t> txdrops;
+  uint8_t txmem[scTxQueueSize];
 };
 
 midiport::midiport()
   : port(nullptr)
   , rxlen(0)
-  , txlen(0)
-  , txbuff(nullptr)
-  , hevent(NULL)
   , data{ 0,0,0,0 }
-{}
+  , txdrops(0)
+{
+  txq.Init(txmem, 1, scTxQueueSize);
+}
 
 
 midiport::~midiport()
@@ -119,34 +125,21 @@ void midiport::cb(MIDI_PORT* midiPort, LPBYTE midiDataBytes, DWORD length)
 {
   if (midiPort == port && midiDataBytes && length)
   {
-    txbuff = midiDataBytes;
-    _InterlockedExchange(&txlen, length);
-    do {
-      //wait till the reader has read it all
-      DWORD r = WaitForSingleObject(hevent, 100);
-      if (r != WAIT_OBJECT_0)
-        break;
-    } while (_InterlockedExchange(&txlen, txlen) > 0);
+    //the message goes in whole or not at all, half a message would corrupt the stream after it.
+    //The sender isn't held up, a full queue drops and counts, the device thread logs the count
+    if (txq.Space() < length) {
+      txdrops.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    txq.Write(midiDataBytes, length);
   }
 }
 
 //called by the reader every ms so technically we throttle to 30kbps instead of 31k25
 bool midiport::read(uint8_t(&data)[4], uint8_t& size)
 {
-  int c = 0;
-  int len = _InterlockedExchange(&txlen, txlen);
-  if (len > 0) //the callback is waiting so we can proceed
-  {
-    for (; len > 0 && c < 3; len--, c++)
-      data[c] = *txbuff++;
-
-    size = c;
-    _InterlockedExchange(&txlen, txlen - c);
-    SetEvent(hevent);
-  }
-  else
-    size = 0;
-  return c > 0;
+  size = (uint8_t)txq.Read(data, 3);
+  return size > 0;
 }
 
 void midiport::open(uint8_t idx)
@@ -155,7 +148,6 @@ void midiport::open(uint8_t idx)
   swprintf_s(str, L"YMH01xUSB MIDI(%u)", idx + 1);
   port = lib.create_port(str, &scb, (DWORD_PTR)this, MAX_SYSEX_BUFFER, 1);
   rxlen = 0;
-  hevent = CreateEvent(nullptr, false, false, nullptr);
 }
 
 
@@ -163,8 +155,7 @@ void midiport::close()
 {
   if(port)
     lib.close_port(port);
-  if(hevent)
-    CloseHandle(hevent);
+  port = nullptr;
 }
 
 //------------------------------------------------------------------------------------
@@ -204,6 +195,15 @@ void MidiIO::Init()
       ports[i].rxlen = 0;
 }
 
+uint32_t MidiIO::TakeOutDrops()
+{
+  uint32_t drops = 0;
+  if (ports != nullptr)
+    for (int i = 0; i < 8; i++)
+      drops += ports[i].txdrops.exchange(0, std::memory_order_relaxed);
+  return drops;
+}
+
 
 static uint32_t msgnr = 0;
 
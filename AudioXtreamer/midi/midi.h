@@ -11,6 +11,9 @@ public:
   void Init();
   void MidiIn(uint8_t *ptr);
   uint8_t MidiOut(uint8_t* ptr);
+
+  //messages the ports dropped on a full tx queue since the last call
+  uint32_t TakeOutDrops();
  
 
 private: